@@ -0,0 +1,217 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "align.h"
+#include "compat.h"
+
+/*
+ * Which parts of a text line up with which parts of its translation. Both
+ * are cut into the same number of pieces, in order, and the nth piece of
+ * one is the counterpart of the nth of the other; a translation's pieces
+ * take turns between what lies between segments and the segments
+ * themselves, starting and ending with the former.
+ *
+ * Offsets are in characters. Each side keeps its pieces' lengths in a
+ * Fenwick tree, so that both finding the piece at an offset and changing
+ * the length of a piece, as the text is edited, take O(log n).
+ */
+struct align {
+	size_t	*len[2];	/* How long each piece is, on each side */
+	size_t	*tree[2];	/* The Fenwick tree of that, from 1 */
+	size_t	 n;		/* How many pieces there are */
+	size_t	 cap;		/* How many there is room for */
+};
+
+static void	bump(struct align *, enum align_side, size_t, size_t);
+static size_t	prefix(const struct align *, enum align_side, size_t);
+static size_t	lowbit(size_t);
+
+struct align *
+align_new(void)
+{
+	struct align	*al;
+
+	if ((al = calloc(1, sizeof(struct align))) == NULL)
+		err(1, "calloc");
+	return al;
+}
+
+void
+align_free(struct align *al)
+{
+	int	side;
+
+	if (al == NULL)
+		return;
+
+	for (side = ALIGN_SRC; side <= ALIGN_DST; side++) {
+		free(al->len[side]);
+		free(al->tree[side]);
+	}
+	free(al);
+}
+
+/*
+ * Add a piece after all the others: src_len characters of the text that
+ * line up with dst_len of the translation.
+ */
+void
+align_add(struct align *al, size_t src_len, size_t dst_len)
+{
+	size_t	k, j, sum;
+	int	side;
+
+	if (al->n == al->cap) {
+		al->cap = al->cap == 0 ? 64 : al->cap * 2;
+		for (side = ALIGN_SRC; side <= ALIGN_DST; side++) {
+			al->len[side] = reallocarray(al->len[side], al->cap,
+			    sizeof(size_t));
+			al->tree[side] = reallocarray(al->tree[side],
+			    al->cap + 1, sizeof(size_t));
+			if (al->len[side] == NULL || al->tree[side] == NULL)
+				err(1, "reallocarray");
+		}
+	}
+
+	k = ++al->n;
+	al->len[ALIGN_SRC][k - 1] = src_len;
+	al->len[ALIGN_DST][k - 1] = dst_len;
+
+	/* A node covers the lengths of the nodes below it, plus its own */
+	for (side = ALIGN_SRC; side <= ALIGN_DST; side++) {
+		sum = al->len[side][k - 1];
+		for (j = k - 1; j > k - lowbit(k); j -= lowbit(j))
+			sum += al->tree[side][j];
+		al->tree[side][k] = sum;
+	}
+}
+
+/*
+ * RETURN: the index of the piece that the character at off is in, on the
+ * given side; an offset at or past the end is in the last piece.
+ */
+size_t
+align_find(const struct align *al, enum align_side side, size_t off)
+{
+	size_t	pos, step;
+
+	if (al->n == 0)
+		return 0;
+
+	for (step = 1; step * 2 <= al->n; step *= 2)
+		;
+
+	/* The last piece that starts at or before off */
+	for (pos = 0; step > 0; step /= 2) {
+		if (pos + step <= al->n && al->tree[side][pos + step] <= off) {
+			pos += step;
+			off -= al->tree[side][pos];
+		}
+	}
+
+	return pos < al->n ? pos : al->n - 1;
+}
+
+/*
+ * RETURN: the offset that piece i starts at, on the given side.
+ */
+size_t
+align_start(const struct align *al, enum align_side side, size_t i)
+{
+	return prefix(al, side, i);
+}
+
+/*
+ * RETURN: how long piece i is, on the given side.
+ */
+size_t
+align_len(const struct align *al, enum align_side side, size_t i)
+{
+	return i < al->n ? al->len[side][i] : 0;
+}
+
+/*
+ * RETURN: how long all of the pieces are together, on the given side.
+ */
+size_t
+align_total(const struct align *al, enum align_side side)
+{
+	return prefix(al, side, al->n);
+}
+
+/*
+ * Note that n characters were put in at off, on the given side. They go in
+ * the piece that the character before them is in.
+ */
+void
+align_insert(struct align *al, enum align_side side, size_t off, size_t n)
+{
+	if (al->n == 0 || n == 0)
+		return;
+
+	bump(al, side, off > 0 ? align_find(al, side, off - 1) : 0, n);
+}
+
+/*
+ * Note that the n characters at off were taken out, on the given side,
+ * shortening each piece they were in.
+ */
+void
+align_delete(struct align *al, enum align_side side, size_t off, size_t n)
+{
+	size_t	i, end, take;
+
+	while (n > 0 && al->n > 0) {
+		i = align_find(al, side, off);
+		if ((end = prefix(al, side, i + 1)) <= off)
+			break;
+		take = MIN(end - off, n);
+		bump(al, side, i, -take);
+		n -= take;
+	}
+}
+
+/*
+ * Add delta, which may have wrapped around to stand for a negative number,
+ * to the length of piece i.
+ */
+static void
+bump(struct align *al, enum align_side side, size_t i, size_t delta)
+{
+	size_t	k;
+
+	al->len[side][i] += delta;
+	for (k = i + 1; k <= al->n; k += lowbit(k))
+		al->tree[side][k] += delta;
+}
+
+/*
+ * RETURN: how long the first k pieces are, together, on the given side.
+ */
+static size_t
+prefix(const struct align *al, enum align_side side, size_t k)
+{
+	size_t	sum;
+
+	if (k > al->n)
+		k = al->n;
+
+	for (sum = 0; k > 0; k -= lowbit(k))
+		sum += al->tree[side][k];
+	return sum;
+}
+
+/*
+ * RETURN: the lowest bit set in k.
+ */
+static size_t
+lowbit(size_t k)
+{
+	return k & (~k + 1);
+}
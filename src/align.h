@@ -0,0 +1,29 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include <sys/types.h>
+
+/*
+ * The two texts an alignment relates: what was translated, and what it was
+ * translated into.
+ */
+enum align_side {
+	ALIGN_SRC,
+	ALIGN_DST
+};
+
+struct align;
+
+struct align	*align_new(void);
+void		 align_free(struct align *);
+void		 align_add(struct align *, size_t, size_t);
+size_t		 align_find(const struct align *, enum align_side, size_t);
+size_t		 align_start(const struct align *, enum align_side, size_t);
+size_t		 align_len(const struct align *, enum align_side, size_t);
+size_t		 align_total(const struct align *, enum align_side);
+void		 align_insert(struct align *, enum align_side, size_t,
+		    size_t);
+void		 align_delete(struct align *, enum align_side, size_t,
+		    size_t);
+
+#endif /* !ALIGN_H */
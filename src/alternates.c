@@ -0,0 +1,364 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-glib/json-glib.h>
+
+#include "alternates.h"
+#include "rawjson.h"
+
+#define ELEM_SENTENCES	0	/* Where the translated sentences are */
+#define ELEM_DICTIONARY	1	/* Where the dictionary entries are (dt=bd) */
+#define ELEM_ALTERNATES	5	/* Where the alternate phrasings are (dt=at) */
+#define MAX_ALTERNATES	5	/* Show at most this many per phrase */
+
+/*
+ * One line of the panel, and the words or phrases that bring it up.
+ */
+struct entry {
+	GPtrArray	*keys;	/* Case-folded phrases that match */
+	gchar		*line;	/* What to show */
+};
+
+/*
+ * The alternate translations and dictionary entries of one translation job.
+ *
+ * Most translations are never looked at this closely, so the responses are
+ * only kept as they came in. The first lookup parses them, and each lookup
+ * is remembered, for as long as the job is.
+ */
+struct alternates {
+	GMutex		 lock;		/* Guards everything below */
+	GPtrArray	*raw;		/* Responses not yet parsed */
+	GPtrArray	*entries;	/* What the parsed ones had */
+	GHashTable	*seen;		/* Phrase to what it looked up */
+};
+
+static void		 parse_raw(struct alternates *, const char *);
+static void		 add_dictionary(struct alternates *, JsonArray *,
+    const char *);
+static void		 add_alternates(struct alternates *, JsonArray *);
+static JsonParser	*parse_element(const char *, size_t, JsonArray **);
+static JsonArray	*array_at(JsonArray *, guint);
+static const char	*string_at(JsonArray *, guint);
+static gchar		*fold(const char *);
+static void		 free_entry(gpointer);
+
+/*
+ * RETURN: an empty set of alternates.
+ */
+struct alternates *
+alternates_new(void)
+{
+	struct alternates	*a;
+
+	if ((a = calloc(1, sizeof(struct alternates))) == NULL)
+		err(1, "calloc");
+
+	g_mutex_init(&a->lock);
+	a->raw = g_ptr_array_new_with_free_func(free);
+	a->entries = g_ptr_array_new_with_free_func(free_entry);
+	a->seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	    g_free);
+
+	return a;
+}
+
+/*
+ * Keep a raw response, taking it over, to be parsed if it is ever needed.
+ */
+void
+alternates_add(struct alternates *a, char *raw)
+{
+	g_mutex_lock(&a->lock);
+	g_ptr_array_add(a->raw, raw);
+	g_mutex_unlock(&a->lock);
+}
+
+/*
+ * Look up the alternate translations and dictionary entries for a word or
+ * phrase, in either language.
+ *
+ * RETURN: one line for each, to be freed by the caller, or NULL if there are
+ * none.
+ */
+char *
+alternates_lookup(struct alternates *a, const char *phrase)
+{
+	struct entry	*e;
+	GString		*found;
+	gchar		*key, *lines;
+	char		*ret;
+	guint		 i, j;
+
+	key = fold(phrase);
+	ret = NULL;
+
+	g_mutex_lock(&a->lock);
+
+	for (i = 0; i < a->raw->len; i++)
+		parse_raw(a, g_ptr_array_index(a->raw, i));
+	g_ptr_array_set_size(a->raw, 0);
+
+	if ((lines = g_hash_table_lookup(a->seen, key)) == NULL) {
+		found = g_string_new(NULL);
+		for (i = 0; i < a->entries->len; i++) {
+			e = g_ptr_array_index(a->entries, i);
+			for (j = 0; j < e->keys->len; j++) {
+				if (strcmp(g_ptr_array_index(e->keys, j),
+				    key) != 0)
+					continue;
+				g_string_append(found, e->line);
+				g_string_append_c(found, '\n');
+				break;
+			}
+		}
+		lines = g_string_free(found, FALSE);
+		g_hash_table_insert(a->seen, key, lines);
+		key = NULL;
+	}
+
+	if (*lines != '\0' && (ret = strdup(lines)) == NULL)
+		err(1, "strdup");
+
+	g_mutex_unlock(&a->lock);
+
+	g_free(key);
+	return ret;
+}
+
+/*
+ * Free the alternates, parsed or not.
+ */
+void
+alternates_free(struct alternates *a)
+{
+	if (a == NULL)
+		return;
+
+	g_ptr_array_free(a->raw, TRUE);
+	g_ptr_array_free(a->entries, TRUE);
+	g_hash_table_destroy(a->seen);
+	g_mutex_clear(&a->lock);
+	free(a);
+}
+
+/*
+ * Pull the dictionary entries and alternate phrasings out of a response. The
+ * lock must be held.
+ */
+static void
+parse_raw(struct alternates *a, const char *raw)
+{
+	JsonParser	*parser;
+	JsonArray	*arr;
+	GString		*query;
+	const char	*orig;
+	guint		 i;
+
+	/* The dictionary is for the whole query, which is only one word */
+	query = g_string_new(NULL);
+	if ((parser = parse_element(raw, ELEM_SENTENCES, &arr)) != NULL) {
+		for (i = 0; i < json_array_get_length(arr); i++)
+			if ((orig = string_at(array_at(arr, i), 1)) != NULL)
+				g_string_append(query, orig);
+		g_object_unref(parser);
+	}
+
+	if ((parser = parse_element(raw, ELEM_DICTIONARY, &arr)) != NULL) {
+		add_dictionary(a, arr, query->str);
+		g_object_unref(parser);
+	}
+
+	if ((parser = parse_element(raw, ELEM_ALTERNATES, &arr)) != NULL) {
+		add_alternates(a, arr);
+		g_object_unref(parser);
+	}
+
+	g_string_free(query, TRUE);
+}
+
+/*
+ * Add a line for each part of speech in the dictionary, such as
+ * "noun: house, home", brought up by the query or any of its translations.
+ */
+static void
+add_dictionary(struct alternates *a, JsonArray *dict, const char *query)
+{
+	struct entry	*e;
+	JsonArray	*pos, *terms;
+	GString		*line;
+	const char	*name, *term;
+	guint		 i, j;
+
+	for (i = 0; i < json_array_get_length(dict); i++) {
+		pos = array_at(dict, i);
+		if ((name = string_at(pos, 0)) == NULL ||
+		    (terms = array_at(pos, 1)) == NULL)
+			continue;
+
+		if ((e = calloc(1, sizeof(struct entry))) == NULL)
+			err(1, "calloc");
+		e->keys = g_ptr_array_new_with_free_func(g_free);
+		g_ptr_array_add(e->keys, fold(query));
+
+		line = g_string_new(NULL);
+		g_string_append_printf(line, "%s:", name);
+		for (j = 0; j < json_array_get_length(terms); j++) {
+			if ((term = string_at(terms, j)) == NULL)
+				continue;
+			g_string_append_printf(line, "%s %s", j > 0 ? "," : "",
+			    term);
+			g_ptr_array_add(e->keys, fold(term));
+		}
+		e->line = g_string_free(line, FALSE);
+
+		g_ptr_array_add(a->entries, e);
+	}
+}
+
+/*
+ * Add a line for each phrase that has other translations, such as
+ * "the house: la maison, la demeure", brought up by the phrase or any of
+ * them.
+ */
+static void
+add_alternates(struct alternates *a, JsonArray *alts)
+{
+	struct entry	*e;
+	JsonArray	*phrase, *choices;
+	GString		*line;
+	const char	*src, *choice;
+	guint		 i, j;
+
+	for (i = 0; i < json_array_get_length(alts); i++) {
+		phrase = array_at(alts, i);
+		if ((src = string_at(phrase, 0)) == NULL ||
+		    (choices = array_at(phrase, 2)) == NULL ||
+		    json_array_get_length(choices) < 2)
+			continue;
+
+		if ((e = calloc(1, sizeof(struct entry))) == NULL)
+			err(1, "calloc");
+		e->keys = g_ptr_array_new_with_free_func(g_free);
+		g_ptr_array_add(e->keys, fold(src));
+
+		line = g_string_new(NULL);
+		g_string_append_printf(line, "%s:", src);
+		for (j = 0; j < json_array_get_length(choices) &&
+		    j < MAX_ALTERNATES; j++) {
+			if ((choice = string_at(array_at(choices, j), 0)) ==
+			    NULL)
+				continue;
+			g_string_append_printf(line, "%s %s", j > 0 ? "," : "",
+			    choice);
+			g_ptr_array_add(e->keys, fold(choice));
+		}
+		e->line = g_string_free(line, FALSE);
+
+		g_ptr_array_add(a->entries, e);
+	}
+}
+
+/*
+ * Parse one element of the top-level array of a response.
+ *
+ * RETURN: the parser, to be unreferenced by the caller, with arr set to the
+ * element; or NULL if the element is missing, not an array, or not UTF-8.
+ */
+static JsonParser *
+parse_element(const char *raw, size_t idx, JsonArray **arr)
+{
+	JsonParser	*parser;
+	JsonNode	*root;
+	char		*elem;
+	size_t		 off, len;
+	int		 ok;
+
+	if (rawjson_element(raw, strlen(raw), idx, &off, &len) == -1 ||
+	    len == 0 || (elem = rawjson_dup(raw + off, len)) == NULL)
+		return NULL;
+
+	parser = json_parser_new();
+	ok = json_parser_load_from_data(parser, elem, -1, NULL) &&
+	    JSON_NODE_HOLDS_ARRAY(root = json_parser_get_root(parser));
+	free(elem);
+
+	if (!ok) {
+		g_object_unref(parser);
+		return NULL;
+	}
+
+	*arr = json_node_get_array(root);
+	return parser;
+}
+
+/*
+ * RETURN: element i of the array if it is an array, otherwise NULL. The
+ * array itself may be NULL.
+ */
+static JsonArray *
+array_at(JsonArray *arr, guint i)
+{
+	JsonNode	*node;
+
+	if (arr == NULL || i >= json_array_get_length(arr))
+		return NULL;
+
+	node = json_array_get_element(arr, i);
+	return JSON_NODE_HOLDS_ARRAY(node) ? json_node_get_array(node) : NULL;
+}
+
+/*
+ * RETURN: element i of the array if it is a string, otherwise NULL. The
+ * array itself may be NULL.
+ */
+static const char *
+string_at(JsonArray *arr, guint i)
+{
+	JsonNode	*node;
+
+	if (arr == NULL || i >= json_array_get_length(arr))
+		return NULL;
+
+	node = json_array_get_element(arr, i);
+	if (!JSON_NODE_HOLDS_VALUE(node) ||
+	    json_node_get_value_type(node) != G_TYPE_STRING)
+		return NULL;
+	return json_node_get_string(node);
+}
+
+/*
+ * RETURN: the phrase with its ends trimmed and its case folded, for
+ * comparing; to be freed with g_free.
+ */
+static gchar *
+fold(const char *phrase)
+{
+	gchar	*trimmed, *folded;
+
+	trimmed = g_strstrip(g_strdup(phrase));
+	folded = g_utf8_casefold(trimmed, -1);
+	g_free(trimmed);
+
+	return folded;
+}
+
+/*
+ * Free an entry.
+ */
+static void
+free_entry(gpointer data)
+{
+	struct entry	*e;
+
+	e = (struct entry *)data;
+
+	g_ptr_array_free(e->keys, TRUE);
+	g_free(e->line);
+	free(e);
+}
@@ -0,0 +1,11 @@
+#ifndef ALTERNATES_H
+#define ALTERNATES_H
+
+struct alternates;
+
+struct alternates	*alternates_new(void);
+void			 alternates_add(struct alternates *, char *);
+char			*alternates_lookup(struct alternates *, const char *);
+void			 alternates_free(struct alternates *);
+
+#endif /* !ALTERNATES_H */
@@ -0,0 +1,267 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "compat.h"
+#include "alternates.h"
+#include "batcher.h"
+#include "upstream.h"
+
+/*
+ * A segment waiting to be sent.
+ */
+struct batch_item {
+	GBytes		*text;	/* The segment */
+	batcher_cb	 cb;	/* Who to tell about the translation */
+	void		*arg;	/* What to tell them with it */
+};
+
+/*
+ * The batcher packs segments into as few requests as the payload limit
+ * allows. Segments pile up until the next one would not fit, until the
+ * oldest has waited BATCHER_DEADLINE_MS, or until someone flushes; then the
+ * sender thread takes the whole pile and makes one request for it.
+ */
+struct batcher {
+	char			*src_lang;	/* The source language */
+	char			*dst_lang;	/* The destination language */
+	enum limit_class	 cls;		/* Who the requests are for */
+	struct alternates	*alts;		/* Where responses go, if anywhere */
+	GMutex			 lock;		/* Guards everything below */
+	GCond			 cond;		/* Signals a change below */
+	struct batch_item	*items;		/* The pending segments */
+	size_t			 n;		/* How many are pending */
+	size_t			 cap;		/* How many fit in items */
+	size_t			 body;		/* Their size as a POST body */
+	gint64			 deadline;	/* When they must be sent */
+	int			 flush;		/* Send without waiting */
+	int			 cancel;	/* Fail instead of sending */
+	int			 done;		/* No more are coming */
+	GThread			*thr;		/* The sender thread */
+};
+
+static gpointer	batcher_func(gpointer);
+static void	send_items(struct batcher *, struct batch_item *, size_t,
+		    int);
+
+/*
+ * Start a batcher for translations from one language to another, sending
+ * requests of class cls. If alts is not NULL, every response is kept there.
+ */
+struct batcher *
+batcher_new(const char *src_lang, const char *dst_lang,
+    struct alternates *alts, enum limit_class cls)
+{
+	struct batcher	*b;
+
+	if ((b = calloc(1, sizeof(struct batcher))) == NULL)
+		err(1, "calloc");
+
+	if ((b->src_lang = strdup(src_lang)) == NULL)
+		err(1, "strdup");
+	if ((b->dst_lang = strdup(dst_lang)) == NULL)
+		err(1, "strdup");
+	b->alts = alts;
+	b->cls = cls;
+
+	g_mutex_init(&b->lock);
+	g_cond_init(&b->cond);
+	b->thr = g_thread_new("batcher", batcher_func, b);
+
+	return b;
+}
+
+/*
+ * Queue a segment for translation, holding a reference to it rather than a
+ * copy. The callback runs on the sender thread, in the order the segments
+ * were added. An empty segment is not sent but still gets its callback, with
+ * an empty translation, in its turn.
+ *
+ * This blocks while the pending batch is full.
+ */
+void
+batcher_add(struct batcher *b, GBytes *text, batcher_cb cb, void *arg)
+{
+	struct batch_item	*item;
+	size_t			 field, len;
+
+	len = g_bytes_get_size(text);
+	field = len > 0 ?
+	    upstream_field_len(g_bytes_get_data(text, NULL), len) : 0;
+
+	g_mutex_lock(&b->lock);
+
+	while (b->n > 0 && b->body + field > UPSTREAM_MAX_BODY) {
+		b->flush = 1;
+		g_cond_broadcast(&b->cond);
+		g_cond_wait(&b->cond, &b->lock);
+	}
+
+	if (b->n == b->cap) {
+		b->cap = b->cap == 0 ? 16 : b->cap * 2;
+		b->items = reallocarray(b->items, b->cap,
+		    sizeof(struct batch_item));
+		if (b->items == NULL)
+			err(1, "reallocarray");
+	}
+
+	item = &b->items[b->n++];
+	item->text = g_bytes_ref(text);
+	item->cb = cb;
+	item->arg = arg;
+
+	if (b->n == 1)
+		b->deadline = g_get_monotonic_time() +
+		    BATCHER_DEADLINE_MS * 1000;
+	b->body += field;
+
+	g_cond_broadcast(&b->cond);
+	g_mutex_unlock(&b->lock);
+}
+
+/*
+ * Send the pending segments now instead of waiting for the deadline.
+ */
+void
+batcher_flush(struct batcher *b)
+{
+	g_mutex_lock(&b->lock);
+	b->flush = 1;
+	g_cond_broadcast(&b->cond);
+	g_mutex_unlock(&b->lock);
+}
+
+/*
+ * Stop sending: everything pending, and anything added from now on, fails
+ * without a request being made. A request already on its way is let be.
+ */
+void
+batcher_cancel(struct batcher *b)
+{
+	g_mutex_lock(&b->lock);
+	b->cancel = 1;
+	g_cond_broadcast(&b->cond);
+	g_mutex_unlock(&b->lock);
+}
+
+/*
+ * Send everything that is pending, wait for the callbacks to finish, and
+ * free the batcher.
+ */
+void
+batcher_free(struct batcher *b)
+{
+	g_mutex_lock(&b->lock);
+	b->done = 1;
+	g_cond_broadcast(&b->cond);
+	g_mutex_unlock(&b->lock);
+
+	g_thread_join(b->thr);
+
+	g_mutex_clear(&b->lock);
+	g_cond_clear(&b->cond);
+	free(b->items);
+	free(b->src_lang);
+	free(b->dst_lang);
+	free(b);
+}
+
+/*
+ * The sender thread: wait for a batch to be ready, then send it.
+ */
+static gpointer
+batcher_func(gpointer data)
+{
+	struct batcher		*b;
+	struct batch_item	*items;
+	size_t			 n;
+	int			 cancel;
+
+	b = (struct batcher *)data;
+
+	g_mutex_lock(&b->lock);
+
+	for (;;) {
+		if (b->n == 0) {
+			if (b->done)
+				break;
+			b->flush = 0;
+			g_cond_wait(&b->cond, &b->lock);
+			continue;
+		}
+
+		if (!b->done && !b->flush && !b->cancel &&
+		    b->body < UPSTREAM_MAX_BODY &&
+		    g_get_monotonic_time() < b->deadline) {
+			g_cond_wait_until(&b->cond, &b->lock, b->deadline);
+			continue;
+		}
+
+		items = b->items;
+		n = b->n;
+		b->items = NULL;
+		b->n = b->cap = b->body = 0;
+		b->flush = 0;
+		cancel = b->cancel;
+		g_cond_broadcast(&b->cond);
+
+		g_mutex_unlock(&b->lock);
+		send_items(b, items, n, cancel);
+		g_mutex_lock(&b->lock);
+	}
+
+	g_mutex_unlock(&b->lock);
+
+	return NULL;
+}
+
+/*
+ * Translate the non-empty segments in one request, then run every callback
+ * in order. If cancel is set, they all fail without a request.
+ */
+static void
+send_items(struct batcher *b, struct batch_item *items, size_t n, int cancel)
+{
+	GBytes		**q;
+	char		**out, *raw;
+	size_t		  i, nq;
+	int		  ok;
+
+	q = reallocarray(NULL, n, sizeof(GBytes *));
+	out = reallocarray(NULL, n, sizeof(char *));
+	if (q == NULL || out == NULL)
+		err(1, "reallocarray");
+
+	for (i = nq = 0; i < n; i++)
+		if (g_bytes_get_size(items[i].text) > 0)
+			q[nq++] = items[i].text;
+
+	raw = NULL;
+	ok = nq == 0 || (!cancel &&
+	    upstream_translate(b->src_lang, b->dst_lang, q, nq, out,
+	    b->alts != NULL ? &raw : NULL, b->cls) == 0);
+	if (raw != NULL)
+		alternates_add(b->alts, raw);
+
+	for (i = nq = 0; i < n; i++) {
+		if (g_bytes_get_size(items[i].text) == 0)
+			items[i].cb("", items[i].arg);
+		else
+			items[i].cb(ok ? out[nq++] : NULL, items[i].arg);
+		g_bytes_unref(items[i].text);
+	}
+
+	if (ok)
+		for (i = 0; i < nq; i++)
+			free(out[i]);
+
+	free(items);
+	free(q);
+	free(out);
+}
@@ -0,0 +1,29 @@
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include <sys/types.h>
+
+#include <glib.h>
+
+#include "limit.h"
+
+/* How long a lone segment waits for company before it is sent anyway */
+#define BATCHER_DEADLINE_MS	10
+
+/*
+ * Called with the translation of a segment, or NULL if it failed. The
+ * translation is only valid for the duration of the call.
+ */
+typedef void	(*batcher_cb)(const char *, void *);
+
+struct alternates;
+struct batcher;
+
+struct batcher	*batcher_new(const char *, const char *, struct alternates *,
+		    enum limit_class);
+void		 batcher_add(struct batcher *, GBytes *, batcher_cb, void *);
+void		 batcher_flush(struct batcher *);
+void		 batcher_cancel(struct batcher *);
+void		 batcher_free(struct batcher *);
+
+#endif /* !BATCHER_H */
@@ -0,0 +1,279 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "cache.h"
+#include "metrics.h"
+
+/*
+ * A cached translation. The key is the source language, the destination
+ * language, and the segment, joined by tabs; no language code has a tab in
+ * it, so no two segments share a key.
+ */
+struct entry {
+	gchar	*key;		/* What was translated */
+	gchar	*value;		/* What it translated to */
+	size_t	 size;		/* How many bytes the two take */
+	GList	 link;		/* Where it is in the recency list */
+};
+
+/*
+ * Translations of segments, most recently used first. The least recently
+ * used are dropped once they take more than CACHE_MAX_BYTES.
+ */
+static struct {
+	GMutex		 lock;		/* Guards everything below */
+	GHashTable	*table;		/* Key to entry */
+	GQueue		 lru;		/* Entries, the most recent at the head */
+	size_t		 size;		/* How many bytes the entries take */
+	char		*path;		/* Where to keep them, or NULL */
+} cache;
+
+static char	*cache_path(void);
+static void	 insert(struct entry *);
+static gchar	*make_key(const char *, const char *, const char *, size_t);
+static void	 drop_entry(struct entry *);
+static void	 free_entry(gpointer);
+
+/*
+ * Fill the cache with what was in it when it was last saved, and save it
+ * again on exit. The file is a run of records, least recently used first,
+ * each "keylen valuelen\n" followed by the key, the value, and a newline,
+ * so no character in either needs escaping.
+ */
+void
+cache_load(void)
+{
+	FILE		*fp;
+	struct entry	*e;
+	size_t		 klen, vlen;
+
+	if ((cache.path = cache_path()) == NULL)
+		return;
+	if (atexit(cache_save) != 0)
+		err(1, "atexit");
+
+	if ((fp = fopen(cache.path, "r")) == NULL)
+		return;
+
+	while (fscanf(fp, "%zu %zu", &klen, &vlen) == 2 && fgetc(fp) == '\n') {
+		if (klen + vlen + sizeof(struct entry) > CACHE_MAX_BYTES)
+			break;
+		if ((e = calloc(1, sizeof(struct entry))) == NULL)
+			err(1, "calloc");
+		e->key = g_malloc(klen + 1);
+		e->value = g_malloc(vlen + 1);
+		if (fread(e->key, 1, klen, fp) != klen ||
+		    fread(e->value, 1, vlen, fp) != vlen ||
+		    fgetc(fp) != '\n') {
+			free_entry(e);
+			break;
+		}
+		e->key[klen] = '\0';
+		e->value[vlen] = '\0';
+		e->size = klen + vlen + sizeof(struct entry);
+		e->link.data = e;
+
+		g_mutex_lock(&cache.lock);
+		insert(e);
+		g_mutex_unlock(&cache.lock);
+	}
+
+	if (ferror(fp))
+		warn("%s", cache.path);
+	fclose(fp);
+}
+
+/*
+ * Write the cache out for next time, beside the old copy and then over it.
+ */
+void
+cache_save(void)
+{
+	FILE		*fp;
+	GList		*l;
+	struct entry	*e;
+	char		*tmp;
+
+	if (cache.path == NULL)
+		return;
+	if (asprintf(&tmp, "%s.tmp", cache.path) == -1)
+		err(1, "asprintf");
+
+	g_mutex_lock(&cache.lock);
+
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		warn("%s", tmp);
+		goto done;
+	}
+
+	for (l = cache.lru.tail; l != NULL; l = l->prev) {
+		e = (struct entry *)l->data;
+		fprintf(fp, "%zu %zu\n%s%s\n", strlen(e->key),
+		    strlen(e->value), e->key, e->value);
+	}
+
+	if (fclose(fp) == EOF)
+		warn("%s", tmp);
+	else if (rename(tmp, cache.path) == -1)
+		warn("rename %s", cache.path);
+
+done:
+	g_mutex_unlock(&cache.lock);
+	free(tmp);
+}
+
+/*
+ * Look up the translation of a segment.
+ *
+ * RETURN: a copy of the translation, to be freed by the caller, or NULL if
+ * it is not cached.
+ */
+char *
+cache_get(const char *src_lang, const char *dst_lang, const char *text,
+    size_t len)
+{
+	struct entry	*e;
+	gchar		*key;
+	char		*value;
+
+	key = make_key(src_lang, dst_lang, text, len);
+	value = NULL;
+
+	g_mutex_lock(&cache.lock);
+
+	if (cache.table != NULL &&
+	    (e = g_hash_table_lookup(cache.table, key)) != NULL) {
+		g_queue_unlink(&cache.lru, &e->link);
+		g_queue_push_head_link(&cache.lru, &e->link);
+		if ((value = strdup(e->value)) == NULL)
+			err(1, "strdup");
+	}
+
+	g_mutex_unlock(&cache.lock);
+
+	metrics_add(value != NULL ? METRIC_CACHE_HITS : METRIC_CACHE_MISSES, 1);
+	g_free(key);
+	return value;
+}
+
+/*
+ * Remember the translation of a segment, replacing any older one, and make
+ * room for it.
+ */
+void
+cache_put(const char *src_lang, const char *dst_lang, const char *text,
+    size_t len, const char *translation)
+{
+	struct entry	*e;
+
+	if ((e = calloc(1, sizeof(struct entry))) == NULL)
+		err(1, "calloc");
+	e->key = make_key(src_lang, dst_lang, text, len);
+	e->value = g_strdup(translation);
+	e->size = strlen(e->key) + strlen(e->value) + sizeof(struct entry);
+	e->link.data = e;
+
+	if (e->size > CACHE_MAX_BYTES) {
+		free_entry(e);
+		return;
+	}
+
+	g_mutex_lock(&cache.lock);
+	insert(e);
+	g_mutex_unlock(&cache.lock);
+}
+
+/*
+ * RETURN: the file to keep the cache in, to be freed by the caller, or NULL
+ * to keep it only in memory. IDIOM_CACHE names the file; set but empty, it
+ * turns keeping it off.
+ */
+static char *
+cache_path(void)
+{
+	const char	*s;
+	char		*path, *dir;
+
+	if ((s = getenv("IDIOM_CACHE")) != NULL)
+		return *s == '\0' ? NULL : g_strdup(s);
+
+	path = g_build_filename(g_get_user_cache_dir(), CACHE_FILE, NULL);
+	dir = g_path_get_dirname(path);
+	if (g_mkdir_with_parents(dir, 0700) == -1) {
+		warn("%s", dir);
+		g_free(path);
+		path = NULL;
+	}
+	g_free(dir);
+
+	return path;
+}
+
+/*
+ * Add an entry as the most recently used, replacing any older one with the
+ * same key, and make room for it. The lock must be held.
+ */
+static void
+insert(struct entry *e)
+{
+	struct entry	*old;
+
+	if (cache.table == NULL)
+		cache.table = g_hash_table_new_full(g_str_hash, g_str_equal,
+		    NULL, free_entry);
+
+	if ((old = g_hash_table_lookup(cache.table, e->key)) != NULL)
+		drop_entry(old);
+
+	while (cache.size + e->size > CACHE_MAX_BYTES)
+		drop_entry(cache.lru.tail->data);
+
+	g_hash_table_insert(cache.table, e->key, e);
+	g_queue_push_head_link(&cache.lru, &e->link);
+	cache.size += e->size;
+}
+
+/*
+ * RETURN: the key for a segment, to be freed with g_free.
+ */
+static gchar *
+make_key(const char *src_lang, const char *dst_lang, const char *text,
+    size_t len)
+{
+	return g_strdup_printf("%s\t%s\t%.*s", src_lang, dst_lang, (int)len,
+	    text);
+}
+
+/*
+ * Take an entry out of the cache and free it. The lock must be held.
+ */
+static void
+drop_entry(struct entry *e)
+{
+	g_queue_unlink(&cache.lru, &e->link);
+	cache.size -= e->size;
+	g_hash_table_remove(cache.table, e->key);
+}
+
+/*
+ * Free an entry that is no longer in the recency list.
+ */
+static void
+free_entry(gpointer data)
+{
+	struct entry	*e;
+
+	e = (struct entry *)data;
+
+	g_free(e->key);
+	g_free(e->value);
+	free(e);
+}
@@ -0,0 +1,18 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <sys/types.h>
+
+/* The most text the cache holds, in bytes */
+#define CACHE_MAX_BYTES	(4 * 1024 * 1024)
+
+/* Where the cache is kept between runs, under the user's cache directory */
+#define CACHE_FILE	"idiom/translations"
+
+void	 cache_load(void);
+void	 cache_save(void);
+char	*cache_get(const char *, const char *, const char *, size_t);
+void	 cache_put(const char *, const char *, const char *, size_t,
+	    const char *);
+
+#endif /* !CACHE_H */
@@ -0,0 +1,105 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "dedup.h"
+#include "metrics.h"
+
+/*
+ * The segments of one document seen so far, so that a segment that comes
+ * up again, such as a header, a legal line, or a table cell, is sent only
+ * once. Segments that differ only in their whitespace count as the same.
+ */
+struct dedup {
+	GHashTable	*seen;		/* Normalized segment to index, plus 1 */
+};
+
+static gchar	*normalize(const char *, size_t);
+
+/*
+ * RETURN: an empty set of segments.
+ */
+struct dedup *
+dedup_new(void)
+{
+	struct dedup	*d;
+
+	if ((d = malloc(sizeof(struct dedup))) == NULL)
+		err(1, "malloc");
+	d->seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	return d;
+}
+
+/*
+ * Look for a segment among those seen before, and if it is not there,
+ * remember it as the one at index idx. A segment found is counted in the
+ * metrics as a request saved.
+ *
+ * RETURN: the index of the same segment seen before, or -1 if it is new.
+ */
+ssize_t
+dedup_find(struct dedup *d, const char *text, size_t len, size_t idx)
+{
+	gchar		*key;
+	gpointer	 found;
+
+	key = normalize(text, len);
+
+	if ((found = g_hash_table_lookup(d->seen, key)) != NULL) {
+		g_free(key);
+		metrics_add(METRIC_DEDUP_HITS, 1);
+		metrics_add(METRIC_DEDUP_BYTES, len);
+		return GPOINTER_TO_SIZE(found) - 1;
+	}
+
+	g_hash_table_insert(d->seen, key, GSIZE_TO_POINTER(idx + 1));
+	return -1;
+}
+
+/*
+ * Free the set.
+ */
+void
+dedup_free(struct dedup *d)
+{
+	if (d == NULL)
+		return;
+
+	g_hash_table_destroy(d->seen);
+	free(d);
+}
+
+/*
+ * RETURN: the text with each run of whitespace turned into one space, and
+ * none at either end, to be freed with g_free.
+ */
+static gchar *
+normalize(const char *text, size_t len)
+{
+	gchar	*s;
+	size_t	 i, n;
+	int	 space;
+
+	s = g_malloc(len + 1);
+	space = 0;
+
+	for (i = n = 0; i < len; i++) {
+		if (g_ascii_isspace(text[i])) {
+			space = n > 0;
+			continue;
+		}
+		if (space)
+			s[n++] = ' ';
+		space = 0;
+		s[n++] = text[i];
+	}
+	s[n] = '\0';
+
+	return s;
+}
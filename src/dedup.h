@@ -0,0 +1,12 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <sys/types.h>
+
+struct dedup;
+
+struct dedup	*dedup_new(void);
+ssize_t		 dedup_find(struct dedup *, const char *, size_t, size_t);
+void		 dedup_free(struct dedup *);
+
+#endif /* !DEDUP_H */
@@ -0,0 +1,6 @@
+#ifndef EXTERN_H
+#define EXTERN_H
+
+void	xwarn(const char *fmt, ...);
+
+#endif /* !EXTERN_H */
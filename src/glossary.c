@@ -0,0 +1,956 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "compat.h"
+#include "glossary.h"
+
+#define NONE	UINT32_MAX	/* No state, term, or edge */
+
+/*
+ * A compiled glossary is an Aho-Corasick automaton over the bytes of its
+ * terms, laid out as one block so that it can be mapped straight from a
+ * file: this header, then the states, the edge targets, the terms, their
+ * translations, the edge labels, and the text they all point into.
+ *
+ * States are numbered breadth first, so that a state's failure link always
+ * points back to an earlier one and its children always come later; the
+ * edges of each state are sorted by byte.
+ */
+struct header {
+	char		magic[8];	/* GLOSSARY_MAGIC */
+	uint64_t	src_size;	/* The size of the glossary compiled */
+	int64_t		src_mtime;	/* And when it was changed, in ns */
+	uint32_t	nstates;	/* How many states there are */
+	uint32_t	nedges;		/* How many edges */
+	uint32_t	nterms;		/* How many terms */
+	uint32_t	nsubs;		/* How many fixed translations */
+	uint32_t	npool;		/* How many bytes of text */
+	uint32_t	maxlen;		/* How long the longest term is */
+};
+
+struct state {
+	uint32_t	edge;		/* Its first edge */
+	uint32_t	nedge;		/* How many edges it has */
+	uint32_t	fail;		/* The longest proper suffix that is a state */
+	uint32_t	term;		/* The term it spells, or NONE */
+	uint32_t	dict;		/* The longest suffix that spells one */
+};
+
+struct term {
+	uint32_t	off;		/* Where it is in the text */
+	uint32_t	len;		/* How long it is */
+	uint32_t	sub;		/* Its first fixed translation */
+	uint32_t	nsub;		/* How many it has, by language */
+};
+
+struct sub {
+	uint32_t	lang;		/* Where its language is in the text */
+	uint32_t	langlen;	/* How long that is */
+	uint32_t	off;		/* Where the translation is */
+	uint32_t	len;		/* How long it is */
+};
+
+/*
+ * The parts of a compiled glossary.
+ */
+struct automaton {
+	struct header	*h;
+	struct state	*states;
+	uint32_t	*targets;	/* Where each edge goes */
+	struct term	*terms;
+	struct sub	*subs;
+	uint8_t		*labels;	/* The byte on each edge */
+	char		*pool;		/* The text */
+};
+
+/*
+ * A line of the glossary, while it is being compiled.
+ */
+struct entry {
+	char		*term;		/* The term */
+	size_t		 len;		/* Its length */
+	char		*lang;		/* The language it has a translation in */
+	char		*sub;		/* That translation */
+	size_t		 line;		/* Where it was given */
+};
+
+/*
+ * The terms replaced in one text, by their placeholder's number, less one.
+ */
+struct glossary_terms {
+	uint32_t	*ids;		/* The terms */
+	size_t		 n;		/* How many there are */
+	size_t		 size;		/* How many there is room for */
+};
+
+/*
+ * A term found in a text, which a longer one that starts earlier may yet
+ * push out.
+ */
+struct match {
+	size_t		start;		/* Where it starts */
+	uint32_t	term;		/* Which term it is */
+};
+
+/*
+ * A text being protected.
+ */
+struct protect {
+	const char		*text;	/* The text */
+	size_t			 from;	/* How much of it is done */
+	GString			*out;	/* What it has become, once it changes */
+	struct glossary_terms	*terms;	/* The terms replaced so far */
+	GHashTable		*index;	/* Their numbers, by term */
+	struct match		*held;	/* Terms found, not yet replaced */
+	size_t			 nheld;	/* How many there are */
+};
+
+/*
+ * The glossary, loaded once before any translation starts and never
+ * changed after, so it can be read from any thread.
+ */
+static struct automaton	gl;
+
+static int		 map(const char *, const struct stat *, void **,
+    size_t *);
+static int		 view(void *, size_t, struct automaton *);
+static int		 sound(const struct automaton *);
+static void		 compile(const char *, const struct stat *, void **,
+    size_t *);
+static size_t		 read_entries(const char *, struct entry **);
+static void		 save(const char *, const void *, size_t);
+static uint32_t		 go(const struct automaton *, uint32_t, uint8_t);
+static int		 whole(const char *, size_t, size_t,
+    const struct term *);
+static int		 is_word(char);
+static void		 consider(struct protect *, size_t, uint32_t);
+static void		 settle(struct protect *, size_t);
+static void		 replace(struct protect *, size_t, uint32_t);
+static const char	*placeholder(const char *, const char *, size_t,
+    size_t *);
+static int		 cmp_entry(const void *, const void *);
+static uint32_t		 count(size_t);
+static int64_t		 mtime(const struct stat *);
+
+/*
+ * Load the glossary at path, of terms to keep out of translations. Each
+ * line is a term to leave as it is, or a term, a language, and what to put
+ * in its place in that language, separated by tabs; lines that are blank
+ * or start with # are skipped.
+ *
+ * The glossary is compiled into an automaton that finds every term in one
+ * pass over a text, however many terms there are, and the result is kept
+ * beside it, with GLOSSARY_SUFFIX added, to be mapped into memory as it is
+ * the next time. The path can also name a compiled glossary itself.
+ */
+void
+glossary_load(const char *path)
+{
+	struct stat	 sb;
+	char		*compiled;
+	void		*img;
+	size_t		 size;
+
+	if (stat(path, &sb) == -1)
+		err(1, "%s", path);
+
+	switch (map(path, NULL, &img, &size)) {
+	case -1:
+		errx(1, "%s: damaged compiled glossary", path);
+		/* NOTREACHED */
+		break;
+	case 1:
+		view(img, size, &gl);
+		return;
+	}
+
+	if (asprintf(&compiled, "%s%s", path, GLOSSARY_SUFFIX) == -1)
+		err(1, "asprintf");
+	if (map(compiled, &sb, &img, &size) != 1) {
+		compile(path, &sb, &img, &size);
+		save(compiled, img, size);
+	}
+	free(compiled);
+
+	view(img, size, &gl);
+}
+
+/*
+ * RETURN: whether there is a glossary to protect terms with.
+ */
+int
+glossary_on(void)
+{
+	return gl.h != NULL;
+}
+
+/*
+ * Replace the terms of the glossary found in text with numbered
+ * placeholders, which the backend leaves alone, in one pass. A term is
+ * only found as a whole word, and where terms overlap, the one that starts
+ * first wins, then the longer one. Every place a term comes up gets the
+ * same number.
+ *
+ * RETURN: the text with the terms replaced, with terms set to what they
+ * were, or to NULL if there were none.
+ */
+GBytes *
+glossary_protect(GBytes *text, struct glossary_terms **terms)
+{
+	struct protect		 p;
+	const struct term	*t;
+	const char		*s;
+	size_t			 len, i;
+	uint32_t		 st, w, o;
+
+	*terms = NULL;
+	if (gl.h == NULL)
+		return g_bytes_ref(text);
+
+	s = g_bytes_get_data(text, &len);
+	memset(&p, 0, sizeof(p));
+	p.text = s;
+
+	/* They do not overlap, and each starts in the last maxlen bytes */
+	if ((p.held = reallocarray(NULL, (size_t)gl.h->maxlen + 1,
+	    sizeof(struct match))) == NULL)
+		err(1, "reallocarray");
+
+	for (i = 0, st = 0; i < len; i++) {
+		while ((w = go(&gl, st, s[i])) == NONE && st != 0)
+			st = gl.states[st].fail;
+		st = w != NONE ? w : 0;
+
+		/* The longest term ending here that is a whole word */
+		o = gl.states[st].term != NONE ? st : gl.states[st].dict;
+		for (t = NULL; o != NONE; o = gl.states[o].dict) {
+			t = &gl.terms[gl.states[o].term];
+			if (whole(s, len, i + 1 - t->len, t))
+				break;
+		}
+		if (o != NONE)
+			consider(&p, i + 1 - t->len, gl.states[o].term);
+		settle(&p, i + 1);
+	}
+	settle(&p, len + gl.h->maxlen);
+	free(p.held);
+
+	if (p.out == NULL)
+		return g_bytes_ref(text);
+
+	g_string_append_len(p.out, s + p.from, len - p.from);
+	g_hash_table_destroy(p.index);
+	*terms = p.terms;
+	return g_string_free_to_bytes(p.out);
+}
+
+/*
+ * Weigh a term found at start against those found before it but not yet
+ * replaced: one that overlaps it and starts first keeps it out, and it
+ * pushes out any it overlaps that start at or after it, which are shorter.
+ */
+static void
+consider(struct protect *p, size_t start, uint32_t term)
+{
+	const struct match	*m;
+	size_t			 k;
+
+	/* Overlaps one already replaced, which started first */
+	if (start < p->from)
+		return;
+
+	for (k = 0; k < p->nheld; k++) {
+		m = &p->held[k];
+		if (m->start + gl.terms[m->term].len > start)
+			break;
+	}
+	if (k < p->nheld && p->held[k].start < start)
+		return;
+
+	p->nheld = k;
+	p->held[p->nheld].start = start;
+	p->held[p->nheld++].term = term;
+}
+
+/*
+ * Replace the terms found that no term ending at or after end could push
+ * out, because none is long enough to start at or before them.
+ */
+static void
+settle(struct protect *p, size_t end)
+{
+	size_t	k;
+
+	for (k = 0; k < p->nheld &&
+	    p->held[k].start + gl.h->maxlen <= end; k++)
+		replace(p, p->held[k].start, p->held[k].term);
+
+	p->nheld -= k;
+	memmove(p->held, p->held + k, p->nheld *
+	    sizeof(struct match));
+}
+
+/*
+ * Put the terms back in place of the placeholders in a translation into
+ * dst_lang: the glossary's translation into that language, if it has one,
+ * and otherwise the term as it was. With no dst_lang, every term goes back
+ * as it was, which gives back the text before it was protected. The backend
+ * may have put spaces inside a placeholder; anything that is not one is
+ * left as it is.
+ *
+ * RETURN: the translation with the terms in place.
+ */
+GBytes *
+glossary_restore(GBytes *text, const struct glossary_terms *terms,
+    const char *dst_lang)
+{
+	const struct term	*t;
+	const struct sub	*sub;
+	const char		*s, *end, *p, *q, *r;
+	GString			*out;
+	size_t			 len, k, i;
+
+	if (terms == NULL)
+		return g_bytes_ref(text);
+
+	s = g_bytes_get_data(text, &len);
+	end = s + len;
+	out = g_string_sized_new(len);
+
+	for (p = s; (q = memmem(p, end - p, GLOSSARY_OPEN,
+	    strlen(GLOSSARY_OPEN))) != NULL; p = r) {
+		g_string_append_len(out, p, q - p);
+		if ((r = placeholder(q, end, terms->n, &k)) == NULL) {
+			r = q + strlen(GLOSSARY_OPEN);
+			g_string_append_len(out, q, r - q);
+			continue;
+		}
+
+		t = &gl.terms[terms->ids[k - 1]];
+		for (i = 0; dst_lang != NULL && i < t->nsub; i++) {
+			sub = &gl.subs[t->sub + i];
+			if (sub->langlen == strlen(dst_lang) &&
+			    memcmp(gl.pool + sub->lang, dst_lang,
+			    sub->langlen) == 0)
+				break;
+		}
+		if (dst_lang != NULL && i < t->nsub)
+			g_string_append_len(out, gl.pool + sub->off, sub->len);
+		else
+			g_string_append_len(out, gl.pool + t->off, t->len);
+	}
+	g_string_append_len(out, p, end - p);
+
+	return g_string_free_to_bytes(out);
+}
+
+/*
+ * Free the terms replaced in a text; NULL is fine.
+ */
+void
+glossary_terms_free(struct glossary_terms *terms)
+{
+	if (terms == NULL)
+		return;
+
+	free(terms->ids);
+	free(terms);
+}
+
+/*
+ * Map the compiled glossary at path into memory. If src is given, the
+ * compiled glossary only counts if it was made from that file as it is now.
+ *
+ * RETURN: 1 with img and size set, 0 if path is not a compiled glossary or
+ * is out of date, or -1 if it is damaged.
+ */
+static int
+map(const char *path, const struct stat *src, void **img, size_t *size)
+{
+	struct automaton	 a;
+	struct stat		 sb;
+	void			*p;
+	int			 fd, ret;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return 0;
+	if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) ||
+	    (size_t)sb.st_size < sizeof(struct header)) {
+		close(fd);
+		return 0;
+	}
+
+	p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		warn("mmap %s", path);
+		return 0;
+	}
+
+	ret = 0;
+	if (memcmp(p, GLOSSARY_MAGIC, strlen(GLOSSARY_MAGIC)) != 0)
+		goto done;
+	if (!view(p, sb.st_size, &a) || !sound(&a)) {
+		ret = -1;
+		goto done;
+	}
+	if (src != NULL && (a.h->src_size != (uint64_t)src->st_size ||
+	    a.h->src_mtime != mtime(src)))
+		goto done;
+
+	*img = p;
+	*size = sb.st_size;
+	return 1;
+
+done:
+	munmap(p, sb.st_size);
+	return ret;
+}
+
+/*
+ * Find the parts of the compiled glossary in img.
+ *
+ * RETURN: 1 with a set to the parts, or 0 if they do not add up to size.
+ */
+static int
+view(void *img, size_t size, struct automaton *a)
+{
+	const struct header	*h;
+	uint64_t		 need;
+
+	h = a->h = (struct header *)img;
+	need = sizeof(struct header) +
+	    (uint64_t)h->nstates * sizeof(struct state) +
+	    (uint64_t)h->nedges * (sizeof(uint32_t) + sizeof(uint8_t)) +
+	    (uint64_t)h->nterms * sizeof(struct term) +
+	    (uint64_t)h->nsubs * sizeof(struct sub) + h->npool;
+	if (need != size || h->nstates == 0)
+		return 0;
+
+	a->states = (struct state *)(a->h + 1);
+	a->targets = (uint32_t *)(a->states + h->nstates);
+	a->terms = (struct term *)(a->targets + h->nedges);
+	a->subs = (struct sub *)(a->terms + h->nterms);
+	a->labels = (uint8_t *)(a->subs + h->nsubs);
+	a->pool = (char *)(a->labels + h->nedges);
+
+	return 1;
+}
+
+/*
+ * Check that the parts of a compiled glossary fit together: that every
+ * index is in range, and that every link followed while matching leads
+ * back to an earlier state, so that matching always ends.
+ *
+ * RETURN: whether the glossary is sound.
+ */
+static int
+sound(const struct automaton *a)
+{
+	const struct header	*h;
+	uint32_t		 i, e;
+
+	h = a->h;
+	for (i = 0; i < h->nstates; i++) {
+		if ((uint64_t)a->states[i].edge + a->states[i].nedge >
+		    h->nedges ||
+		    (i > 0 && a->states[i].fail >= i) ||
+		    (a->states[i].term != NONE &&
+		    a->states[i].term >= h->nterms) ||
+		    (a->states[i].dict != NONE && a->states[i].dict >= i))
+			return 0;
+		for (e = 0; e < a->states[i].nedge; e++)
+			if (a->targets[a->states[i].edge + e] <= i ||
+			    a->targets[a->states[i].edge + e] >= h->nstates)
+				return 0;
+	}
+	for (i = 0; i < h->nterms; i++)
+		if (a->terms[i].len == 0 ||
+		    (uint64_t)a->terms[i].off + a->terms[i].len > h->npool ||
+		    a->terms[i].len > h->maxlen ||
+		    (uint64_t)a->terms[i].sub + a->terms[i].nsub > h->nsubs)
+			return 0;
+	if (h->maxlen > h->npool)
+		return 0;
+	for (i = 0; i < h->nsubs; i++)
+		if ((uint64_t)a->subs[i].lang + a->subs[i].langlen >
+		    h->npool ||
+		    (uint64_t)a->subs[i].off + a->subs[i].len > h->npool)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Compile the glossary at path, described by sb, into a newly-allocated
+ * image, setting img and size to it.
+ *
+ * The terms are sorted first, so that the terms under each state of the
+ * trie are a run of them, split among its children by their next byte;
+ * building the trie breadth first then takes one step per state, and
+ * leaves every state's edges in order. The failure links are filled in
+ * afterwards, in the same order, each from its parent's.
+ */
+static void
+compile(const char *path, const struct stat *sb, void **img, size_t *size)
+{
+	struct automaton	 a;
+	struct entry		*ents;
+	struct state		*states;
+	struct term		*t;
+	const char		*lang;
+	uint32_t		*targets, s, e, f, w, v;
+	uint8_t			*labels;
+	size_t			*lo, *hi, *depth, *first;
+	size_t			 nents, nterms, nsubs, npool, nstates, nedges;
+	size_t			 cap, ecap, i, j, l, h, d, off;
+
+	nents = read_entries(path, &ents);
+	qsort(ents, nents, sizeof(struct entry), cmp_entry);
+
+	/* Each term once; each language once per term, first given first */
+	if ((first = reallocarray(NULL, nents + 1, sizeof(size_t))) == NULL)
+		err(1, "reallocarray");
+	nterms = nsubs = npool = 0;
+	for (i = 0, lang = NULL; i < nents; i++) {
+		if (i == 0 || ents[i].len != ents[i - 1].len ||
+		    memcmp(ents[i].term, ents[i - 1].term, ents[i].len) != 0) {
+			first[nterms++] = i;
+			npool += ents[i].len;
+			lang = NULL;
+		} else if (ents[i].lang == NULL || (lang != NULL &&
+		    strcmp(ents[i].lang, lang) == 0)) {
+			free(ents[i].lang);
+			ents[i].lang = NULL;
+			continue;
+		}
+		if (ents[i].lang != NULL) {
+			lang = ents[i].lang;
+			nsubs++;
+			npool += strlen(ents[i].lang) + strlen(ents[i].sub);
+		}
+	}
+	first[nterms] = nents;
+
+	/* The trie, breadth first, one run of terms per state */
+	nstates = nedges = 0;
+	cap = ecap = 64;
+	states = reallocarray(NULL, cap, sizeof(struct state));
+	lo = reallocarray(NULL, cap, sizeof(size_t));
+	hi = reallocarray(NULL, cap, sizeof(size_t));
+	depth = reallocarray(NULL, cap, sizeof(size_t));
+	targets = reallocarray(NULL, ecap, sizeof(uint32_t));
+	labels = malloc(ecap);
+	if (states == NULL || lo == NULL || hi == NULL || depth == NULL ||
+	    targets == NULL || labels == NULL)
+		err(1, "malloc");
+
+	lo[0] = 0;
+	hi[0] = nterms;
+	depth[0] = 0;
+	nstates = 1;
+	for (s = 0; s < nstates; s++) {
+		l = lo[s];
+		h = hi[s];
+		d = depth[s];
+		states[s].term = NONE;
+		states[s].dict = NONE;
+		states[s].fail = 0;
+		if (l < h && ents[first[l]].len == d)
+			states[s].term = count(l++);
+		states[s].edge = count(nedges);
+
+		while (l < h) {
+			for (j = l + 1; j < h && ents[first[j]].term[d] ==
+			    ents[first[l]].term[d]; j++)
+				;
+			if (nstates == cap) {
+				cap *= 2;
+				states = reallocarray(states, cap,
+				    sizeof(struct state));
+				lo = reallocarray(lo, cap, sizeof(size_t));
+				hi = reallocarray(hi, cap, sizeof(size_t));
+				depth = reallocarray(depth, cap,
+				    sizeof(size_t));
+				if (states == NULL || lo == NULL ||
+				    hi == NULL || depth == NULL)
+					err(1, "reallocarray");
+			}
+			if (nedges == ecap) {
+				ecap *= 2;
+				targets = reallocarray(targets, ecap,
+				    sizeof(uint32_t));
+				labels = realloc(labels, ecap);
+				if (targets == NULL || labels == NULL)
+					err(1, "realloc");
+			}
+			lo[nstates] = l;
+			hi[nstates] = j;
+			depth[nstates] = d + 1;
+			labels[nedges] = ents[first[l]].term[d];
+			targets[nedges++] = count(nstates++);
+			l = j;
+		}
+		states[s].nedge = count(nedges - states[s].edge);
+	}
+
+	/* Lay it all out as one block */
+	*size = sizeof(struct header) + nstates * sizeof(struct state) +
+	    nedges * (sizeof(uint32_t) + sizeof(uint8_t)) +
+	    nterms * sizeof(struct term) + nsubs * sizeof(struct sub) + npool;
+	if ((*img = calloc(1, *size)) == NULL)
+		err(1, "calloc");
+
+	a.h = (struct header *)*img;
+	memcpy(a.h->magic, GLOSSARY_MAGIC, sizeof(a.h->magic));
+	a.h->src_size = sb->st_size;
+	a.h->src_mtime = mtime(sb);
+	a.h->nstates = count(nstates);
+	a.h->nedges = count(nedges);
+	a.h->nterms = count(nterms);
+	a.h->nsubs = count(nsubs);
+	a.h->npool = count(npool);
+	for (i = 0; i < nterms; i++)
+		a.h->maxlen = MAX(a.h->maxlen, count(ents[first[i]].len));
+	view(*img, *size, &a);
+
+	memcpy(a.states, states, nstates * sizeof(struct state));
+	memcpy(a.targets, targets, nedges * sizeof(uint32_t));
+	memcpy(a.labels, labels, nedges);
+
+	for (i = 0, off = 0, nsubs = 0; i < nterms; i++) {
+		t = &a.terms[i];
+		t->off = count(off);
+		t->len = count(ents[first[i]].len);
+		memcpy(a.pool + off, ents[first[i]].term, t->len);
+		off += t->len;
+
+		t->sub = count(nsubs);
+		for (j = first[i]; j < first[i + 1]; j++) {
+			if (ents[j].lang == NULL)
+				continue;
+			a.subs[nsubs].lang = count(off);
+			a.subs[nsubs].langlen = count(strlen(ents[j].lang));
+			memcpy(a.pool + off, ents[j].lang,
+			    a.subs[nsubs].langlen);
+			off += a.subs[nsubs].langlen;
+			a.subs[nsubs].off = count(off);
+			a.subs[nsubs].len = count(strlen(ents[j].sub));
+			memcpy(a.pool + off, ents[j].sub, a.subs[nsubs].len);
+			off += a.subs[nsubs].len;
+			nsubs++;
+		}
+		t->nsub = count(nsubs - t->sub);
+	}
+
+	/* A child fails to where its parent fails, followed by its byte */
+	for (s = 0; s < nstates; s++)
+		for (e = a.states[s].edge;
+		    e < a.states[s].edge + a.states[s].nedge; e++) {
+			v = a.targets[e];
+			if (s == 0)
+				w = NONE;
+			else {
+				f = a.states[s].fail;
+				while ((w = go(&a, f, a.labels[e])) == NONE &&
+				    f != 0)
+					f = a.states[f].fail;
+			}
+			a.states[v].fail = w != NONE ? w : 0;
+			f = a.states[v].fail;
+			a.states[v].dict = a.states[f].term != NONE ? f :
+			    a.states[f].dict;
+		}
+
+	for (i = 0; i < nents; i++) {
+		free(ents[i].term);
+		free(ents[i].lang);
+		free(ents[i].sub);
+	}
+	free(ents);
+	free(first);
+	free(states);
+	free(lo);
+	free(hi);
+	free(depth);
+	free(targets);
+	free(labels);
+}
+
+/*
+ * Read the lines of a glossary, warning about any that make no sense.
+ *
+ * RETURN: how many entries there are, stored into the newly-allocated ents.
+ */
+static size_t
+read_entries(const char *path, struct entry **ents)
+{
+	FILE		*fp;
+	struct entry	*e;
+	char		*line, *fields[3], *p;
+	size_t		 size, n, cap, lineno, nf;
+	ssize_t		 len;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+
+	line = NULL;
+	size = n = cap = lineno = 0;
+	*ents = NULL;
+
+	while ((len = getline(&line, &size, fp)) != -1) {
+		lineno++;
+		while (len > 0 && (line[len - 1] == '\n' ||
+		    line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		for (nf = 0, p = line; p != NULL && nf < 3; nf++)
+			fields[nf] = strsep(&p, "\t");
+		if (p != NULL || nf == 2 || *fields[0] == '\0' ||
+		    (nf == 3 && *fields[1] == '\0')) {
+			warnx("%s:%zu: expected a term, or a term, a language,"
+			    " and a translation", path, lineno);
+			continue;
+		}
+
+		if (n == cap) {
+			cap = cap ? cap * 2 : 64;
+			if ((*ents = reallocarray(*ents, cap,
+			    sizeof(struct entry))) == NULL)
+				err(1, "reallocarray");
+		}
+		e = &(*ents)[n++];
+		e->len = strlen(fields[0]);
+		e->line = lineno;
+		e->lang = e->sub = NULL;
+		if ((e->term = strdup(fields[0])) == NULL ||
+		    (nf == 3 && ((e->lang = strdup(fields[1])) == NULL ||
+		    (e->sub = strdup(fields[2])) == NULL)))
+			err(1, "strdup");
+	}
+
+	if (ferror(fp))
+		err(1, "%s", path);
+	free(line);
+	fclose(fp);
+
+	return n;
+}
+
+/*
+ * Write a compiled glossary out for next time, beside the old copy and then
+ * over it. Not being able to is no reason not to use it this time.
+ */
+static void
+save(const char *path, const void *img, size_t size)
+{
+	FILE	*fp;
+	char	*tmp;
+
+	if (asprintf(&tmp, "%s.tmp", path) == -1)
+		err(1, "asprintf");
+
+	if ((fp = fopen(tmp, "w")) == NULL)
+		warn("%s", tmp);
+	else if (fwrite(img, 1, size, fp) != size) {
+		warn("%s", tmp);
+		fclose(fp);
+		unlink(tmp);
+	} else if (fclose(fp) == EOF) {
+		warn("%s", tmp);
+		unlink(tmp);
+	} else if (rename(tmp, path) == -1)
+		warn("rename %s", path);
+
+	free(tmp);
+}
+
+/*
+ * RETURN: the state reached from state s on byte c, or NONE if there is no
+ * such edge.
+ */
+static uint32_t
+go(const struct automaton *a, uint32_t s, uint8_t c)
+{
+	const uint8_t	*labels;
+	uint32_t	 l, h, m;
+
+	labels = a->labels + a->states[s].edge;
+	l = 0;
+	h = a->states[s].nedge;
+
+	while (l < h) {
+		m = l + (h - l) / 2;
+		if (labels[m] < c)
+			l = m + 1;
+		else if (labels[m] > c)
+			h = m;
+		else
+			return a->targets[a->states[s].edge + m];
+	}
+
+	return NONE;
+}
+
+/*
+ * RETURN: whether the term found at start in the text stands on its own:
+ * where the term begins or ends with a letter or digit, the text next to
+ * it must not.
+ */
+static int
+whole(const char *text, size_t len, size_t start, const struct term *t)
+{
+	const char	*term;
+	size_t		 end;
+
+	term = gl.pool + t->off;
+	end = start + t->len;
+
+	if (start > 0 && is_word(term[0]) && is_word(text[start - 1]))
+		return 0;
+	if (end < len && is_word(term[t->len - 1]) && is_word(text[end]))
+		return 0;
+	return 1;
+}
+
+/*
+ * RETURN: whether the byte can be part of a word. Any byte of a multibyte
+ * character counts, whatever the character is.
+ */
+static int
+is_word(char c)
+{
+	return (unsigned char)c >= 0x80 || isalnum((unsigned char)c) ||
+	    c == '_';
+}
+
+/*
+ * Replace the term at start with its placeholder, numbering it if it has
+ * not come up before.
+ */
+static void
+replace(struct protect *p, size_t start, uint32_t term)
+{
+	gpointer	 k;
+	size_t		 n;
+
+	if (p->out == NULL) {
+		p->out = g_string_new(NULL);
+		p->index = g_hash_table_new(g_direct_hash, g_direct_equal);
+		if ((p->terms = calloc(1, sizeof(struct glossary_terms))) ==
+		    NULL)
+			err(1, "calloc");
+	}
+
+	k = GSIZE_TO_POINTER((size_t)term + 1);
+	if ((n = GPOINTER_TO_SIZE(g_hash_table_lookup(p->index, k))) == 0) {
+		if (p->terms->n == p->terms->size) {
+			p->terms->size = p->terms->size ? p->terms->size * 2 :
+			    16;
+			if ((p->terms->ids = reallocarray(p->terms->ids,
+			    p->terms->size, sizeof(uint32_t))) == NULL)
+				err(1, "reallocarray");
+		}
+		p->terms->ids[p->terms->n++] = term;
+		n = p->terms->n;
+		g_hash_table_insert(p->index, k, GSIZE_TO_POINTER(n));
+	}
+
+	g_string_append_len(p->out, p->text + p->from, start - p->from);
+	g_string_append_printf(p->out, GLOSSARY_OPEN "%zu" GLOSSARY_CLOSE, n);
+	p->from = start + gl.terms[term].len;
+}
+
+/*
+ * Read the placeholder at s, which starts with GLOSSARY_OPEN.
+ *
+ * RETURN: just past the end of it, with k set to its number, or NULL if it
+ * is not a placeholder numbered from 1 to n.
+ */
+static const char *
+placeholder(const char *s, const char *end, size_t n, size_t *k)
+{
+	size_t	digits;
+
+	s += strlen(GLOSSARY_OPEN);
+	while (s < end && *s == ' ')
+		s++;
+
+	for (*k = 0, digits = 0; s < end && *s >= '0' && *s <= '9';
+	    s++, digits++)
+		if ((*k = *k * 10 + (*s - '0')) > n)
+			return NULL;
+	if (digits == 0 || *k == 0)
+		return NULL;
+
+	while (s < end && *s == ' ')
+		s++;
+	if ((size_t)(end - s) < strlen(GLOSSARY_CLOSE) ||
+	    memcmp(s, GLOSSARY_CLOSE, strlen(GLOSSARY_CLOSE)) != 0)
+		return NULL;
+
+	return s + strlen(GLOSSARY_CLOSE);
+}
+
+/*
+ * Order entries by term, byte by byte, then those to be left as they are
+ * before those with a translation, by language, then by where they were
+ * given, for qsort(3).
+ */
+static int
+cmp_entry(const void *a, const void *b)
+{
+	const struct entry	*x, *y;
+	int			 c;
+
+	x = (const struct entry *)a;
+	y = (const struct entry *)b;
+
+	if ((c = memcmp(x->term, y->term, MIN(x->len, y->len))) != 0)
+		return c;
+	if (x->len != y->len)
+		return x->len < y->len ? -1 : 1;
+	if ((x->lang == NULL) != (y->lang == NULL))
+		return x->lang == NULL ? -1 : 1;
+	if (x->lang != NULL && (c = strcmp(x->lang, y->lang)) != 0)
+		return c;
+	return x->line < y->line ? -1 : x->line > y->line;
+}
+
+/*
+ * RETURN: n as a count in a compiled glossary; exits if it does not fit.
+ */
+static uint32_t
+count(size_t n)
+{
+	if (n >= NONE)
+		errx(1, "glossary too large");
+	return (uint32_t)n;
+}
+
+/*
+ * RETURN: when a file was last changed, in nanoseconds, so that a glossary
+ * edited twice in a second is still compiled again.
+ */
+static int64_t
+mtime(const struct stat *sb)
+{
+	return (int64_t)sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+}
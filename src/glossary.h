@@ -0,0 +1,27 @@
+#ifndef GLOSSARY_H
+#define GLOSSARY_H
+
+#include <sys/types.h>
+
+#include <glib.h>
+
+/* What a compiled glossary starts with; bump it when the layout changes */
+#define GLOSSARY_MAGIC		"idiomGL2"
+
+/* Added to the name of a glossary to get the name of its compiled form */
+#define GLOSSARY_SUFFIX		".ac"
+
+/* What a term is replaced with on the way out: U+27E6, number, U+27E7 */
+#define GLOSSARY_OPEN		"\xe2\x9f\xa6"
+#define GLOSSARY_CLOSE		"\xe2\x9f\xa7"
+
+struct glossary_terms;
+
+void	 glossary_load(const char *);
+int	 glossary_on(void);
+GBytes	*glossary_protect(GBytes *, struct glossary_terms **);
+GBytes	*glossary_restore(GBytes *, const struct glossary_terms *,
+	    const char *);
+void	 glossary_terms_free(struct glossary_terms *);
+
+#endif /* !GLOSSARY_H */
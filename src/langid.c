@@ -0,0 +1,1017 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+#include "langid.h"
+
+#define GUESS_MAX_CHARS	1024	/* Only look this far into the text */
+#define MIN_LETTERS	10	/* Don't guess from fewer letters than this */
+#define MIN_SCRIPT	2	/* ...unless the script alone gives it away */
+#define MARGIN		8.0	/* How far ahead a guess must be, in nats */
+#define SMOOTHING	0.5	/* Pretend every n-gram was seen this often */
+#define TABLE_BITS	15	/* The n-gram table has 2^TABLE_BITS slots */
+
+enum script {
+	SCRIPT_NONE,
+	SCRIPT_LATIN,
+	SCRIPT_GREEK,
+	SCRIPT_CYRILLIC,
+	SCRIPT_ARMENIAN,
+	SCRIPT_HEBREW,
+	SCRIPT_ARABIC,
+	SCRIPT_DEVANAGARI,
+	SCRIPT_BENGALI,
+	SCRIPT_GURMUKHI,
+	SCRIPT_GUJARATI,
+	SCRIPT_TAMIL,
+	SCRIPT_TELUGU,
+	SCRIPT_KANNADA,
+	SCRIPT_THAI,
+	SCRIPT_LAO,
+	SCRIPT_GEORGIAN,
+	SCRIPT_KHMER,
+	SCRIPT_HANGUL,
+	SCRIPT_KANA,
+	SCRIPT_HAN,
+	NSCRIPTS
+};
+
+/*
+ * Unicode blocks and the script they hold.
+ */
+static const struct script_range {
+	uint32_t	lo, hi;
+	enum script	script;
+} script_ranges[] = {
+	{ 0x0041, 0x005a, SCRIPT_LATIN },
+	{ 0x0061, 0x007a, SCRIPT_LATIN },
+	{ 0x00c0, 0x024f, SCRIPT_LATIN },
+	{ 0x0250, 0x02af, SCRIPT_LATIN },
+	{ 0x0370, 0x03ff, SCRIPT_GREEK },
+	{ 0x0400, 0x052f, SCRIPT_CYRILLIC },
+	{ 0x0530, 0x058f, SCRIPT_ARMENIAN },
+	{ 0x0590, 0x05ff, SCRIPT_HEBREW },
+	{ 0x0600, 0x06ff, SCRIPT_ARABIC },
+	{ 0x0750, 0x077f, SCRIPT_ARABIC },
+	{ 0x0900, 0x097f, SCRIPT_DEVANAGARI },
+	{ 0x0980, 0x09ff, SCRIPT_BENGALI },
+	{ 0x0a00, 0x0a7f, SCRIPT_GURMUKHI },
+	{ 0x0a80, 0x0aff, SCRIPT_GUJARATI },
+	{ 0x0b80, 0x0bff, SCRIPT_TAMIL },
+	{ 0x0c00, 0x0c7f, SCRIPT_TELUGU },
+	{ 0x0c80, 0x0cff, SCRIPT_KANNADA },
+	{ 0x0e00, 0x0e7f, SCRIPT_THAI },
+	{ 0x0e80, 0x0eff, SCRIPT_LAO },
+	{ 0x10a0, 0x10ff, SCRIPT_GEORGIAN },
+	{ 0x1100, 0x11ff, SCRIPT_HANGUL },
+	{ 0x1780, 0x17ff, SCRIPT_KHMER },
+	{ 0x1e00, 0x1eff, SCRIPT_LATIN },
+	{ 0x3040, 0x30ff, SCRIPT_KANA },
+	{ 0x3130, 0x318f, SCRIPT_HANGUL },
+	{ 0x3400, 0x4dbf, SCRIPT_HAN },
+	{ 0x4e00, 0x9fff, SCRIPT_HAN },
+	{ 0xac00, 0xd7af, SCRIPT_HANGUL },
+	{ 0xfb1d, 0xfb4f, SCRIPT_HEBREW },
+	{ 0xfb50, 0xfdff, SCRIPT_ARABIC },
+	{ 0xfe70, 0xfeff, SCRIPT_ARABIC }
+};
+
+/*
+ * Scripts that only one of our languages uses, so that seeing the script is
+ * enough. Chinese is either of two.
+ */
+static const struct script_lang {
+	enum script	 script;
+	const char	*langs[2];
+} script_langs[] = {
+	{ SCRIPT_GREEK, { "el", NULL } },
+	{ SCRIPT_ARMENIAN, { "hy", NULL } },
+	{ SCRIPT_BENGALI, { "bn", NULL } },
+	{ SCRIPT_GURMUKHI, { "pa", NULL } },
+	{ SCRIPT_GUJARATI, { "gu", NULL } },
+	{ SCRIPT_TAMIL, { "ta", NULL } },
+	{ SCRIPT_TELUGU, { "te", NULL } },
+	{ SCRIPT_KANNADA, { "kn", NULL } },
+	{ SCRIPT_THAI, { "th", NULL } },
+	{ SCRIPT_LAO, { "lo", NULL } },
+	{ SCRIPT_GEORGIAN, { "ka", NULL } },
+	{ SCRIPT_KHMER, { "km", NULL } },
+	{ SCRIPT_HANGUL, { "ko", NULL } },
+	{ SCRIPT_KANA, { "ja", NULL } },
+	{ SCRIPT_HAN, { "zh-CN", "zh-TW" } }
+};
+
+/*
+ * For every language that shares its script with others, a sample of
+ * ordinary text: the first article of the Universal Declaration of Human
+ * Rights and a few everyday sentences. The n-gram profile of each language
+ * is built from its sample the first time a guess is made.
+ */
+static const struct sample {
+	const char	*lang;
+	const char	*text;
+} samples[] = {
+	{ "af",
+	    "Alle menslike wesens word vry, met gelyke waardigheid en "
+	    "regte, gebore. Hulle het rede en gewete en behoort in "
+	    "die gees van broederskap teenoor mekaar op te tree. Ek "
+	    "is baie bly dat jy hier is. Wat is jou naam? Ons gaan "
+	    "more na die stad toe om iets te koop wat ons kan eet." },
+	{ "sq",
+	    "Të gjithë njerëzit lindin të lirë dhe të barabartë në "
+	    "dinjitet dhe në të drejta. Ata kanë arsye dhe ndërgjegje "
+	    "dhe duhet të sillen ndaj njëri-tjetrit me frymë "
+	    "vëllazërimi. Unë jam shumë i lumtur që je këtu. Si "
+	    "quhesh? Nesër do të shkojmë në qytet për të blerë diçka "
+	    "për të ngrënë." },
+	{ "az",
+	    "Bütün insanlar ləyaqət və hüquqlarına görə azad və "
+	    "bərabər doğulurlar. Onların şüurları və vicdanları var "
+	    "və bir-birlərinə münasibətdə qardaşlıq ruhunda "
+	    "davranmalıdırlar. Mən çox şadam ki, sən buradasan. Sənin "
+	    "adın nədir? Sabah yemək almaq üçün şəhərə gedəcəyik." },
+	{ "eu",
+	    "Gizon-emakume guztiak aske jaiotzen dira, duintasun eta "
+	    "eskubide berberak dituztela; eta ezaguera eta "
+	    "kontzientzia dutenez gero, elkarren artean senide legez "
+	    "jokatu beharra dute. Oso pozik nago hemen zaudelako. "
+	    "Zein da zure izena? Bihar hirira joango gara zerbait "
+	    "jateko erostera." },
+	{ "bs",
+	    "Sva ljudska bića rađaju se slobodna i jednaka u "
+	    "dostojanstvu i pravima. Ona su obdarena razumom i "
+	    "sviješću i trebaju jedno prema drugome postupati u duhu "
+	    "bratstva. Jako sam sretan što si ovdje. Kako se zoveš? "
+	    "Sutra idemo u grad da kupimo nešto za jelo." },
+	{ "ceb",
+	    "Ang tanang katawhan gipakatawo nga may kagawasan ug "
+	    "managsama sa dignidad ug katungod. Sila gigasahan sa "
+	    "pangisip ug tanlag ug kinahanglan nga mag-ilhanay isip "
+	    "managsoon sa usag usa. Nalipay kaayo ko nga ania ka. "
+	    "Unsa imong ngalan? Moadto mi sa siyudad ugma aron "
+	    "mopalit ug pagkaon." },
+	{ "ca",
+	    "Tots els éssers humans neixen lliures i iguals en "
+	    "dignitat i en drets. Són dotats de raó i de consciència, "
+	    "i han de comportar-se fraternalment els uns amb els "
+	    "altres. Estic molt content que siguis aquí. Com et dius? "
+	    "Demà anirem a la ciutat per comprar alguna cosa per "
+	    "menjar." },
+	{ "hr",
+	    "Sva ljudska bića rađaju se slobodna i jednaka u "
+	    "dostojanstvu i pravima. Ona su obdarena razumom i "
+	    "sviješću pa jedna prema drugima trebaju postupati u duhu "
+	    "bratstva. Vrlo sam sretan što si ovdje. Kako se zoveš? "
+	    "Sutra idemo u grad i kupit ćemo nešto za jelo." },
+	{ "cs",
+	    "Všichni lidé rodí se svobodní a sobě rovní co do "
+	    "důstojnosti a práv. Jsou nadáni rozumem a svědomím a "
+	    "mají spolu jednat v duchu bratrství. Jsem velmi rád, že "
+	    "jsi tady. Jak se jmenuješ? Zítra pojedeme do města a "
+	    "koupíme něco k jídlu." },
+	{ "da",
+	    "Alle mennesker er født frie og lige i værdighed og "
+	    "rettigheder. De er udstyret med fornuft og samvittighed, "
+	    "og de bør handle mod hverandre i en broderskabets ånd. "
+	    "Jeg er meget glad for, at du er her. Hvad hedder du? I "
+	    "morgen tager vi til byen og køber noget at spise." },
+	{ "nl",
+	    "Alle mensen worden vrij en gelijk in waardigheid en "
+	    "rechten geboren. Zij zijn begiftigd met verstand en "
+	    "geweten, en behoren zich jegens elkander in een geest "
+	    "van broederschap te gedragen. Ik ben heel blij dat je "
+	    "hier bent. Hoe heet je? Morgen gaan we naar de stad om "
+	    "iets te eten te kopen." },
+	{ "en",
+	    "All human beings are born free and equal in dignity and "
+	    "rights. They are endowed with reason and conscience and "
+	    "should act towards one another in a spirit of "
+	    "brotherhood. I am very happy that you are here. What is "
+	    "your name? Tomorrow we will go to the city to buy "
+	    "something to eat with the children." },
+	{ "eo",
+	    "Ĉiuj homoj estas denaske liberaj kaj egalaj laŭ digno "
+	    "kaj rajtoj. Ili posedas racion kaj konsciencon, kaj "
+	    "devus konduti unu al alia en spirito de frateco. Mi "
+	    "estas tre feliĉa ke vi estas ĉi tie. Kiel vi nomiĝas? "
+	    "Morgaŭ ni iros al la urbo kaj aĉetos ion por manĝi." },
+	{ "et",
+	    "Kõik inimesed sünnivad vabadena ja võrdsetena oma "
+	    "väärikuselt ja õigustelt. Neile on antud mõistus ja "
+	    "südametunnistus ja nende suhtumist üksteisesse peab "
+	    "kandma vendluse vaim. Ma olen väga rõõmus, et sa oled "
+	    "siin. Mis su nimi on? Homme läheme linna ja ostame "
+	    "midagi süüa." },
+	{ "tl",
+	    "Ang lahat ng tao ay isinilang na malaya at pantay-pantay "
+	    "sa karangalan at mga karapatan. Sila ay pinagkalooban ng "
+	    "katwiran at budhi at dapat magpalagayan ang isa't isa sa "
+	    "diwa ng pagkakapatiran. Masaya ako na nandito ka. Ano "
+	    "ang pangalan mo? Bukas ay pupunta kami sa lungsod para "
+	    "bumili ng pagkain." },
+	{ "fi",
+	    "Kaikki ihmiset syntyvät vapaina ja tasavertaisina "
+	    "arvoltaan ja oikeuksiltaan. Heille on annettu järki ja "
+	    "omatunto, ja heidän on toimittava toisiaan kohtaan "
+	    "veljeyden hengessä. Olen hyvin iloinen, että olet "
+	    "täällä. Mikä sinun nimesi on? Huomenna menemme "
+	    "kaupunkiin ostamaan jotain syötävää." },
+	{ "fr",
+	    "Tous les êtres humains naissent libres et égaux en "
+	    "dignité et en droits. Ils sont doués de raison et de "
+	    "conscience et doivent agir les uns envers les autres "
+	    "dans un esprit de fraternité. Je suis très content que "
+	    "tu sois ici. Comment t'appelles-tu? Demain nous irons à "
+	    "la ville pour acheter quelque chose à manger." },
+	{ "gl",
+	    "Tódolos seres humanos nacen libres e iguais en dignidade "
+	    "e dereitos e, dotados como están de razón e conciencia, "
+	    "débense comportar fraternalmente uns cos outros. Estou "
+	    "moi contento de que esteas aquí. Como te chamas? Mañá "
+	    "imos á cidade para mercar algo de comer." },
+	{ "de",
+	    "Alle Menschen sind frei und gleich an Würde und Rechten "
+	    "geboren. Sie sind mit Vernunft und Gewissen begabt und "
+	    "sollen einander im Geist der Brüderlichkeit begegnen. "
+	    "Ich bin sehr froh, dass du hier bist. Wie heißt du? "
+	    "Morgen gehen wir in die Stadt und kaufen etwas zu essen "
+	    "für die Kinder." },
+	{ "ht",
+	    "Tout moun fèt lib, egalego pou diyite kou wè dwa. Nou "
+	    "gen konprann ak konsyans epi nou fèt pou nou aji youn ak "
+	    "lòt ak lespri fratènite. Mwen kontan anpil ke ou la. "
+	    "Kijan ou rele? Demen n ap ale lavil pou n achte yon "
+	    "bagay pou n manje." },
+	{ "ha",
+	    "Duk ɗan Adam an haife shi ne yantacce, kuma mutuncinsu "
+	    "da haƙƙoƙinsu daidai suke. Suna da hankali da kuma "
+	    "tunani, saboda haka duk abin da za su aikata wa junansu "
+	    "ya kamata su yi shi a cikin 'yan'uwanci. Ina farin ciki "
+	    "da kake nan. Yaya sunanka? Gobe za mu tafi gari mu sayi "
+	    "abinci." },
+	{ "hmn",
+	    "Txhua tus neeg yug los muaj kev ywj pheej thiab sib "
+	    "npaug zos hauv txoj cai. Lawv muaj lub tswv yim thiab "
+	    "lub siab thiab yuav tsum coj ua ib leeg rau ib leeg raws "
+	    "li kwv tij. Kuv zoo siab heev uas koj nyob ntawm no. Koj "
+	    "lub npe hu li cas? Tag kis peb yuav mus rau hauv lub zos "
+	    "yuav khoom noj." },
+	{ "hu",
+	    "Minden emberi lény szabadon születik és egyenlő "
+	    "méltósága és joga van. Az emberek, ésszel és "
+	    "lelkiismerettel bírván, egymással szemben testvéri "
+	    "szellemben kell hogy viseltessenek. Nagyon örülök, hogy "
+	    "itt vagy. Hogy hívnak? Holnap elmegyünk a városba, és "
+	    "veszünk valamit enni." },
+	{ "is",
+	    "Hver maður er borinn frjáls og jafn öðrum að virðingu og "
+	    "réttindum. Menn eru gæddir vitsmunum og samvisku, og ber "
+	    "þeim að breyta bróðurlega hverjum við annan. Ég er mjög "
+	    "glaður að þú ert hér. Hvað heitir þú? Á morgun förum við "
+	    "í bæinn og kaupum eitthvað að borða." },
+	{ "ig",
+	    "Amụrụ mmadụ nile n'ohere nakwa nha anya n'ugwu na ikike. "
+	    "E nyere ha uche na akọ na uche, ha kwesịrị ịkpaso ibe ha "
+	    "agwa n'obi nwanne na nwanne. Obi dị m ụtọ na ị nọ ebe a. "
+	    "Kedu aha gị? Echi anyị ga-aga n'obodo ịzụta nri." },
+	{ "id",
+	    "Semua orang dilahirkan merdeka dan mempunyai martabat "
+	    "dan hak-hak yang sama. Mereka dikaruniai akal dan hati "
+	    "nurani dan hendaknya bergaul satu sama lain dalam "
+	    "semangat persaudaraan. Saya sangat senang kamu ada di "
+	    "sini. Siapa namamu? Besok kami akan pergi ke kota untuk "
+	    "membeli makanan." },
+	{ "ga",
+	    "Saolaítear na daoine uile saor agus comhionann ina "
+	    "ndínit agus ina gcearta. Tá bua an réasúin agus an "
+	    "choinsiasa acu agus ba cheart dóibh gníomhú i dtreo a "
+	    "chéile i spiorad an bhráithreachais. Tá áthas an domhain "
+	    "orm go bhfuil tú anseo. Cad is ainm duit? Rachaimid go "
+	    "dtí an chathair amárach." },
+	{ "it",
+	    "Tutti gli esseri umani nascono liberi ed eguali in "
+	    "dignità e diritti. Essi sono dotati di ragione e di "
+	    "coscienza e devono agire gli uni verso gli altri in "
+	    "spirito di fratellanza. Sono molto contento che tu sia "
+	    "qui. Come ti chiami? Domani andremo in città per "
+	    "comprare qualcosa da mangiare." },
+	{ "jw",
+	    "Kabeh manungsa kalairake kanthi merdika lan darbe "
+	    "martabat lan hak-hak kang padha. Kabeh pinaringan akal "
+	    "lan kalbu sarta kaajab pasrawungan siji lan sijine "
+	    "kanthi jiwa paseduluran. Aku seneng banget kowe ana ing "
+	    "kene. Sapa jenengmu? Sesuk awake dhewe arep menyang "
+	    "kutha tuku panganan." },
+	{ "la",
+	    "Omnes homines dignitate et iure liberi et pares "
+	    "nascuntur, rationis et conscientiae participes sunt, "
+	    "quibus inter se concordiae studio est agendum. Gaudeo "
+	    "valde quod hic es. Quid est nomen tibi? Cras ad urbem "
+	    "ibimus ut cibum emamus, et cum amicis nostris cenabimus." },
+	{ "lv",
+	    "Visi cilvēki piedzimst brīvi un vienlīdzīgi savā "
+	    "pašcieņā un tiesībās. Viņi ir apveltīti ar saprātu un "
+	    "sirdsapziņu, un viņiem jāizturas citam pret citu "
+	    "brālības garā. Es esmu ļoti priecīgs, ka tu esi šeit. Kā "
+	    "tevi sauc? Rīt mēs iesim uz pilsētu nopirkt kaut ko "
+	    "ēdamu." },
+	{ "lt",
+	    "Visi žmonės gimsta laisvi ir lygūs savo orumu ir "
+	    "teisėmis. Jiems suteiktas protas ir sąžinė ir jie turi "
+	    "elgtis vienas kito atžvilgiu kaip broliai. Aš labai "
+	    "džiaugiuosi, kad tu esi čia. Koks tavo vardas? Rytoj mes "
+	    "eisime į miestą nusipirkti ko nors valgyti." },
+	{ "ms",
+	    "Semua manusia dilahirkan bebas dan samarata dari segi "
+	    "maruah dan hak-hak. Mereka mempunyai pemikiran dan "
+	    "perasaan hati dan hendaklah bertindak di antara satu "
+	    "sama lain dengan semangat persaudaraan. Saya sangat "
+	    "gembira awak berada di sini. Siapa nama awak? Esok kami "
+	    "akan pergi ke bandar untuk membeli makanan." },
+	{ "mt",
+	    "Il-bnedmin kollha jitwieldu ħielsa u ugwali fid-dinjità "
+	    "u d-drittijiet. Huma mogħnija bir-raġuni u bil-kuxjenza "
+	    "u għandhom iġibu ruħhom ma' xulxin bi spirtu ta' aħwa. "
+	    "Jien ferħan ħafna li int hawn. X'jismek? Għada se mmorru "
+	    "l-belt biex nixtru xi ħaġa x'nieklu." },
+	{ "mi",
+	    "Ko te katoa o nga tangata i te whanaugatanga mai he mea "
+	    "wātea, he ōrite hoki ōna tika me tōna mana. E whai "
+	    "whakaaro ana, e whai hinengaro ana, nō reira me mahi "
+	    "tētahi ki tētahi i runga i te wairua o te "
+	    "whanaungatanga. He tino koa ahau kei konei koe. Ko wai "
+	    "tōu ingoa? Āpōpō ka haere mātou ki te tāone." },
+	{ "no",
+	    "Alle mennesker er født frie og med samme menneskeverd og "
+	    "menneskerettigheter. De er utstyrt med fornuft og "
+	    "samvittighet og bør handle mot hverandre i brorskapets "
+	    "ånd. Jeg er veldig glad for at du er her. Hva heter du? "
+	    "I morgen skal vi dra til byen og kjøpe noe å spise." },
+	{ "pl",
+	    "Wszyscy ludzie rodzą się wolni i równi pod względem swej "
+	    "godności i swych praw. Są oni obdarzeni rozumem i "
+	    "sumieniem i powinni postępować wobec innych w duchu "
+	    "braterstwa. Bardzo się cieszę, że tu jesteś. Jak się "
+	    "nazywasz? Jutro pojedziemy do miasta, żeby kupić coś do "
+	    "jedzenia." },
+	{ "pt",
+	    "Todos os seres humanos nascem livres e iguais em "
+	    "dignidade e em direitos. Dotados de razão e de "
+	    "consciência, devem agir uns para com os outros em "
+	    "espírito de fraternidade. Estou muito feliz que você "
+	    "esteja aqui. Como você se chama? Amanhã vamos à cidade "
+	    "para comprar alguma coisa para comer." },
+	{ "ro",
+	    "Toate ființele umane se nasc libere și egale în "
+	    "demnitate și în drepturi. Ele sunt înzestrate cu rațiune "
+	    "și conștiință și trebuie să se comporte unele față de "
+	    "altele în spiritul fraternității. Sunt foarte bucuros că "
+	    "ești aici. Cum te numești? Mâine mergem în oraș să "
+	    "cumpărăm ceva de mâncare." },
+	{ "sk",
+	    "Všetci ľudia sa rodia slobodní a sebe rovní, čo sa týka "
+	    "ich dôstojnosti a práv. Sú obdarení rozumom a svedomím a "
+	    "majú spolu jednať v bratskom duchu. Som veľmi rád, že si "
+	    "tu. Ako sa voláš? Zajtra pôjdeme do mesta kúpiť niečo na "
+	    "jedenie." },
+	{ "sl",
+	    "Vsi ljudje se rodijo svobodni in imajo enako "
+	    "dostojanstvo in enake pravice. Obdarjeni so z razumom in "
+	    "vestjo in bi morali ravnati drug z drugim kakor bratje. "
+	    "Zelo sem vesel, da si tukaj. Kako ti je ime? Jutri bomo "
+	    "šli v mesto kupit nekaj za jesti." },
+	{ "so",
+	    "Aadanaha dhammaantiis wuxuu dhashaa isagoo xor ah kana "
+	    "siman xagga sharafta iyo xuquuqda. Waxaa Alle siiyey "
+	    "aqoon iyo wacyi, waana in qof la arkaa qofka kale ula "
+	    "dhaqmaa si walaaltinimo ah. Aad baan ugu faraxsanahay "
+	    "inaad halkan joogto. Magacaa? Berri waxaan aadi doonnaa "
+	    "magaalada si aan cunto u soo iibsanno." },
+	{ "es",
+	    "Todos los seres humanos nacen libres e iguales en "
+	    "dignidad y derechos y, dotados como están de razón y "
+	    "conciencia, deben comportarse fraternalmente los unos "
+	    "con los otros. Estoy muy contento de que estés aquí. "
+	    "¿Cómo te llamas? Mañana vamos a la ciudad para comprar "
+	    "algo de comer." },
+	{ "sw",
+	    "Watu wote wamezaliwa huru, hadhi na haki zao ni sawa. "
+	    "Wote wamejaliwa akili na dhamiri, hivyo yapasa "
+	    "watendeane kindugu. Nina furaha sana kwamba uko hapa. "
+	    "Jina lako ni nani? Kesho tutakwenda mjini kununua "
+	    "chakula kwa ajili ya watoto." },
+	{ "sv",
+	    "Alla människor är födda fria och lika i värde och "
+	    "rättigheter. De har utrustats med förnuft och samvete "
+	    "och bör handla gentemot varandra i en anda av "
+	    "broderskap. Jag är mycket glad att du är här. Vad heter "
+	    "du? I morgon ska vi åka till staden och köpa något att "
+	    "äta." },
+	{ "tr",
+	    "Bütün insanlar hür, haysiyet ve haklar bakımından eşit "
+	    "doğarlar. Akıl ve vicdana sahiptirler ve birbirlerine "
+	    "karşı kardeşlik zihniyeti ile hareket etmelidirler. "
+	    "Burada olmana çok sevindim. Adın ne? Yarın yiyecek bir "
+	    "şeyler almak için şehre gideceğiz." },
+	{ "vi",
+	    "Tất cả mọi người sinh ra đều được tự do và bình đẳng về "
+	    "nhân phẩm và quyền lợi. Mọi con người đều được tạo hóa "
+	    "ban cho lý trí và lương tâm và cần phải đối xử với nhau "
+	    "trong tình anh em. Tôi rất vui vì bạn ở đây. Bạn tên là "
+	    "gì? Ngày mai chúng tôi sẽ đi vào thành phố để mua đồ ăn." },
+	{ "cy",
+	    "Genir pawb yn rhydd ac yn gydradd â'i gilydd mewn urddas "
+	    "a hawliau. Fe'u cynysgaeddir â rheswm a chydwybod, a "
+	    "dylai pawb ymddwyn y naill at y llall mewn ysbryd "
+	    "cymodlon. Rydw i'n hapus iawn dy fod ti yma. Beth yw dy "
+	    "enw di? Yfory byddwn ni'n mynd i'r dref i brynu bwyd." },
+	{ "yo",
+	    "Gbogbo ènìyàn ni a bí ní òmìnira; iyì àti ẹ̀tọ́ kọ̀ọ̀kan "
+	    "sì dọ́gba. Wọ́n ní ẹ̀bùn ti làákàyè àti ti ẹ̀rí-ọkàn, ó "
+	    "sì yẹ kí wọn ó máa hùwà sí ara wọn gẹ́gẹ́ bí ọmọ ìyá. "
+	    "Inú mi dùn púpọ̀ pé o wà níbí. Kí ni orúkọ rẹ? Ní ọ̀la a "
+	    "ó lọ sí ìlú láti ra oúnjẹ." },
+	{ "zu",
+	    "Bonke abantu bazalwa bekhululekile belingana ngesithunzi "
+	    "nangamalungelo. Bahlanganiswe wumcabango nangunembeza "
+	    "futhi kufanele baphathane ngomoya wobunye. Ngijabule "
+	    "kakhulu ukuthi ulapha. Ungubani igama lakho? Kusasa "
+	    "sizoya edolobheni siyothenga ukudla." },
+	{ "be",
+	    "Усе людзі нараджаюцца свабоднымі і роўнымі ў сваёй "
+	    "годнасці і правах. Яны надзелены розумам і сумленнем і "
+	    "павінны ставіцца адзін да аднаго ў духу брацтва. Я "
+	    "вельмі рады, што ты тут. Як цябе завуць? Заўтра мы "
+	    "пойдзем у горад, каб купіць што-небудзь паесці." },
+	{ "bg",
+	    "Всички хора се раждат свободни и равни по достойнство и "
+	    "права. Те са надарени с разум и съвест и следва да се "
+	    "отнасят помежду си в дух на братство. Много се радвам, "
+	    "че си тук. Как се казваш? Утре ще отидем в града, за да "
+	    "купим нещо за ядене." },
+	{ "mk",
+	    "Сите човечки суштества се раѓаат слободни и еднакви по "
+	    "достоинство и права. Тие се обдарени со разум и совест и "
+	    "треба да се однесуваат еден кон друг во духот на "
+	    "братството. Многу ми е мило што си тука. Како се викаш? "
+	    "Утре ќе одиме во градот да купиме нешто за јадење." },
+	{ "mn",
+	    "Хүн бүр төрж мэндлэхэд эрх чөлөөтэй, адил тэгш нэр "
+	    "төртэй, ижил эрхтэй байдаг. Оюун ухаан, нандин чанар "
+	    "заяасан хүн гэгч өөр хоорондоо ахан дүүгийн үзэл "
+	    "санаагаар харьцах учиртай. Чамайг энд байгаад би их "
+	    "баяртай байна. Таны нэр хэн бэ? Маргааш бид хот руу хоол "
+	    "авахаар явна." },
+	{ "ru",
+	    "Все люди рождаются свободными и равными в своем "
+	    "достоинстве и правах. Они наделены разумом и совестью и "
+	    "должны поступать в отношении друг друга в духе братства. "
+	    "Я очень рад, что ты здесь. Как тебя зовут? Завтра мы "
+	    "пойдём в город, чтобы купить что-нибудь поесть." },
+	{ "sr",
+	    "Сва људска бића рађају се слободна и једнака у "
+	    "достојанству и правима. Она су обдарена разумом и свешћу "
+	    "и треба једни према другима да поступају у духу "
+	    "братства. Веома сам срећан што си овде. Како се зовеш? "
+	    "Сутра идемо у град да купимо нешто за јело." },
+	{ "uk",
+	    "Всі люди народжуються вільними і рівними у своїй "
+	    "гідності та правах. Вони наділені розумом і совістю і "
+	    "повинні діяти у відношенні один до одного в дусі "
+	    "братерства. Я дуже радий, що ти тут. Як тебе звати? "
+	    "Завтра ми підемо до міста, щоб купити щось поїсти." },
+	{ "ar",
+	    "يولد جميع الناس أحرارا متساوين في الكرامة والحقوق. وقد "
+	    "وهبوا عقلا وضميرا وعليهم أن يعامل بعضهم بعضا بروح "
+	    "الإخاء. أنا سعيد جدا لأنك هنا. ما اسمك؟ غدا سنذهب إلى "
+	    "المدينة لشراء شيء نأكله مع الأطفال." },
+	{ "fa",
+	    "تمام افراد بشر آزاد به دنیا می‌آیند و از لحاظ حیثیت و "
+	    "حقوق با هم برابرند. همه دارای عقل و وجدان هستند و باید "
+	    "نسبت به یکدیگر با روح برادری رفتار کنند. من خیلی خوشحالم "
+	    "که تو اینجا هستی. اسم تو چیست؟ فردا به شهر می‌رویم تا "
+	    "چیزی برای خوردن بخریم." },
+	{ "ur",
+	    "تمام انسان آزاد اور حقوق و عزت کے اعتبار سے برابر پیدا "
+	    "ہوئے ہیں۔ انہیں ضمیر اور عقل ودیعت ہوئی ہے۔ اس لیے انہیں "
+	    "ایک دوسرے کے ساتھ بھائی چارے کا سلوک کرنا چاہیے۔ مجھے "
+	    "بہت خوشی ہے کہ آپ یہاں ہیں۔ آپ کا نام کیا ہے؟ کل ہم شہر "
+	    "جائیں گے اور کھانا خریدیں گے۔" },
+	{ "iw",
+	    "כל בני האדם נולדו בני חורין ושווים בערכם ובזכויותיהם. "
+	    "כולם חוננו בתבונה ובמצפון, לפיכך חובה עליהם לנהוג איש "
+	    "ברעהו ברוח של אחוה. אני מאוד שמח שאתה כאן. מה שמך? מחר "
+	    "נלך לעיר לקנות משהו לאכול." },
+	{ "yi",
+	    "אַלע מענטשן ווערן געבוירן פֿרײַ און גלײַך אין כּבֿוד און "
+	    "רעכט. זיי זענען באַשאָנקען מיט שכל און געוויסן און זאָלן "
+	    "זיך באַגיין איינער מיטן אַנדערן אין אַ גייסט פֿון "
+	    "ברודערשאַפֿט. איך בין זייער צופֿרידן אַז דו ביסט דאָ. "
+	    "ווי הייסטו? מאָרגן גייען מיר אין שטאָט." },
+	{ "hi",
+	    "सभी मनुष्यों को गौरव और अधिकारों के मामले में जन्मजात "
+	    "स्वतन्त्रता और समानता प्राप्त है। उन्हें बुद्धि और "
+	    "अन्तरात्मा की देन प्राप्त है और परस्पर उन्हें भाईचारे के "
+	    "भाव से बर्ताव करना चाहिए। मुझे बहुत खुशी है कि आप यहाँ "
+	    "हैं। आपका नाम क्या है? कल हम शहर जाएंगे और कुछ खाने के "
+	    "लिए खरीदेंगे।" },
+	{ "mr",
+	    "सर्व मानवी व्यक्ति जन्मतःच स्वतंत्र आहेत व त्यांना समान "
+	    "प्रतिष्ठा व समान अधिकार आहेत. त्यांना विचारशक्ती व "
+	    "सदसद्विवेकबुद्धी लाभलेली आहे व त्यांनी एकमेकांशी "
+	    "बंधुत्वाच्या भावनेने आचरण करावे. तुम्ही इथे आहात याचा "
+	    "मला खूप आनंद आहे. तुमचे नाव काय आहे? उद्या आम्ही शहरात "
+	    "जाणार आहोत आणि काहीतरी खायला विकत घेणार आहोत." },
+	{ "ne",
+	    "सबै व्यक्ति जन्मजात स्वतन्त्र हुन् ती सबैको समान अधिकार "
+	    "र महत्व छ। निजहरूमा विचार शक्ति र सद्विचार भएकोले "
+	    "निजहरूले आपसमा भातृत्वको भावनाबाट व्यवहार गर्नु पर्छ। "
+	    "तपाईं यहाँ हुनुहुन्छ भनेर म धेरै खुसी छु। तपाईंको नाम के "
+	    "हो? भोलि हामी सहरमा खाना किन्न जान्छौं।" },
+};
+
+#define NPROFILES	(sizeof(samples) / sizeof(samples[0]))
+
+/*
+ * How often an n-gram appears in one language's sample. All the hits for an
+ * n-gram are chained together from its slot in the table.
+ */
+struct hit {
+	uint16_t	lang;	/* Which sample */
+	uint16_t	count;	/* How many times */
+	float		weight;	/* log((count + SMOOTHING) / SMOOTHING) */
+	uint32_t	next;	/* The next hit for the n-gram, plus one */
+};
+
+struct slot {
+	uint64_t	key;	/* The n-gram */
+	uint32_t	first;	/* Its first hit, plus one; 0 if empty */
+};
+
+/*
+ * What the samples were boiled down to.
+ */
+static struct {
+	struct slot	*table;			/* N-gram to hits */
+	struct hit	*hits;			/* Every hit */
+	size_t		 nhits;			/* How many hits */
+	size_t		 cap;			/* How many fit in hits */
+	enum script	 script[NPROFILES];	/* The script of each sample */
+	double		 base[NPROFILES];	/* The log-odds of an unseen n-gram */
+} prof;
+
+static pthread_once_t	prof_once = PTHREAD_ONCE_INIT;
+
+typedef void	(*ngram_fn)(uint64_t, void *);
+
+static void		 build_profiles(void);
+static void		 count_ngram(uint64_t, void *);
+static void		 score_ngram(uint64_t, void *);
+static size_t		 each_ngram(const char *, size_t, size_t, ngram_fn,
+    void *, size_t *);
+static struct slot	*lookup(uint64_t, int);
+static enum script	 dominant_script(const size_t *);
+static enum script	 lang_script(const char *);
+static enum script	 script_of(uint32_t);
+static int		 is_word_char(uint32_t);
+static uint32_t		 fold_case(uint32_t);
+static size_t		 utf8_next(const unsigned char *, size_t, uint32_t *);
+
+/*
+ * The n-grams seen while scoring a text.
+ */
+struct scores {
+	double	score[NPROFILES];	/* The log-odds of each language */
+	size_t	n;			/* How many n-grams there were */
+};
+
+/*
+ * Guess the language of the text from its letters: by the script alone when
+ * only one language uses it, otherwise by how well the character n-grams of
+ * the text match each language that uses the script.
+ *
+ * Languages that share a script are easily mistaken for one another, so the
+ * current language stands unless the text is in another script; only then,
+ * or with no current language, is a guess made, and a guess that is not
+ * clearly better than the rest is no guess at all.
+ *
+ * RETURN: the language code, or NULL if there is no confident guess.
+ */
+const char *
+langid_guess(const char *text, size_t len, const char *current)
+{
+	struct scores	 sc;
+	size_t		 counts[NSCRIPTS], i, letters;
+	ssize_t		 best, second;
+	enum script	 script;
+	double		 total[NPROFILES];
+
+	pthread_once(&prof_once, build_profiles);
+
+	memset(&sc, 0, sizeof(sc));
+	memset(counts, 0, sizeof(counts));
+	each_ngram(text, len, GUESS_MAX_CHARS, score_ngram, &sc, counts);
+
+	for (i = letters = 0; i < NSCRIPTS; i++)
+		letters += counts[i];
+	if (letters < MIN_SCRIPT)
+		return NULL;
+
+	if ((script = dominant_script(counts)) == SCRIPT_NONE)
+		return NULL;
+	if (current != NULL && lang_script(current) == script)
+		return current;
+
+	for (i = 0; i < sizeof(script_langs) / sizeof(script_langs[0]); i++)
+		if (script_langs[i].script == script)
+			return script_langs[i].langs[0];
+
+	if (letters < MIN_LETTERS)
+		return NULL;
+
+	best = second = -1;
+	for (i = 0; i < NPROFILES; i++) {
+		if (prof.script[i] != script)
+			continue;
+
+		total[i] = sc.score[i] + sc.n * prof.base[i];
+		if (best == -1 || total[i] > total[best]) {
+			second = best;
+			best = i;
+		} else if (second == -1 || total[i] > total[second])
+			second = i;
+	}
+
+	if (best == -1)
+		return NULL;
+	if (second != -1 && total[best] - total[second] < MARGIN)
+		return NULL;
+
+	return samples[best].lang;
+}
+
+/*
+ * Count the n-grams of every sample into the table, then weigh them.
+ */
+static void
+build_profiles(void)
+{
+	size_t		 counts[NSCRIPTS], n[NPROFILES], i, distinct;
+	uint16_t	 lang;
+
+	if ((prof.table = calloc(1 << TABLE_BITS, sizeof(struct slot))) == NULL)
+		err(1, "calloc");
+
+	for (i = 0; i < NPROFILES; i++) {
+		memset(counts, 0, sizeof(counts));
+		lang = i;
+		n[i] = each_ngram(samples[i].text, strlen(samples[i].text),
+		    SIZE_MAX, count_ngram, &lang, counts);
+		prof.script[i] = dominant_script(counts);
+	}
+
+	for (i = distinct = 0; i < (1 << TABLE_BITS); i++)
+		if (prof.table[i].first != 0)
+			distinct++;
+
+	for (i = 0; i < prof.nhits; i++)
+		prof.hits[i].weight = log((prof.hits[i].count + SMOOTHING) /
+		    SMOOTHING);
+
+	for (i = 0; i < NPROFILES; i++)
+		prof.base[i] = log(SMOOTHING / (n[i] + SMOOTHING * distinct));
+}
+
+/*
+ * Count one n-gram of a sample. The hits of the sample being counted are
+ * always at the head of their chains, since samples are counted in turn.
+ */
+static void
+count_ngram(uint64_t key, void *data)
+{
+	struct slot	*slot;
+	struct hit	*hit;
+	uint16_t	 lang;
+
+	lang = *(uint16_t *)data;
+	slot = lookup(key, 1);
+
+	if (slot->first != 0 && prof.hits[slot->first - 1].lang == lang) {
+		prof.hits[slot->first - 1].count++;
+		return;
+	}
+
+	if (prof.nhits == prof.cap) {
+		prof.cap = prof.cap == 0 ? 4096 : prof.cap * 2;
+		prof.hits = reallocarray(prof.hits, prof.cap, sizeof(struct hit));
+		if (prof.hits == NULL)
+			err(1, "reallocarray");
+	}
+
+	hit = &prof.hits[prof.nhits++];
+	hit->lang = lang;
+	hit->count = 1;
+	hit->next = slot->first;
+	slot->first = prof.nhits;
+}
+
+/*
+ * Add the weight of one n-gram of the text to each language that has it.
+ */
+static void
+score_ngram(uint64_t key, void *data)
+{
+	struct scores	*sc;
+	struct slot	*slot;
+	struct hit	*hit;
+	uint32_t	 h;
+
+	sc = (struct scores *)data;
+	sc->n++;
+
+	if ((slot = lookup(key, 0)) == NULL)
+		return;
+
+	for (h = slot->first; h != 0; h = hit->next) {
+		hit = &prof.hits[h - 1];
+		sc->score[hit->lang] += hit->weight;
+	}
+}
+
+/*
+ * Walk the character unigrams, bigrams, and trigrams of the text, up to max
+ * characters in. Letters are case-folded, and any run of other characters
+ * becomes a single space, so "The" is " th", "the", "he ", " t", "th", "he",
+ * "e ", "t", "h", and "e". Each is packed into a key 21 bits per character;
+ * no character is 0, so the three kinds never collide. The letters of each
+ * script are tallied into counts.
+ *
+ * RETURN: how many n-grams there were.
+ */
+static size_t
+each_ngram(const char *text, size_t len, size_t max, ngram_fn fn,
+    void *data, size_t *counts)
+{
+	const unsigned char	*p, *end;
+	uint32_t		 c, w0, w1;
+	size_t			 nchars, n;
+
+	p = (const unsigned char *)text;
+	end = p + len;
+	w0 = 0;
+	w1 = ' ';
+	n = 0;
+
+	for (nchars = 0; p < end && nchars < max; nchars++) {
+		p += utf8_next(p, end - p, &c);
+
+		if (is_word_char(c)) {
+			counts[script_of(c)]++;
+			c = fold_case(c);
+		} else if (w1 == ' ')
+			continue;
+		else
+			c = ' ';
+
+		if (c != ' ') {
+			fn(c, data);
+			n++;
+		}
+		fn(((uint64_t)w1 << 21) | c, data);
+		n++;
+		if (w0 != 0) {
+			fn(((uint64_t)w0 << 42) | ((uint64_t)w1 << 21) | c,
+			    data);
+			n++;
+		}
+		w0 = w1;
+		w1 = c;
+	}
+
+	if (w1 != ' ') {
+		fn(((uint64_t)w1 << 21) | ' ', data);
+		n++;
+	}
+	if (w1 != ' ' && w0 != 0) {
+		fn(((uint64_t)w0 << 42) | ((uint64_t)w1 << 21) | ' ', data);
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * Find the slot for an n-gram, by open addressing.
+ *
+ * RETURN: the slot, or NULL if the n-gram is not there and create is false.
+ */
+static struct slot *
+lookup(uint64_t key, int create)
+{
+	size_t	i, mask;
+
+	mask = (1 << TABLE_BITS) - 1;
+	i = (key * 0x9e3779b97f4a7c15ULL) >> (64 - TABLE_BITS);
+
+	for (;; i = (i + 1) & mask) {
+		if (prof.table[i].first == 0) {
+			if (!create)
+				return NULL;
+			prof.table[i].key = key;
+			return &prof.table[i];
+		}
+		if (prof.table[i].key == key)
+			return &prof.table[i];
+	}
+}
+
+/*
+ * RETURN: the script with the most letters. Any kana at all means Japanese,
+ * which mixes kana with Han.
+ */
+static enum script
+dominant_script(const size_t *counts)
+{
+	enum script	best;
+	int		i;
+
+	best = SCRIPT_NONE;
+	for (i = SCRIPT_NONE + 1; i < NSCRIPTS; i++)
+		if (counts[i] > counts[best])
+			best = i;
+
+	if (best == SCRIPT_HAN && counts[SCRIPT_KANA] > 0)
+		best = SCRIPT_KANA;
+
+	return best;
+}
+
+/*
+ * RETURN: the script the language is written in, or SCRIPT_NONE if it is
+ * not one we know.
+ */
+static enum script
+lang_script(const char *lang)
+{
+	size_t	i, j;
+
+	for (i = 0; i < sizeof(script_langs) / sizeof(script_langs[0]); i++)
+		for (j = 0; j < 2 && script_langs[i].langs[j] != NULL; j++)
+			if (strcmp(lang, script_langs[i].langs[j]) == 0)
+				return script_langs[i].script;
+
+	for (i = 0; i < NPROFILES; i++)
+		if (strcmp(lang, samples[i].lang) == 0)
+			return prof.script[i];
+
+	return SCRIPT_NONE;
+}
+
+/*
+ * RETURN: the script of the character.
+ */
+static enum script
+script_of(uint32_t c)
+{
+	size_t	lo, hi, mid;
+
+	lo = 0;
+	hi = sizeof(script_ranges) / sizeof(script_ranges[0]);
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (c < script_ranges[mid].lo)
+			hi = mid;
+		else if (c > script_ranges[mid].hi)
+			lo = mid + 1;
+		else
+			return script_ranges[mid].script;
+	}
+
+	return SCRIPT_NONE;
+}
+
+/*
+ * RETURN: whether the character is part of a word: a letter or a mark in
+ * one of the scripts we know, excluding their punctuation.
+ */
+static int
+is_word_char(uint32_t c)
+{
+	switch (c) {
+	case 0x00d7:	/* multiplication sign */
+	case 0x00f7:	/* division sign */
+	case 0x037e:	/* Greek question mark */
+	case 0x0387:	/* Greek ano teleia */
+	case 0x0589:	/* Armenian full stop */
+	case 0x05be:	/* Hebrew maqaf */
+	case 0x05c0:	/* Hebrew paseq */
+	case 0x05c3:	/* Hebrew sof pasuq */
+	case 0x060c:	/* Arabic comma */
+	case 0x061b:	/* Arabic semicolon */
+	case 0x061f:	/* Arabic question mark */
+	case 0x066a:	/* Arabic percent sign */
+	case 0x06d4:	/* Arabic full stop */
+	case 0x0964:	/* Devanagari danda */
+	case 0x0965:	/* Devanagari double danda */
+	case 0x0e3f:	/* Thai baht */
+	case 0x30fb:	/* Katakana middle dot */
+		return 0;
+	}
+
+	if (c >= 0x0660 && c <= 0x0669)	/* Arabic-Indic digits */
+		return 0;
+	if (c >= 0x06f0 && c <= 0x06f9)	/* Persian digits */
+		return 0;
+	if (c >= 0x0966 && c <= 0x096f)	/* Devanagari digits */
+		return 0;
+	if (c >= 0x055a && c <= 0x055f)	/* Armenian punctuation */
+		return 0;
+
+	return script_of(c) != SCRIPT_NONE ||
+	    (c >= 0x0300 && c <= 0x036f);	/* combining diacritics */
+}
+
+/*
+ * RETURN: the lower-case form of an upper-case Latin, Greek, or Cyrillic
+ * letter; any other character as-is.
+ */
+static uint32_t
+fold_case(uint32_t c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c + 0x20;
+	if (c >= 0x00c0 && c <= 0x00de && c != 0x00d7)
+		return c + 0x20;
+	if (c == 0x0130)
+		return 'i';
+	if ((c >= 0x0100 && c <= 0x0137) || (c >= 0x014a && c <= 0x0177))
+		return c | 1;
+	if ((c >= 0x0139 && c <= 0x0148) || (c >= 0x0179 && c <= 0x017e))
+		return (c & 1) ? c + 1 : c;
+	if (c >= 0x0391 && c <= 0x03ab && c != 0x03a2)
+		return c + 0x20;
+	if (c >= 0x0410 && c <= 0x042f)
+		return c + 0x20;
+	if (c >= 0x0400 && c <= 0x040f)
+		return c + 0x50;
+	if ((c >= 0x0490 && c <= 0x04bf) || (c >= 0x04d0 && c <= 0x04ff))
+		return c | 1;
+	if (c >= 0x1ea0 && c <= 0x1ef9)
+		return c | 1;
+
+	return c;
+}
+
+/*
+ * Decode the UTF-8 character at the start of s. A malformed sequence decodes
+ * as U+FFFD, one byte at a time.
+ *
+ * RETURN: how many bytes the character took.
+ */
+static size_t
+utf8_next(const unsigned char *s, size_t len, uint32_t *cp)
+{
+	uint32_t	c;
+	size_t		n, i;
+
+	if (s[0] < 0x80) {
+		*cp = s[0];
+		return 1;
+	} else if ((s[0] & 0xe0) == 0xc0) {
+		n = 2;
+		c = s[0] & 0x1f;
+	} else if ((s[0] & 0xf0) == 0xe0) {
+		n = 3;
+		c = s[0] & 0x0f;
+	} else if ((s[0] & 0xf8) == 0xf0) {
+		n = 4;
+		c = s[0] & 0x07;
+	} else {
+		*cp = 0xfffd;
+		return 1;
+	}
+
+	if (n > len) {
+		*cp = 0xfffd;
+		return 1;
+	}
+
+	for (i = 1; i < n; i++) {
+		if ((s[i] & 0xc0) != 0x80) {
+			*cp = 0xfffd;
+			return 1;
+		}
+		c = (c << 6) | (s[i] & 0x3f);
+	}
+
+	*cp = c;
+	return n;
+}
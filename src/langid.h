@@ -0,0 +1,8 @@
+#ifndef LANGID_H
+#define LANGID_H
+
+#include <sys/types.h>
+
+const char	*langid_guess(const char *, size_t, const char *);
+
+#endif /* !LANGID_H */
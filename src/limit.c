@@ -0,0 +1,275 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "limit.h"
+#include "metrics.h"
+
+#define LIMIT_INITIAL	4.0	/* Requests in flight to start with */
+#define LIMIT_MIN	1.0	/* Never allow fewer than this in flight */
+#define LIMIT_BACKOFF	0.5	/* Shrink by this when the backend pushes back */
+#define LIMIT_SLOW	0.9	/* Shrink by this when latency climbs */
+#define SLOW_FACTOR	2	/* Latency this many times the best is slow */
+#define BASELINE_DECAY	1.01	/* Let the best latency drift up slowly */
+
+/*
+ * The share of the limit each class may have in flight, at least one
+ * request. Background work never takes more than a quarter, so that there
+ * is room for what the user is waiting on.
+ */
+static const double quota[LIMIT_CLASSES] = {
+	1.0,	/* LIMIT_FOREGROUND */
+	1.0,	/* LIMIT_BATCH */
+	0.25,	/* LIMIT_BACKGROUND */
+};
+
+/*
+ * Every request to the backend goes through here twice: once to get a slot
+ * and a token before it is sent, and once to give the slot back with how it
+ * went.
+ *
+ * Tokens drip into a bucket at a fixed rate, which caps the sustained
+ * request rate while still allowing short bursts. Separately, the number of
+ * requests in flight is capped by a limit that grows by one for every window
+ * of successful requests and is cut in half when the backend throttles or
+ * fails, so it settles just under what the backend will tolerate.
+ *
+ * Slots go to the most urgent class waiting, each class up to its quota.
+ * When a request has to wait for a slot while background requests hold
+ * some, those are preempted: they give their slots up and queue again.
+ */
+static struct {
+	GMutex	lock;		/* Guards everything below */
+	GCond	cond;		/* Signals a slot was released */
+	double	rate;		/* Tokens added per second */
+	double	burst;		/* Most tokens the bucket holds */
+	double	tokens;		/* Tokens in the bucket now */
+	gint64	refilled;	/* When tokens were last added */
+	double	limit;		/* How many may be in flight */
+	double	max;		/* The most the limit may grow to */
+	int	inflight;	/* How many are in flight */
+	int	held[LIMIT_CLASSES];	/* Of those, how many per class */
+	int	waiting[LIMIT_CLASSES];	/* How many wait, per class */
+	guint	gen;		/* Bumped to preempt the background */
+	double	baseline;	/* The best recent latency, in ms */
+} lim = { .rate = 20.0, .burst = 20.0, .limit = LIMIT_INITIAL, .max = 16.0 };
+
+static int	take(gint64, enum limit_class, gint64 *);
+static double	env_double(const char *, double);
+
+/*
+ * Read the limits from the environment:
+ *
+ * IDIOM_RATE: the most requests to start per second.
+ * IDIOM_CONCURRENCY: the most requests to have in flight at once.
+ */
+void
+limit_init(void)
+{
+	lim.rate = env_double("IDIOM_RATE", lim.rate);
+	lim.burst = MAX(lim.rate, 1.0);
+	lim.tokens = lim.burst;
+	lim.max = MAX(env_double("IDIOM_CONCURRENCY", lim.max), LIMIT_MIN);
+	lim.limit = MIN(lim.limit, lim.max);
+	lim.refilled = g_get_monotonic_time();
+	metrics_set(GAUGE_LIMIT, lim.limit);
+}
+
+/*
+ * Wait until there is a slot and a token for a request of class c, then
+ * take them. Waiting for a slot preempts any background requests.
+ *
+ * RETURN: a ticket, for limit_preempted().
+ */
+guint
+limit_acquire(enum limit_class c)
+{
+	gint64	now, until;
+	guint	ticket;
+
+	g_mutex_lock(&lim.lock);
+
+	lim.waiting[c]++;
+	for (;;) {
+		now = g_get_monotonic_time();
+		if (take(now, c, &until))
+			break;
+
+		if (c != LIMIT_BACKGROUND && lim.held[LIMIT_BACKGROUND] > 0 &&
+		    lim.inflight >= (int)lim.limit)
+			lim.gen++;
+
+		if (until > 0)
+			g_cond_wait_until(&lim.cond, &lim.lock, until);
+		else
+			g_cond_wait(&lim.cond, &lim.lock);
+	}
+	lim.waiting[c]--;
+	ticket = lim.gen;
+
+	/* Anyone less urgent may have been held back by this one */
+	g_cond_broadcast(&lim.cond);
+
+	g_mutex_unlock(&lim.lock);
+
+	return ticket;
+}
+
+/*
+ * Take a slot and a token for a request of class c if there are some to
+ * spare.
+ *
+ * RETURN: whether they were taken.
+ */
+int
+limit_try_acquire(enum limit_class c)
+{
+	gint64	until;
+	int	ok;
+
+	g_mutex_lock(&lim.lock);
+	ok = take(g_get_monotonic_time(), c, &until);
+	g_mutex_unlock(&lim.lock);
+
+	return ok;
+}
+
+/*
+ * RETURN: whether a request of class c, given ticket when it got its slot,
+ * should give the slot up to a more urgent one.
+ */
+int
+limit_preempted(enum limit_class c, guint ticket)
+{
+	int	preempted;
+
+	if (c != LIMIT_BACKGROUND)
+		return 0;
+
+	g_mutex_lock(&lim.lock);
+	preempted = ticket != lim.gen;
+	g_mutex_unlock(&lim.lock);
+
+	return preempted;
+}
+
+/*
+ * RETURN: whether no request is in flight.
+ */
+int
+limit_idle(void)
+{
+	int	idle;
+
+	g_mutex_lock(&lim.lock);
+	idle = lim.inflight == 0;
+	g_mutex_unlock(&lim.lock);
+
+	return idle;
+}
+
+/*
+ * Give back a slot, and adjust the limit by how the request went: grow it a
+ * little on a quick success, shrink it a little on a slow one, and shrink it
+ * a lot when the backend pushed back.
+ */
+void
+limit_release(enum limit_class c, gint64 ms, enum limit_outcome outcome)
+{
+	g_mutex_lock(&lim.lock);
+
+	lim.inflight--;
+	lim.held[c]--;
+
+	switch (outcome) {
+	case LIMIT_OK:
+		if (lim.baseline == 0 || ms < lim.baseline)
+			lim.baseline = ms;
+		else
+			lim.baseline *= BASELINE_DECAY;
+
+		if (ms > lim.baseline * SLOW_FACTOR)
+			lim.limit *= LIMIT_SLOW;
+		else
+			lim.limit += 1.0 / lim.limit;
+		break;
+	case LIMIT_DROP:
+		lim.limit *= LIMIT_BACKOFF;
+		break;
+	case LIMIT_IGNORE:
+		break;
+	}
+
+	lim.limit = MAX(MIN(lim.limit, lim.max), LIMIT_MIN);
+	metrics_set(GAUGE_INFLIGHT, lim.inflight);
+	metrics_set(GAUGE_LIMIT, lim.limit);
+
+	g_cond_broadcast(&lim.cond);
+	g_mutex_unlock(&lim.lock);
+}
+
+/*
+ * Refill the bucket, then take a slot and a token for a request of class c
+ * if both are free, nothing more urgent is waiting, and the class is within
+ * its quota. The lock must be held.
+ *
+ * RETURN: whether they were taken. If not, until is set to when the next
+ * token arrives, or to 0 if it is a slot that is missing.
+ */
+static int
+take(gint64 now, enum limit_class c, gint64 *until)
+{
+	int	i;
+
+	lim.tokens += (now - lim.refilled) * lim.rate / G_USEC_PER_SEC;
+	lim.tokens = MIN(lim.tokens, lim.burst);
+	lim.refilled = now;
+
+	*until = 0;
+	for (i = 0; i < (int)c; i++)
+		if (lim.waiting[i] > 0)
+			return 0;
+	if (lim.inflight >= (int)lim.limit ||
+	    lim.held[c] >= MAX((int)(lim.limit * quota[c]), 1))
+		return 0;
+
+	if (lim.tokens < 1.0) {
+		*until = now + (gint64)((1.0 - lim.tokens) * G_USEC_PER_SEC /
+		    lim.rate) + 1;
+		return 0;
+	}
+
+	lim.tokens -= 1.0;
+	lim.inflight++;
+	lim.held[c]++;
+	metrics_set(GAUGE_INFLIGHT, lim.inflight);
+	return 1;
+}
+
+/*
+ * RETURN: the environment variable as a positive number, or def if it is
+ * unset or not one.
+ */
+static double
+env_double(const char *name, double def)
+{
+	const char	*s;
+	char		*end;
+	double		 d;
+
+	if ((s = getenv(name)) == NULL || *s == '\0')
+		return def;
+
+	d = strtod(s, &end);
+	if (*end != '\0' || d <= 0) {
+		warnx("%s: invalid number: %s", name, s);
+		return def;
+	}
+
+	return d;
+}
@@ -0,0 +1,36 @@
+#ifndef LIMIT_H
+#define LIMIT_H
+
+#include <glib.h>
+
+/* How often a request that may be preempted checks whether it is */
+#define LIMIT_POLL_MS	50
+
+/*
+ * Who a request is for, most urgent first. A request never goes ahead of
+ * one waiting in a more urgent class.
+ */
+enum limit_class {
+	LIMIT_FOREGROUND,	/* Someone is watching for the answer */
+	LIMIT_BATCH,		/* A file or stream being translated */
+	LIMIT_BACKGROUND,	/* A guess or a warm-up; may be preempted */
+	LIMIT_CLASSES
+};
+
+/*
+ * How a request went, as far as the limiter cares.
+ */
+enum limit_outcome {
+	LIMIT_OK,	/* It succeeded; the backend has room */
+	LIMIT_DROP,	/* It was throttled, timed out, or hit a 5xx */
+	LIMIT_IGNORE	/* It failed or was cancelled for some other reason */
+};
+
+void	limit_init(void);
+guint	limit_acquire(enum limit_class);
+int	limit_try_acquire(enum limit_class);
+int	limit_preempted(enum limit_class, guint);
+int	limit_idle(void);
+void	limit_release(enum limit_class, gint64, enum limit_outcome);
+
+#endif /* !LIMIT_H */
@@ -15,10 +15,44 @@
 
 #include <curl/curl.h>
 #include <gtk/gtk.h>
-#include <json-glib/json-glib.h>
 
+#include "align.h"
+#include "alternates.h"
+#include "batcher.h"
+#include "cache.h"
 #include "compat.h"
+#include "dedup.h"
+#include "extern.h"
+#include "glossary.h"
+#include "langid.h"
+#include "limit.h"
+#include "markup.h"
+#include "metrics.h"
 #include "pathnames.h"
+#include "piece.h"
+#include "pipeline.h"
+#include "prefetch.h"
+#include "progress.h"
+#include "segment.h"
+#include "stream.h"
+#include "upstream.h"
+#include "warmup.h"
+
+/* Wait for the PRIMARY selection to stay put this long before translating */
+#define WATCH_SETTLE_MS	400
+
+/* How much of the text of a document with markup to guess its language by */
+#define GUESS_SAMPLE	4096
+
+/* Text longer than this is shown a window at a time */
+#define LARGE_TEXT	(1024 * 1024)
+/* How much of such a text to show at once */
+#define LARGE_WINDOW	(128 * 1024)
+/* Where a text buffer keeps the whole of its large text */
+#define LARGE_KEY	"idiom-large"
+
+/* How the sentence under the cursor, and its translation, are marked */
+#define FOLLOW_BACKGROUND	"#fce94f"
 
 enum src_pos {
 	NO_BOX,
@@ -42,14 +76,34 @@ struct state {
 	GtkTextView	*bot_view;	/* The view with the bottom text buffer */
 	const char	*top_lang;	/* The language up top */
 	const char	*bot_lang;	/* The language down bottom */
+	GtkComboBox	*top_combo;	/* The language chooser up top */
+	GtkComboBox	*bot_combo;	/* The language chooser down bottom */
+	gulong		 top_combo_id;	/* Its "changed" handler */
+	gulong		 bot_combo_id;	/* Its "changed" handler */
 	GtkWindow	*parent;	/* The parent window */
 	GtkProgressBar	*prog_bar;	/* The progress bar */
+	struct alternates *alts;	/* What else the last translation had */
+	struct pane	*panes;		/* More languages for the top box */
+	size_t		 npanes;	/* How many there are */
+	struct trans_text *running;	/* The latest translation, until done */
+	int		 watch;		/* Whether to follow the PRIMARY */
+	guint		 watch_id;	/* The wait for it to settle, if any */
+	char		*last_clip;	/* What it held when last translated */
+	enum markup	 markup;	/* What kind of file was opened */
+	char		*find;		/* What was last looked for */
+	struct align	*align;		/* Which sentences translate to which */
+	GtkTextBuffer	*align_src;	/* Which box has the text translated */
+	GtkTextTag	*top_tag;	/* The sentence followed up top */
+	GtkTextTag	*bot_tag;	/* The sentence followed down bottom */
+	int		 following;	/* Whether a view is being lined up */
 };
 
-/* This is used to transfer data out of curl */
-struct mem_buf {
-	char	*mem;	/* The actual string */
-	size_t	 size;	/* The size of the string */
+/*
+ * An extra result pane, showing the top box in one more language.
+ */
+struct pane {
+	const char	*lang;		/* Its language */
+	GtkTextBuffer	*buf;		/* Its text */
 };
 
 /*
@@ -57,18 +111,46 @@ struct mem_buf {
  * thread.
  */
 struct trans_text {
-	gchar		*src;		/* The source text */
-	GtkTextBuffer	*dst_g_buf;	/* The destination text buffer */
-	GtkProgressBar	*prog_bar;	/* The progress bar */
+	GBytes		*src;		/* The source text */
 	const char	*src_lang;	/* The source language */
-	const char	*dst_lang;	/* The destination language */
-	struct mem_buf	*translation;	/* The translated text */
-	guint		 timeout_id;	/* The progressbar pulser id */
+	struct segment	*segs;		/* The source, split up */
+	size_t		 nsegs;		/* How many segments there are */
+	struct trans_target *targets;	/* Where it all goes */
+	size_t		 ntargets;	/* How many places that is */
+	struct glossary_terms *terms;	/* What the glossary kept out */
+	enum markup	 markup;	/* What kind of document it is */
+	struct state	*s;		/* The window it is for */
+	GMutex		 lock;		/* Guards cancelled and the batchers */
+	int		 cancelled;	/* Set once a newer one starts */
 };
 
-#define TRANS_URL_FMT "https://translate.google.com/translate_a/single?client=t&sl=%s&tl=%s&dt=bd&dt=t&dt=at"
+/*
+ * A text too long to hand to GTK+ whole. All of it is kept in a piece table,
+ * and only a window of it, around what is on screen, is in the text buffer;
+ * the window moves as the view scrolls.
+ */
+struct large {
+	struct piece_table *pt;		/* All of the text */
+	size_t		 off;		/* Where the window starts in it */
+	size_t		 choff;		/* The same, in characters */
+	gchar		*win;		/* What is in the window */
+	size_t		 len;		/* How long that is */
+	int		 moving;	/* Whether the window is being moved */
+};
 
-#define USER_AGENT "User-Agent: Mozilla/5.0 (X11; Linux i686; rv:10.0.12) Gecko/20100101 Firefox/10.0.12 Iceweasel/10.0.12"
+/*
+ * One language the text goes into, and the box it ends up in.
+ */
+struct trans_target {
+	struct trans_text *t;		/* The translation this is part of */
+	GtkTextBuffer	*dst_g_buf;	/* The destination text buffer */
+	const char	*dst_lang;	/* The destination language */
+	GBytes		*translation;	/* The translated text */
+	struct alternates *alts;	/* What else the responses had */
+	struct alternates **dst_alts;	/* Where to keep that, if anywhere */
+	struct batcher	*b;		/* Its requests, while they are made */
+	struct align	*align;		/* Where its segments went, if kept */
+};
 
 static void		 top_but_cb(GtkButton *, gpointer);
 static void		 bot_but_cb(GtkButton *, gpointer);
@@ -80,10 +162,23 @@ static void		 write_cb(GtkMenuItem *, gpointer);
 static void		 cut_cb(GtkMenuItem *, gpointer);
 static void		 copy_cb(GtkMenuItem *, gpointer);
 static void		 paste_cb(GtkMenuItem *, gpointer);
+static void		 find_cb(GtkMenuItem *, gpointer);
+static void		 scrolled_cb(GtkAdjustment *, gpointer);
+static void		 inserted_cb(GtkTextBuffer *, GtkTextIter *, gchar *,
+    gint, gpointer);
+static void		 deleted_cb(GtkTextBuffer *, GtkTextIter *,
+    GtkTextIter *, gpointer);
+static void		 cursor_cb(GtkTextBuffer *, GtkTextIter *,
+    GtkTextMark *, gpointer);
+static void		 follow_scroll_cb(GtkAdjustment *, gpointer);
+static void		 alternates_cb(GtkMenuItem *, gpointer);
 static void		 about_cb(GtkMenuItem *, gpointer);
 static void		 from_clip_cb(GtkWidget *, gpointer);
 static void		 clip_received_cb(GtkClipboard *, const gchar *,
     gpointer);
+static void		 owner_change_cb(GtkClipboard *, GdkEvent *,
+    gpointer);
+static gboolean		 settled_cb(gpointer);
 static gboolean		 top_text_in_cb(GtkWidget *, GdkEvent *, gpointer);
 static gboolean		 bot_text_in_cb(GtkWidget *, GdkEvent *, gpointer);
 static gboolean		 top_text_out_cb(GtkWidget *, GdkEvent *, gpointer);
@@ -91,25 +186,53 @@ static gboolean		 bot_text_out_cb(GtkWidget *, GdkEvent *, gpointer);
 
 static GtkTextView	*focused_text_view(struct state *);
 static GtkTextBuffer	*deactivated_text_buf(struct state *);
-
-static void		 xwarn(const char *fmt, ...);
+static int		 find_text(GtkTextView *, const char *);
+
+static void		 show_text(GtkTextBuffer *, GBytes *);
+static void		 forget_large(GtkTextBuffer *);
+static gchar		*buffer_text(GtkTextBuffer *);
+static struct large	*large_of(GtkTextBuffer *);
+static void		 large_free(gpointer);
+static void		 large_sync(GtkTextBuffer *, struct large *);
+static void		 large_move(GtkTextBuffer *, struct large *, size_t);
+static void		 large_iter(GtkTextBuffer *, struct large *, size_t,
+    GtkTextIter *);
+static size_t		 large_offset(struct large *, const GtkTextIter *);
+static size_t		 buffer_chars(GtkTextBuffer *);
+
+static void		 follow(struct state *, GtkTextView *,
+    const GtkTextIter *, int);
+static void		 unfollow(struct state *);
+static void		 highlight(struct state *, GtkTextBuffer *,
+    enum align_side, size_t);
+static int		 text_offset(struct state *, GtkTextBuffer *,
+    const GtkTextIter *, enum align_side *, size_t *);
+static void		 text_iter(GtkTextBuffer *, size_t, GtkTextIter *);
+static void		 text_show(GtkTextBuffer *, size_t);
 
 static void		 translate_box(struct state *);
-static void		 insert_sentence(JsonArray *, guint, JsonNode *,
-    gpointer);
-
-static size_t		 accumulate_mem_buf(char *, size_t, size_t, void *);
-static struct mem_buf	*mem_buf_new();
-static void		 mem_buf_free(struct mem_buf*);
+static void		 supersede(struct trans_text *);
+static int		 superseded(struct trans_text *);
+static const char	*switch_src_lang(struct state *, const char *);
+static gchar		*text_runs(const char *, enum markup);
+static void		 collect_result(const char *, void *);
+static void		 show_progress(double, gint64, void *);
+
+static size_t		 split_langs(char *, const char ***);
+static void		 add_panes(struct state *, GtkBox *, const char **,
+    size_t);
+static void		 translate_target(struct trans_target *);
+static void		 stitch(struct trans_target *, GString *, const char *,
+    size_t, const char *, size_t);
 
 static void		 replace_text_from_file(GtkTextBuffer *, char *);
 static void		 write_deactivated(struct state *, char *);
-static char		*read_fd(int);
+static char		*read_fd(int, size_t *);
 
 gpointer		 translate_box_func(gpointer);
+gpointer		 translate_target_func(gpointer);
 gboolean		 set_translation_text(gpointer);
 gboolean		 done_translation(gpointer);
-gboolean		 pulse(gpointer);
 
 __dead void		 usage();
 
@@ -125,20 +248,61 @@ main(int argc, char *argv[])
 	GtkWidget	*window, *top_text, *bot_text, *top_but, *bot_but;
 	GtkWidget	*top_combo, *bot_combo, *prog_bar;
 	GtkWidget	*file_new, *file_open, *file_save_as, *file_quit;
-	GtkWidget	*edit_cut, *edit_copy, *edit_paste, *help_about;
+	GtkWidget	*edit_cut, *edit_copy, *edit_paste, *edit_alternates;
+	GtkWidget	*edit_find, *help_about, *extra_box;
 	struct state	 s;
 	enum which_clip	 from_clipboard;
-	int		 ch;
+	const char	*src_lang, *in_path, *out_path, *warm_path;
+	const char	*gloss_path;
+	const char	**dst_langs, *en;
+	char		*dst_lang;
+	size_t		 ndst;
+	gboolean	 have_display;
+	int		 ch, bflag, watch, ret;
 
 	from_clipboard = NO_CLIPBOARD;
+	src_lang = dst_lang = NULL;
+	in_path = out_path = warm_path = gloss_path = NULL;
+	bflag = watch = 0;
+
+	if (curl_global_init(CURL_GLOBAL_DEFAULT) != 0)
+		errx(1, "curl_global_init");
+	upstream_init();
+	limit_init();
+	metrics_init();
+	cache_load();
 
-	gtk_init(&argc, &argv);
+	have_display = gtk_init_check(&argc, &argv);
 
-	while ((ch = getopt(argc, argv, "p")) != -1)
+	while ((ch = getopt(argc, argv, "bg:i:o:Pps:t:w:")) != -1)
 		switch (ch) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'g':
+			gloss_path = optarg;
+			break;
+		case 'i':
+			in_path = optarg;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'P':
+			watch = 1;
+			/* FALLTHROUGH */
 		case 'p':
 			from_clipboard = PRIMARY;
 			break;
+		case 's':
+			src_lang = optarg;
+			break;
+		case 't':
+			dst_lang = optarg;
+			break;
+		case 'w':
+			warm_path = optarg;
+			break;
 		default:
 			usage();
 			/* NOTREACHED */
@@ -147,6 +311,43 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	ndst = split_langs(dst_lang, &dst_langs);
+	en = "en";
+
+	if (in_path != NULL || out_path != NULL) {
+		if (in_path == NULL || out_path == NULL || bflag ||
+		    warm_path != NULL || gloss_path != NULL ||
+		    from_clipboard != NO_CLIPBOARD)
+			usage();
+		if (ndst > 1)
+			errx(EX_USAGE, "-i and -o take only one language");
+		upstream_prewarm();
+		ret = stream_file(in_path, out_path,
+		    src_lang ? src_lang : "auto", ndst > 0 ? dst_langs[0] : en);
+		free(dst_langs);
+		return ret;
+	}
+
+	if (bflag) {
+		if (gloss_path != NULL || from_clipboard != NO_CLIPBOARD)
+			usage();
+		upstream_prewarm();
+		if (warm_path != NULL)
+			warmup_start(warm_path, src_lang ? src_lang : "auto",
+			    ndst > 0 ? dst_langs : &en, ndst > 0 ? ndst : 1);
+		ret = pipeline_run(stdin, stdout, src_lang ? src_lang : "auto",
+		    ndst > 0 ? dst_langs : &en, ndst > 0 ? ndst : 1);
+		free(dst_langs);
+		return ret;
+	}
+
+	if (!have_display)
+		errx(EX_UNAVAILABLE, "cannot open display");
+	upstream_prewarm();
+
+	if (gloss_path != NULL)
+		glossary_load(gloss_path);
+
 	builder = gtk_builder_new_from_file(INTERFACE_PATH);
 	window = GTK_WIDGET(gtk_builder_get_object(builder, "window1"));
 	top_text = GTK_WIDGET(gtk_builder_get_object(builder, "textview1"));
@@ -164,7 +365,15 @@ main(int argc, char *argv[])
 	edit_cut = GTK_WIDGET(gtk_builder_get_object(builder, "menu-item-edit-cut"));
 	edit_copy = GTK_WIDGET(gtk_builder_get_object(builder, "menu-item-edit-copy"));
 	edit_paste = GTK_WIDGET(gtk_builder_get_object(builder, "menu-item-edit-paste"));
+	edit_alternates = GTK_WIDGET(gtk_builder_get_object(builder, "menu-item-edit-alternatives"));
+	edit_find = GTK_WIDGET(gtk_builder_get_object(builder, "menu-item-edit-find"));
 	help_about = GTK_WIDGET(gtk_builder_get_object(builder, "menu-item-help-about"));
+	extra_box = GTK_WIDGET(gtk_builder_get_object(builder, "box-extra"));
+
+	if (src_lang != NULL)
+		gtk_combo_box_set_active_id(GTK_COMBO_BOX(top_combo), src_lang);
+	if (ndst > 0)
+		gtk_combo_box_set_active_id(GTK_COMBO_BOX(bot_combo), dst_langs[0]);
 
 	s.top_buf = gtk_text_view_get_buffer(GTK_TEXT_VIEW(top_text));
 	s.bot_buf = gtk_text_view_get_buffer(GTK_TEXT_VIEW(bot_text));
@@ -172,19 +381,48 @@ main(int argc, char *argv[])
 	s.bot_view = GTK_TEXT_VIEW(bot_text);
 	s.top_lang = gtk_combo_box_get_active_id(GTK_COMBO_BOX(top_combo));
 	s.bot_lang = gtk_combo_box_get_active_id(GTK_COMBO_BOX(bot_combo));
+	s.top_combo = GTK_COMBO_BOX(top_combo);
+	s.bot_combo = GTK_COMBO_BOX(bot_combo);
 	s.clipboard = from_clipboard;
 	s.active = NO_BOX;
 	s.focused = TOP_BOX;
 	s.prog_bar = GTK_PROGRESS_BAR(prog_bar);
+	progress_init(show_progress, s.prog_bar);
 	s.parent = GTK_WINDOW(window);
+	s.alts = NULL;
+	s.panes = NULL;
+	s.npanes = 0;
+	s.running = NULL;
+	s.watch = watch;
+	s.watch_id = 0;
+	s.last_clip = NULL;
+	s.markup = MARKUP_NONE;
+	s.find = NULL;
+	s.align = NULL;
+	s.align_src = NULL;
+	s.top_tag = gtk_text_buffer_create_tag(s.top_buf, NULL,
+	    "background", FOLLOW_BACKGROUND, NULL);
+	s.bot_tag = gtk_text_buffer_create_tag(s.bot_buf, NULL,
+	    "background", FOLLOW_BACKGROUND, NULL);
+	s.following = 0;
+
+	/* The first language goes down bottom; any others get panes of their own */
+	if (ndst > 1)
+		add_panes(&s, GTK_BOX(extra_box), dst_langs + 1, ndst - 1);
+	if (warm_path != NULL)
+		warmup_start(warm_path, s.top_lang,
+		    ndst > 0 ? dst_langs : &s.bot_lang, ndst > 0 ? ndst : 1);
+	free(dst_langs);
 
 	gtk_window_set_default_size(GTK_WINDOW(window), 800, 400);
 	g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
 	g_signal_connect(window, "realize", G_CALLBACK(from_clip_cb), &s);
 	g_signal_connect(top_but, "clicked", G_CALLBACK(top_but_cb), &s);
 	g_signal_connect(bot_but, "clicked", G_CALLBACK(bot_but_cb), &s);
-	g_signal_connect(top_combo, "changed", G_CALLBACK(top_combo_cb), &s);
-	g_signal_connect(bot_combo, "changed", G_CALLBACK(bot_combo_cb), &s);
+	s.top_combo_id = g_signal_connect(top_combo, "changed",
+	    G_CALLBACK(top_combo_cb), &s);
+	s.bot_combo_id = g_signal_connect(bot_combo, "changed",
+	    G_CALLBACK(bot_combo_cb), &s);
 	g_signal_connect(top_text, "focus-in-event", G_CALLBACK(top_text_in_cb), &s);
 	g_signal_connect(bot_text, "focus-in-event", G_CALLBACK(bot_text_in_cb), &s);
 	g_signal_connect(top_text, "focus-out-event", G_CALLBACK(top_text_out_cb), &s);
@@ -196,7 +434,30 @@ main(int argc, char *argv[])
 	g_signal_connect(edit_cut, "activate", G_CALLBACK(cut_cb), &s);
 	g_signal_connect(edit_copy, "activate", G_CALLBACK(copy_cb), &s);
 	g_signal_connect(edit_paste, "activate", G_CALLBACK(paste_cb), &s);
+	g_signal_connect(edit_alternates, "activate", G_CALLBACK(alternates_cb), &s);
+	g_signal_connect(edit_find, "activate", G_CALLBACK(find_cb), &s);
+	g_signal_connect(gtk_scrollable_get_vadjustment(
+	    GTK_SCROLLABLE(top_text)), "value-changed",
+	    G_CALLBACK(scrolled_cb), top_text);
+	g_signal_connect(gtk_scrollable_get_vadjustment(
+	    GTK_SCROLLABLE(bot_text)), "value-changed",
+	    G_CALLBACK(scrolled_cb), bot_text);
+	g_signal_connect(gtk_scrollable_get_vadjustment(
+	    GTK_SCROLLABLE(top_text)), "value-changed",
+	    G_CALLBACK(follow_scroll_cb), &s);
+	g_signal_connect(gtk_scrollable_get_vadjustment(
+	    GTK_SCROLLABLE(bot_text)), "value-changed",
+	    G_CALLBACK(follow_scroll_cb), &s);
+	g_signal_connect(s.top_buf, "insert-text", G_CALLBACK(inserted_cb), &s);
+	g_signal_connect(s.bot_buf, "insert-text", G_CALLBACK(inserted_cb), &s);
+	g_signal_connect(s.top_buf, "delete-range", G_CALLBACK(deleted_cb), &s);
+	g_signal_connect(s.bot_buf, "delete-range", G_CALLBACK(deleted_cb), &s);
+	g_signal_connect(s.top_buf, "mark-set", G_CALLBACK(cursor_cb), &s);
+	g_signal_connect(s.bot_buf, "mark-set", G_CALLBACK(cursor_cb), &s);
 	g_signal_connect(help_about, "activate", G_CALLBACK(about_cb), window);
+	if (s.watch)
+		g_signal_connect(gtk_clipboard_get(GDK_SELECTION_PRIMARY),
+		    "owner-change", G_CALLBACK(owner_change_cb), &s);
 
 	gtk_window_set_default_icon_name(ICON_NAME);
 	gtk_widget_show(window);
@@ -212,10 +473,74 @@ main(int argc, char *argv[])
 void
 usage()
 {
-	fprintf(stderr, "usage: idiom [-p]\n");
+	fprintf(stderr, "usage: idiom [-Pp] [-g glossary] [-s lang] "
+	    "[-t lang[,lang...]] [-w phrases]\n"
+	    "       idiom -b [-s lang] [-t lang[,lang...]] [-w phrases]\n"
+	    "       idiom -i file -o file [-s lang] [-t lang]\n");
 	exit(EX_USAGE);
 }
 
+/*
+ * Split a comma-separated list of languages, in place.
+ *
+ * RETURN: how many there are, with langs set to them, to be freed by the
+ * caller. The list may be NULL, for none.
+ */
+static size_t
+split_langs(char *list, const char ***langs)
+{
+	char	*lang;
+	size_t	 n;
+
+	*langs = NULL;
+	n = 0;
+
+	while ((lang = strsep(&list, ",")) != NULL) {
+		if (*lang == '\0')
+			continue;
+		if ((*langs = reallocarray(*langs, n + 1, sizeof(char *))) ==
+		    NULL)
+			err(1, "reallocarray");
+		(*langs)[n++] = lang;
+	}
+
+	return n;
+}
+
+/*
+ * Add a read-only pane for each language, which translating the top box
+ * also fills in.
+ */
+static void
+add_panes(struct state *s, GtkBox *box, const char **langs, size_t n)
+{
+	GtkWidget	*frame, *scroll, *view;
+	size_t		 i;
+
+	if ((s->panes = reallocarray(NULL, n, sizeof(struct pane))) == NULL)
+		err(1, "reallocarray");
+	s->npanes = n;
+
+	for (i = 0; i < n; i++) {
+		frame = gtk_frame_new(langs[i]);
+		scroll = gtk_scrolled_window_new(NULL, NULL);
+		view = gtk_text_view_new();
+		gtk_text_view_set_editable(GTK_TEXT_VIEW(view), FALSE);
+		gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(view), GTK_WRAP_WORD);
+		gtk_container_add(GTK_CONTAINER(scroll), view);
+		gtk_container_add(GTK_CONTAINER(frame), scroll);
+		g_signal_connect(gtk_scrollable_get_vadjustment(
+		    GTK_SCROLLABLE(view)), "value-changed",
+		    G_CALLBACK(scrolled_cb), view);
+		gtk_box_pack_start(box, frame, TRUE, TRUE, 0);
+
+		s->panes[i].lang = langs[i];
+		s->panes[i].buf = gtk_text_view_get_buffer(GTK_TEXT_VIEW(view));
+	}
+
+	gtk_widget_show_all(GTK_WIDGET(box));
+}
+
 /*
  * Copy the clipboard into the top buffer then translate it.
  */
@@ -234,7 +559,8 @@ from_clip_cb(GtkWidget *widget, gpointer user_data)
 }
 
 /*
- * Set the top buffer's text then translate it.
+ * Set the top buffer's text then translate it, unless it is the same text
+ * as last time, or there is none.
  */
 void
 clip_received_cb(GtkClipboard *clipboard, const gchar *text, gpointer data)
@@ -242,12 +568,61 @@ clip_received_cb(GtkClipboard *clipboard, const gchar *text, gpointer data)
 	struct state	*s;
 
 	s = (struct state *)data;
+
+	if (text == NULL || *text == '\0' ||
+	    (s->last_clip != NULL && strcmp(text, s->last_clip) == 0))
+		return;
+	g_free(s->last_clip);
+	s->last_clip = g_strdup(text);
+
 	s->active = TOP_BOX;
+	unfollow(s);
+	forget_large(s->top_buf);
 	gtk_text_buffer_set_text(s->top_buf, text, -1);
+	s->markup = MARKUP_NONE;
 
 	translate_box(s);
 }
 
+/*
+ * The PRIMARY selection has a new owner, or its owner has changed it. While
+ * the user is still dragging out a selection this happens over and over, so
+ * wait for it to stay put for WATCH_SETTLE_MS before reading it.
+ */
+static void
+owner_change_cb(GtkClipboard *clipboard, GdkEvent *event, gpointer user_data)
+{
+	struct state	*s;
+
+	s = (struct state *)user_data;
+
+	if (s->watch_id != 0)
+		g_source_remove(s->watch_id);
+	s->watch_id = g_timeout_add(WATCH_SETTLE_MS, settled_cb, s);
+}
+
+/*
+ * Read the PRIMARY selection, now that it has settled, to translate it. A
+ * selection made in one of idiom's own boxes is left alone.
+ *
+ * RETURN: false, so the function is not run again.
+ */
+static gboolean
+settled_cb(gpointer user_data)
+{
+	GtkClipboard	*cb;
+	struct state	*s;
+
+	s = (struct state *)user_data;
+	s->watch_id = 0;
+
+	cb = gtk_clipboard_get(GDK_SELECTION_PRIMARY);
+	if (gtk_clipboard_get_owner(cb) == NULL)
+		gtk_clipboard_request_text(cb, clip_received_cb, s);
+
+	return G_SOURCE_REMOVE;
+}
+
 /*
  * Translate the top box.
  *
@@ -379,12 +754,17 @@ clear_cb(GtkMenuItem *menuitem, gpointer user_data)
 	struct state	*s;
 	s = (struct state *)user_data;
 
+	unfollow(s);
+	forget_large(s->top_buf);
+	forget_large(s->bot_buf);
 	gtk_text_buffer_set_text(s->top_buf, "", 0);
 	gtk_text_buffer_set_text(s->bot_buf, "", 0);
+	s->markup = MARKUP_NONE;
 }
 
 /*
  * Show a file open dialog, then load the selected file into the top buffer.
+ * If its name says it is HTML, XML, or Markdown, only its text is translated.
  */
 static void
 open_cb(GtkMenuItem *menuitem, gpointer user_data)
@@ -403,8 +783,11 @@ open_cb(GtkMenuItem *menuitem, gpointer user_data)
 
 	if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
 		path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-		if (path != NULL)
+		if (path != NULL) {
+			unfollow(s);
 			replace_text_from_file(s->top_buf, path);
+			s->markup = markup_guess(path);
+		}
 		g_free(path);
 	}
 
@@ -454,6 +837,7 @@ write_deactivated(struct state *s, char *path)
 {
 	GtkTextBuffer	*text_buf;
 	GtkTextIter	 start, end;
+	struct large	*lg;
  	gchar		*buf;
 	size_t		 len;
 	int		 fd;
@@ -461,9 +845,14 @@ write_deactivated(struct state *s, char *path)
 	if ((text_buf = deactivated_text_buf(s)) == NULL)
 		return;
 
-	gtk_text_buffer_get_bounds(text_buf, &start, &end);
-	buf = gtk_text_buffer_get_text(text_buf, &start, &end, 0);
-	len = strlen(buf);
+	/* A large text is written from its store, not copied out first */
+	buf = NULL;
+	if ((lg = large_of(text_buf)) != NULL)
+		large_sync(text_buf, lg);
+	else {
+		gtk_text_buffer_get_bounds(text_buf, &start, &end);
+		buf = gtk_text_buffer_get_text(text_buf, &start, &end, 0);
+	}
 
 	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
 	if (fd == -1) {
@@ -471,9 +860,17 @@ write_deactivated(struct state *s, char *path)
 		goto cleanup;
 	}
 
-	if (write(fd, buf, len) == -1) {
-		xwarn("write");
-		goto cleanup;
+	if (lg != NULL) {
+		if (piece_write(lg->pt, fd) == -1) {
+			xwarn("write");
+			goto cleanup;
+		}
+	} else {
+		len = strlen(buf);
+		if (write(fd, buf, len) == -1) {
+			xwarn("write");
+			goto cleanup;
+		}
 	}
 
 	if (write(fd, "\n", 2) == -1) {
@@ -524,6 +921,7 @@ xwarn(const char *fmt, ...)
 	guint	 cxt_id;
 	char	*msg;
 
+	msg = NULL;
 	va_start(ap, fmt);
 
 	if (status_bar == NULL) {
@@ -535,6 +933,7 @@ xwarn(const char *fmt, ...)
 
 	if (vasprintf(&msg, fmt, ap) == -1) {
 		warn("vasprintf");
+		msg = NULL;
 		goto cleanup;
 	}
 
@@ -572,6 +971,44 @@ about_cb(GtkMenuItem *menuitem, gpointer user_data)
 	    NULL);
 }
 
+/*
+ * Show the alternate translations and dictionary entries for the selected
+ * word or phrase, from the last translation.
+ */
+static void
+alternates_cb(GtkMenuItem *menuitem, gpointer user_data)
+{
+	GtkTextView	*text_view;
+	GtkTextBuffer	*text_buf;
+	GtkTextIter	 start, end;
+	GtkWidget	*dialog;
+	struct state	*s;
+	gchar		*phrase;
+	char		*found;
+
+	s = (struct state *)user_data;
+	if ((text_view = focused_text_view(s)) == NULL)
+		return;
+
+	text_buf = gtk_text_view_get_buffer(text_view);
+	if (!gtk_text_buffer_get_selection_bounds(text_buf, &start, &end))
+		return;
+
+	phrase = gtk_text_buffer_get_text(text_buf, &start, &end, 0);
+	found = s->alts != NULL ? alternates_lookup(s->alts, phrase) : NULL;
+
+	dialog = gtk_message_dialog_new(s->parent,
+	    GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_INFO,
+	    GTK_BUTTONS_CLOSE, "%s", phrase);
+	gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog),
+	    "%s", found != NULL ? found : "No alternatives.");
+	gtk_dialog_run(GTK_DIALOG(dialog));
+	gtk_widget_destroy(dialog);
+
+	free(found);
+	g_free(phrase);
+}
+
 /*
  * Activate the cut-clipboard signal on the focused text view.
  */
@@ -620,6 +1057,48 @@ paste_cb(GtkMenuItem *menuitem, gpointer user_data)
 	g_signal_emit_by_name(text_view, "paste-clipboard", NULL);
 }
 
+/*
+ * Ask what to look for, then select the next place it appears in the focused
+ * text box after the cursor, going around to the start if need be. A large
+ * text is searched through whole, not only the part on screen.
+ */
+static void
+find_cb(GtkMenuItem *menuitem, gpointer user_data)
+{
+	GtkTextView	*text_view;
+	GtkWidget	*dialog, *entry;
+	struct state	*s;
+
+	s = (struct state *)user_data;
+	if ((text_view = focused_text_view(s)) == NULL)
+		return;
+
+	dialog = gtk_dialog_new_with_buttons("Find", s->parent,
+	    GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+	    "_Cancel", GTK_RESPONSE_CANCEL,
+	    "_Find", GTK_RESPONSE_ACCEPT,
+	    NULL);
+	gtk_dialog_set_default_response(GTK_DIALOG(dialog),
+	    GTK_RESPONSE_ACCEPT);
+
+	entry = gtk_entry_new();
+	gtk_entry_set_activates_default(GTK_ENTRY(entry), TRUE);
+	if (s->find != NULL)
+		gtk_entry_set_text(GTK_ENTRY(entry), s->find);
+	gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(
+	    GTK_DIALOG(dialog))), entry);
+	gtk_widget_show_all(dialog);
+
+	if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+		g_free(s->find);
+		s->find = g_strdup(gtk_entry_get_text(GTK_ENTRY(entry)));
+		if (*s->find != '\0' && !find_text(text_view, s->find))
+			gtk_widget_error_bell(GTK_WIDGET(text_view));
+	}
+
+	gtk_widget_destroy(dialog);
+}
+
 /*
  * RETURN: a pointer to the GtkTexView that is currently focused. If no box is
  * currently focused, return NULL.
@@ -645,6 +1124,50 @@ focused_text_view(struct state *s)
 	return text_view;
 }
 
+/*
+ * Select the next place the needle appears after the cursor in the text
+ * view, going around to the start if need be, and scroll to it.
+ *
+ * RETURN: whether it was found.
+ */
+static int
+find_text(GtkTextView *text_view, const char *needle)
+{
+	GtkTextBuffer	*text_buf;
+	GtkTextIter	 start, end, match_start, match_end;
+	struct large	*lg;
+	size_t		 n;
+	ssize_t		 at;
+
+	text_buf = gtk_text_view_get_buffer(text_view);
+	gtk_text_buffer_get_selection_bounds(text_buf, &start, &end);
+
+	if ((lg = large_of(text_buf)) == NULL) {
+		if (!gtk_text_iter_forward_search(&end, needle, 0, &match_start,
+		    &match_end, NULL)) {
+			gtk_text_buffer_get_start_iter(text_buf, &end);
+			if (!gtk_text_iter_forward_search(&end, needle, 0,
+			    &match_start, &match_end, NULL))
+				return 0;
+		}
+	} else {
+		large_sync(text_buf, lg);
+		n = strlen(needle);
+		if ((at = piece_find(lg->pt, large_offset(lg, &end), needle,
+		    n)) == -1 && (at = piece_find(lg->pt, 0, needle, n)) == -1)
+			return 0;
+		if ((size_t)at < lg->off || at + n > lg->off + lg->len)
+			large_move(text_buf, lg, at);
+		large_iter(text_buf, lg, at, &match_start);
+		large_iter(text_buf, lg, at + n, &match_end);
+	}
+
+	gtk_text_buffer_select_range(text_buf, &match_start, &match_end);
+	gtk_text_view_scroll_to_mark(text_view,
+	    gtk_text_buffer_get_insert(text_buf), 0.1, FALSE, 0.0, 0.0);
+	return 1;
+}
+
 /*
  * Start the translation.
  */
@@ -653,17 +1176,14 @@ translate_box(struct state *s)
 {
 	GThread			*thr;
 	struct trans_text	*t;
- 	gchar			*src_buf;
-	GtkTextIter		 src_start, src_end;
+	struct trans_target	*tt;
+ 	gchar			*src_buf, *sample;
 	GtkTextBuffer		*src_g_buf = NULL, *dst_g_buf = NULL;
 	const char		*src_lang = NULL, *dst_lang = NULL;
-	guint			 timeout_id;
+	const char		*guess;
+	size_t			 i, n;
 
 	src_buf = NULL;
-	t = NULL;
-
-	gtk_progress_bar_pulse(s->prog_bar);
-	timeout_id = g_timeout_add(100, pulse, s->prog_bar);
 
 	/* get the string from the user */
 	switch (s->active) {
@@ -687,22 +1207,64 @@ translate_box(struct state *s)
 		errx(EX_SOFTWARE, "unknown src_pos");
 	}
 
-	gtk_text_buffer_get_bounds(src_g_buf, &src_start, &src_end);
-	src_buf = gtk_text_buffer_get_text(src_g_buf, &src_start, &src_end, 0);
+	src_buf = buffer_text(src_g_buf);
 
 	if (*src_buf == '\0')
 		goto cleanup;
 
+	/* Tags, scripts, and style sheets say nothing about the language */
+	sample = s->markup != MARKUP_NONE ? text_runs(src_buf, s->markup) :
+	    NULL;
+	guess = langid_guess(sample != NULL ? sample : src_buf,
+	    strlen(sample != NULL ? sample : src_buf), src_lang);
+	if (guess != NULL && strcmp(guess, src_lang) != 0 &&
+	    strcmp(guess, dst_lang) != 0)
+		src_lang = switch_src_lang(s, guess);
+	g_free(sample);
+
+	prefetch_cancel();
+	prefetch_note(src_lang, dst_lang);
+	warmup_defer();
+
 	if ((t = (struct trans_text *)malloc(sizeof(struct trans_text))) == NULL)
 		err(1, "malloc");
 
-	t->src = src_buf;
-	t->dst_g_buf = dst_g_buf;
+	/* The top box also goes into any extra panes */
+	n = 1 + (s->active == TOP_BOX ? s->npanes : 0);
+	if ((t->targets = calloc(n, sizeof(struct trans_target))) == NULL)
+		err(1, "calloc");
+
+	t->src = g_bytes_new_take(src_buf, strlen(src_buf));
+	src_buf = NULL;
 	t->src_lang = src_lang;
-	t->dst_lang = dst_lang;
-	t->timeout_id = timeout_id;
-	t->prog_bar = s->prog_bar;
-	t->translation = NULL;
+	t->segs = NULL;
+	t->nsegs = 0;
+	t->ntargets = n;
+	t->terms = NULL;
+	t->markup = s->markup;
+	t->s = s;
+	g_mutex_init(&t->lock);
+	t->cancelled = 0;
+
+	for (i = 0; i < n; i++) {
+		tt = &t->targets[i];
+		tt->t = t;
+		if (i == 0) {
+			tt->dst_g_buf = dst_g_buf;
+			tt->dst_lang = dst_lang;
+			tt->alts = alternates_new();
+			tt->dst_alts = &s->alts;
+			tt->align = align_new();
+		} else {
+			tt->dst_g_buf = s->panes[i - 1].buf;
+			tt->dst_lang = s->panes[i - 1].lang;
+		}
+	}
+
+	/* Whatever is still running is out of date */
+	if (s->running != NULL)
+		supersede(s->running);
+	s->running = t;
 
 	/* launch the thread */
 	thr = g_thread_new("translator", translate_box_func, t);
@@ -710,147 +1272,401 @@ translate_box(struct state *s)
 	return;
 
 cleanup:
-	g_source_remove(timeout_id);
-	if (t)
-		t->timeout_id = 0;
-	gtk_progress_bar_set_fraction(s->prog_bar, 0.0);
-	free(t);
+	g_free(src_buf);
 }
 
 /*
- * Pulsate the progress bar.
- *
- * RETURN: true, so the function is run again.
+ * Give up on a translation that a newer one has made out of date: its
+ * requests not yet sent are dropped, and what it does get back is cached but
+ * not shown.
  */
-gboolean
-pulse(gpointer user_data)
+static void
+supersede(struct trans_text *t)
+{
+	size_t	i;
+
+	g_mutex_lock(&t->lock);
+	t->cancelled = 1;
+	for (i = 0; i < t->ntargets; i++)
+		if (t->targets[i].b != NULL)
+			batcher_cancel(t->targets[i].b);
+	g_mutex_unlock(&t->lock);
+}
+
+/*
+ * RETURN: whether a newer translation has made this one out of date.
+ */
+static int
+superseded(struct trans_text *t)
 {
-	GtkProgressBar	*prog_bar;
-	prog_bar = (GtkProgressBar *)user_data;
+	int	ret;
 
-	gtk_progress_bar_pulse(prog_bar);
-	return TRUE;
+	g_mutex_lock(&t->lock);
+	ret = t->cancelled;
+	g_mutex_unlock(&t->lock);
+
+	return ret;
 }
 
 /*
- * Translate the text into the other box.
+ * RETURN: the first GUESS_SAMPLE bytes or so of the text of a document with
+ * markup, leaving the markup out, to be freed with g_free.
+ */
+static gchar *
+text_runs(const char *text, enum markup markup)
+{
+	struct segment	*segs;
+	GString		*runs;
+	size_t		 i, n;
+
+	n = markup_text(text, strlen(text), UPSTREAM_MAX_SEGMENT, markup,
+	    &segs);
+
+	runs = g_string_new(NULL);
+	for (i = 0; i < n && runs->len < GUESS_SAMPLE; i++) {
+		g_string_append_len(runs, text + segs[i].off, segs[i].len);
+		g_string_append_c(runs, ' ');
+	}
+	free(segs);
+
+	return g_string_free(runs, FALSE);
+}
+
+/*
+ * Point the language chooser of the active box at lang, without that
+ * counting as the user picking it and starting another translation, and say
+ * so in the status bar.
  *
- * This function does too much:
+ * RETURN: the source language now chosen, which is the old one if lang is
+ * not on offer.
+ */
+static const char *
+switch_src_lang(struct state *s, const char *lang)
+{
+	GtkComboBox	*combo;
+	const char	*now;
+	char		*msg;
+	gulong		 id;
+	guint		 cxt_id;
+
+	if (s->active == TOP_BOX) {
+		combo = s->top_combo;
+		id = s->top_combo_id;
+	} else {
+		combo = s->bot_combo;
+		id = s->bot_combo_id;
+	}
+
+	g_signal_handler_block(combo, id);
+	gtk_combo_box_set_active_id(combo, lang);
+	g_signal_handler_unblock(combo, id);
+
+	now = gtk_combo_box_get_active_id(combo);
+	if (status_bar != NULL && now != NULL && strcmp(now, lang) == 0) {
+		if (asprintf(&msg, "Source language switched to %s", lang) == -1)
+			err(1, "asprintf");
+		cxt_id = gtk_statusbar_get_context_id(status_bar, "language");
+		gtk_statusbar_push(status_bar, cxt_id, msg);
+		free(msg);
+	}
+
+	if (s->active == TOP_BOX)
+		return s->top_lang = now;
+	else
+		return s->bot_lang = now;
+}
+
+/*
+ * Translate the text into the other box, and into any extra panes.
  *
- * 1. Read the buffer from the active box.
- * 2. Fetch a translation from the Internet.
- * 3. Parse the JSON.
- * 4. Set the buffer of the inactive box.
+ * The terms in the glossary are taken out first, and put back into each
+ * translation. The text is split into segments once, and every language
+ * gets the same segments; in a document with markup, the markup is left out
+ * of them and so copied through as it is. Each language beyond the first is
+ * translated on a thread of its own, so their requests are in flight
+ * together and the whole takes about as long as the slowest of them; each
+ * box is filled in as soon as its language is done.
  */
 gpointer
 translate_box_func(gpointer data)
 {
-	CURL			*handle;
-	struct curl_slist	*headers;
-	char			*url, *esc_buf, *esc_data;
-	char			 errbuf[CURL_ERROR_SIZE];
-	int			 len, str_len;
-	size_t			 i;
-	struct mem_buf		*raw_json, *translation;
-	JsonParser		*parser;
-	GError			*error;
-	JsonNode		*root;
-	JsonArray		*sentences;
 	struct trans_text	*t;
+	GThread			**thr;
+	GBytes			 *protected;
+	const char		 *src;
+	size_t			  i, len;
 
 	t = (struct trans_text *)data;
-	headers = NULL;
-	parser = NULL;
-	esc_data = url = NULL; /* only to shut up gcc */
 
-	raw_json = mem_buf_new();
+	protected = glossary_protect(t->src, &t->terms);
+	g_bytes_unref(t->src);
+	t->src = protected;
 
-	/* get the translation JSON */
+	src = g_bytes_get_data(t->src, &len);
+	t->nsegs = markup_text(src, len, UPSTREAM_MAX_SEGMENT, t->markup,
+	    &t->segs);
 
-	if ((handle = curl_easy_init()) == NULL) {
-		xwarn("curl_easy_init failed");
-		goto done;
-	}
+	if ((thr = calloc(t->ntargets, sizeof(GThread *))) == NULL)
+		err(1, "calloc");
 
-	str_len = strlen(t->src);
-	if ((esc_buf = curl_easy_escape(handle, t->src, str_len)) == NULL) {
-		xwarn("curl_easy_escape");
-		goto done;
-	}
-	str_len = strlen(esc_buf);
+	for (i = 1; i < t->ntargets; i++)
+		thr[i] = g_thread_new("target", translate_target_func,
+		    &t->targets[i]);
+	translate_target(&t->targets[0]);
+	for (i = 1; i < t->ntargets; i++)
+		g_thread_join(thr[i]);
+	free(thr);
+
+	g_idle_add(done_translation, t);
+
+	return NULL;
+}
 
-	if ((esc_data = calloc(str_len + 3, sizeof(char))) == NULL)
+/*
+ * Translate the text into one more language, on a thread of its own.
+ */
+gpointer
+translate_target_func(gpointer data)
+{
+	translate_target((struct trans_target *)data);
+	return NULL;
+}
+
+/*
+ * Translate the text into one language.
+ *
+ * Segments not in the cache go out through a batcher in as few requests as
+ * fit, each repeated segment only once; the translations are then stitched
+ * back together with the whitespace, or markup, that separated the
+ * segments, and the glossary's terms put back in. For the first language,
+ * where each segment and its translation ended up is kept as they are
+ * stitched, and once that is done, guesses at the next translation are made
+ * in the background.
+ */
+static void
+translate_target(struct trans_target *tt)
+{
+	struct trans_text	*t;
+	struct segment		*segs;
+	struct batcher		*b;
+	struct dedup		*seen;
+	struct glossary_terms	*kept;
+	GBytes			*seg, *back;
+	GString			*translation;
+	const char		*src;
+	char			**results;
+	size_t			  i, n, len, prev;
+	ssize_t			 *same;
+	int			 *cached, failed;
+
+	t = tt->t;
+	segs = t->segs;
+	n = t->nsegs;
+	src = g_bytes_get_data(t->src, &len);
+
+	if ((results = calloc(n, sizeof(char *))) == NULL)
 		err(1, "calloc");
-	snprintf(esc_data, str_len + 3, "q=%s", esc_buf);
 
-	len = strlen(TRANS_URL_FMT) - 1;
-	if ((url = calloc(len, sizeof(char))) == NULL)
+	if ((cached = calloc(n, sizeof(int))) == NULL)
 		err(1, "calloc");
-	snprintf(url, len, TRANS_URL_FMT, t->src_lang, t->dst_lang);
 
-	if ((headers = curl_slist_append(headers, "User-Agent: "USER_AGENT)) == NULL) {
-		xwarn("curl_slist_append");
-		goto done;
+	if ((same = reallocarray(NULL, n, sizeof(ssize_t))) == NULL && n > 0)
+		err(1, "reallocarray");
+
+	progress_begin(n);
+
+	/*
+	 * The batcher gets slices of the source, not copies of it, and only
+	 * the first of any segments that repeat
+	 */
+	b = NULL;
+	seen = dedup_new();
+	for (i = 0; i < n; i++) {
+		same[i] = -1;
+		results[i] = cache_get(t->src_lang, tt->dst_lang,
+		    src + segs[i].off, segs[i].len);
+		if ((cached[i] = results[i] != NULL)) {
+			progress_advance(PROGRESS_UNIT);
+			continue;
+		}
+		if ((same[i] = dedup_find(seen, src + segs[i].off, segs[i].len,
+		    i)) != -1)
+			continue;
+
+		if (b == NULL) {
+			b = batcher_new(t->src_lang, tt->dst_lang, tt->alts,
+			    LIMIT_FOREGROUND);
+			g_mutex_lock(&t->lock);
+			if (t->cancelled)
+				batcher_cancel(b);
+			tt->b = b;
+			g_mutex_unlock(&t->lock);
+		}
+		seg = g_bytes_new_from_bytes(t->src, segs[i].off, segs[i].len);
+		batcher_add(b, seg, collect_result, &results[i]);
+		g_bytes_unref(seg);
+	}
+	if (b != NULL) {
+		g_mutex_lock(&t->lock);
+		tt->b = NULL;
+		g_mutex_unlock(&t->lock);
+		batcher_free(b);
+	}
+	dedup_free(seen);
+
+	/* Each repeat gets the translation of its first appearance */
+	for (i = 0; i < n; i++) {
+		if (same[i] == -1)
+			continue;
+		if (results[same[i]] != NULL &&
+		    (results[i] = strdup(results[same[i]])) == NULL)
+			err(1, "strdup");
+		progress_advance(PROGRESS_UNIT);
 	}
 
-	curl_easy_setopt(handle, CURLOPT_URL, url);
-	curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
-	curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, &errbuf);
-	curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, accumulate_mem_buf);
-	curl_easy_setopt(handle, CURLOPT_WRITEDATA, raw_json);
-	curl_easy_setopt(handle, CURLOPT_POST, 1);
-	curl_easy_setopt(handle, CURLOPT_POSTFIELDS, esc_data);
-	curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, str_len + 3);
-	curl_easy_setopt(handle, CURLOPT_VERBOSE, 0);
-
-	if (curl_easy_perform(handle) != 0) {
-		xwarn("curl: %s", errbuf);
-		goto done;
+	progress_end(n);
+
+	for (i = 0, failed = 0; i < n; i++) {
+		if (results[i] == NULL)
+			failed = 1;
+		else if (!cached[i] && segs[i].len > 0)
+			cache_put(t->src_lang, tt->dst_lang,
+			    src + segs[i].off, segs[i].len, results[i]);
 	}
 
-	/* parse the JSON */
+	if (!failed) {
+		translation = g_string_sized_new(len + len / 4);
+		prev = 0;
+		for (i = 0; i < n; i++) {
+			stitch(tt, translation, src + prev, segs[i].off - prev,
+			    src + prev, segs[i].off - prev);
+			stitch(tt, translation, results[i], strlen(results[i]),
+			    src + segs[i].off, segs[i].len);
+			prev = segs[i].off + segs[i].len;
+		}
+		stitch(tt, translation, src + prev, len - prev, src + prev,
+		    len - prev);
+
+		tt->translation = g_string_free_to_bytes(translation);
+		g_idle_add(set_translation_text, tt);
+
+		/*
+		 * The translation is guessed back as the foreground would
+		 * send it, with the glossary's terms taken out again
+		 */
+		if (tt == &t->targets[0] && !superseded(t)) {
+			back = glossary_protect(tt->translation, &kept);
+			glossary_terms_free(kept);
+			prefetch_start(t->src, back, t->src_lang, tt->dst_lang,
+			    t->markup);
+			g_bytes_unref(back);
+		}
+	}
 
-	/*
-	 * Remove doubled commas. This traverses from the back but checks from
-	 * the front - that is, given ",,,", it will go from the right but
-	 * check whether the character to the left is a comma, resulting in 
-	 * ",  ".
-	 */
-	for (i = raw_json->size; i > 0; i--)
-		if (raw_json->mem[i-1] == ',' && raw_json->mem[i] == ',')
-			raw_json->mem[i] = ' ';
-
-	error = NULL;
-	parser = json_parser_new();
-	if (!json_parser_load_from_data(parser, raw_json->mem, raw_json->size, &error)) {
-		xwarn("json_parser_load_from_data: %s", error->message);
-		goto done;
+	for (i = 0; i < n; i++)
+		free(results[i]);
+	free(results);
+	free(cached);
+	free(same);
+}
+
+/*
+ * Add the n bytes at piece, which are either what lies between two
+ * segments or the translation of one, to the end of the translation, with
+ * the glossary's terms put back in. If the target keeps an index, it gets a
+ * piece too, lining that up with the m bytes at orig it came from.
+ */
+static void
+stitch(struct trans_target *tt, GString *translation, const char *piece,
+    size_t n, const char *orig, size_t m)
+{
+	const struct glossary_terms	*terms;
+	GBytes				*text, *restored;
+	const char			*data;
+	gsize				 len;
+	size_t				 start, src_len;
+
+	terms = tt->t->terms;
+	start = translation->len;
+
+	if (terms == NULL)
+		g_string_append_len(translation, piece, n);
+	else {
+		text = g_bytes_new_static(piece, n);
+		restored = glossary_restore(text, terms, tt->dst_lang);
+		data = g_bytes_get_data(restored, &len);
+		g_string_append_len(translation, data, len);
+		g_bytes_unref(restored);
+		g_bytes_unref(text);
 	}
 
-	root = json_parser_get_root(parser);
-	sentences = json_array_get_array_element(
-	    json_node_get_array(root), 0);
+	if (tt->align == NULL)
+		return;
 
-	translation = mem_buf_new();
-	json_array_foreach_element(sentences, insert_sentence, translation);
+	/* The boxes hold the text as it was before the glossary had it */
+	if (terms == NULL)
+		src_len = g_utf8_strlen(orig, m);
+	else {
+		text = g_bytes_new_static(orig, m);
+		restored = glossary_restore(text, terms, NULL);
+		data = g_bytes_get_data(restored, &len);
+		src_len = g_utf8_strlen(data, len);
+		g_bytes_unref(restored);
+		g_bytes_unref(text);
+	}
+	align_add(tt->align, src_len, g_utf8_strlen(translation->str + start,
+	    translation->len - start));
+}
 
-	t->translation = translation;
-	g_idle_add(set_translation_text, t);
+/*
+ * Keep the translation of a segment in the slot set aside for it.
+ */
+static void
+collect_result(const char *translation, void *data)
+{
+	char	**slot;
 
-done:
-	curl_easy_cleanup(handle);
-	curl_slist_free_all(headers);
+	slot = (char **)data;
 
-	free(url);
-	free(esc_data);
+	if (translation != NULL && (*slot = strdup(translation)) == NULL)
+		err(1, "strdup");
+	progress_advance(PROGRESS_UNIT);
+}
 
-	if (parser != NULL)
-		g_object_unref(parser);
-	mem_buf_free(raw_json);
+/*
+ * Show how far the translations in progress have got, and how long they
+ * will likely take, once that is long enough to be worth saying.
+ */
+static void
+show_progress(double fraction, gint64 eta_ms, void *data)
+{
+	GtkProgressBar	*bar;
+	char		*text;
 
-	g_idle_add(done_translation, t);
+	bar = (GtkProgressBar *)data;
 
-	return NULL;
+	if (fraction < 0) {
+		gtk_progress_bar_set_show_text(bar, FALSE);
+		gtk_progress_bar_set_fraction(bar, 0.0);
+		return;
+	}
+
+	if (fraction == 0)
+		gtk_progress_bar_pulse(bar);
+	else
+		gtk_progress_bar_set_fraction(bar, fraction);
+
+	if (eta_ms < PROGRESS_ETA_MIN_MS) {
+		gtk_progress_bar_set_show_text(bar, FALSE);
+		return;
+	}
+
+	if (asprintf(&text, "About %lld s left",
+	    (long long)(eta_ms + 999) / 1000) == -1)
+		err(1, "asprintf");
+	gtk_progress_bar_set_text(bar, text);
+	gtk_progress_bar_set_show_text(bar, TRUE);
+	free(text);
 }
 
 /*
@@ -861,10 +1677,38 @@ done:
 gboolean
 set_translation_text(gpointer data)
 {
-	struct trans_text	*t;
-	t = (struct trans_text *)data;
+	struct trans_target	*tt;
+	struct state		*s;
+
+	tt = (struct trans_target *)data;
+
+	/* Only the main thread sets this */
+	if (tt->t->cancelled)
+		return G_SOURCE_REMOVE;
+
+	/* The old index is dropped first, so the new text does not touch it */
+	if (tt->align != NULL)
+		unfollow(tt->t->s);
+
+	show_text(tt->dst_g_buf, tt->translation);
+
+	/* Unless the text was edited while it was being translated */
+	if (tt->align != NULL) {
+		s = tt->t->s;
+		s->align_src = tt->dst_g_buf == s->top_buf ? s->bot_buf :
+		    s->top_buf;
+		if (align_total(tt->align, ALIGN_SRC) ==
+		    buffer_chars(s->align_src)) {
+			s->align = tt->align;
+			tt->align = NULL;
+		}
+	}
 
-	gtk_text_buffer_set_text(t->dst_g_buf, t->translation->mem, -1);
+	if (tt->dst_alts != NULL) {
+		alternates_free(*tt->dst_alts);
+		*tt->dst_alts = tt->alts;
+		tt->alts = NULL;
+	}
 
 	return G_SOURCE_REMOVE;
 }
@@ -879,158 +1723,558 @@ gboolean
 done_translation(gpointer data)
 {
 	struct trans_text	*t;
+	size_t			 i;
+
 	t = (struct trans_text *)data;
 
-	if (t->timeout_id != 0)
-		g_source_remove(t->timeout_id);
-	t->timeout_id = 0;
-	gtk_progress_bar_set_fraction(t->prog_bar, 0.0);
+	if (t->s->running == t)
+		t->s->running = NULL;
 
-	mem_buf_free(t->translation);
-	t->translation = NULL;
+	for (i = 0; i < t->ntargets; i++) {
+		if (t->targets[i].translation != NULL)
+			g_bytes_unref(t->targets[i].translation);
+		alternates_free(t->targets[i].alts);
+		align_free(t->targets[i].align);
+	}
+	g_bytes_unref(t->src);
+	glossary_terms_free(t->terms);
+	g_mutex_clear(&t->lock);
+	free(t->targets);
+	free(t->segs);
 	free(t);
 
 	return G_SOURCE_REMOVE;
 }
 
 /*
- * Pull the sentence from the translation pair and add it to the memory buffer.
+ * Load the contents of the file into the given text buffer widget.
+ */
+void
+replace_text_from_file(GtkTextBuffer *text_buf, char *path)
+{
+	GBytes	*text;
+	char	*buf;
+	size_t	 len;
+	int	 fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		xwarn("open");
+		return;
+	}
+	buf = read_fd(fd, &len);
+	close(fd);
+
+	text = g_bytes_new_with_free_func(buf, len, free, buf);
+	show_text(text_buf, text);
+	g_bytes_unref(text);
+}
+
+/*
+ * Put the text into the text buffer. A text longer than LARGE_TEXT is kept
+ * out of it, in a piece table, and only a window of it is shown.
  */
 static void
-insert_sentence(JsonArray *array, guint index, JsonNode *element_node,
-    gpointer user_data)
+show_text(GtkTextBuffer *text_buf, GBytes *text)
 {
-	struct mem_buf	*res;
-	JsonArray	*pair;
-	const gchar	*value;
-	char		*ptr;
-	size_t		 cpy_len, len;
+	struct large	*lg;
+	const char	*data;
+	gsize		 len;
+
+	data = g_bytes_get_data(text, &len);
 
-	res = (struct mem_buf *)user_data;
-	pair = json_node_get_array(element_node);
-	value = json_array_get_string_element(pair, 0);
+	if (len <= LARGE_TEXT) {
+		forget_large(text_buf);
+		gtk_text_buffer_set_text(text_buf, len > 0 ? data : "", len);
+		return;
+	}
 
-	len = strlen(value);
-	if ((ptr = calloc(len + 1, sizeof(char))) == NULL)
+	if ((lg = calloc(1, sizeof(struct large))) == NULL)
 		err(1, "calloc");
-	cpy_len = strlcpy(ptr, value, len + 1);
-	if (cpy_len < len)
-		err(1, "strlcpy");
+	lg->pt = piece_new(text);
+	g_object_set_data_full(G_OBJECT(text_buf), LARGE_KEY, lg, large_free);
 
-	accumulate_mem_buf(ptr, sizeof(char), strlen(value), res);
+	large_move(text_buf, lg, 0);
+}
 
-	free(ptr);
+/*
+ * Let go of the large text behind the text buffer, if any, so that the
+ * buffer holds all of its text again.
+ */
+static void
+forget_large(GtkTextBuffer *text_buf)
+{
+	g_object_set_data(G_OBJECT(text_buf), LARGE_KEY, NULL);
 }
 
 /*
- * Add the string to the memory buffer.
+ * RETURN: all of the text in the text buffer, including any of a large text
+ * that is not on screen, to be freed with g_free.
+ */
+static gchar *
+buffer_text(GtkTextBuffer *text_buf)
+{
+	GtkTextIter	 start, end;
+	struct large	*lg;
+	gchar		*text;
+	size_t		 len;
+
+	if ((lg = large_of(text_buf)) == NULL) {
+		gtk_text_buffer_get_bounds(text_buf, &start, &end);
+		return gtk_text_buffer_get_text(text_buf, &start, &end, 0);
+	}
+
+	large_sync(text_buf, lg);
+	len = piece_len(lg->pt);
+	text = g_malloc(len + 1);
+	piece_read(lg->pt, 0, len, text);
+	text[len] = '\0';
+
+	return text;
+}
+
+/*
+ * RETURN: the large text behind the text buffer, or NULL if it holds all of
+ * its text.
+ */
+static struct large *
+large_of(GtkTextBuffer *text_buf)
+{
+	return g_object_get_data(G_OBJECT(text_buf), LARGE_KEY);
+}
+
+static void
+large_free(gpointer data)
+{
+	struct large	*lg;
+
+	lg = (struct large *)data;
+
+	piece_free(lg->pt);
+	g_free(lg->win);
+	free(lg);
+}
+
+/*
+ * Carry any edits made to the window over into the large text.
+ */
+static void
+large_sync(GtkTextBuffer *text_buf, struct large *lg)
+{
+	GtkTextIter	 start, end;
+	gchar		*text;
+
+	if (!gtk_text_buffer_get_modified(text_buf))
+		return;
+
+	gtk_text_buffer_get_bounds(text_buf, &start, &end);
+	text = gtk_text_buffer_get_text(text_buf, &start, &end, 0);
+	piece_replace(lg->pt, lg->off, lg->len, text, strlen(text));
+
+	g_free(lg->win);
+	lg->win = text;
+	lg->len = strlen(text);
+	gtk_text_buffer_set_modified(text_buf, FALSE);
+}
+
+/*
+ * Show the window of the large text around offset at, cut at line breaks
+ * where there are any nearby. Any edits to the old window must have been
+ * carried over first.
+ */
+static void
+large_move(GtkTextBuffer *text_buf, struct large *lg, size_t at)
+{
+	size_t	 len, start, end;
+
+	len = piece_len(lg->pt);
+
+	start = at > LARGE_WINDOW / 2 ? at - LARGE_WINDOW / 2 : 0;
+	if (start + LARGE_WINDOW > len)
+		start = len > LARGE_WINDOW ? len - LARGE_WINDOW : 0;
+	start = piece_boundary(lg->pt, start, LARGE_WINDOW / 4);
+	end = piece_boundary(lg->pt, start + LARGE_WINDOW, LARGE_WINDOW / 4);
+
+	if (start >= lg->off)
+		lg->choff += piece_chars(lg->pt, lg->off, start - lg->off);
+	else
+		lg->choff -= piece_chars(lg->pt, start, lg->off - start);
+
+	g_free(lg->win);
+	lg->win = g_malloc(end - start + 1);
+	lg->len = piece_read(lg->pt, start, end - start, lg->win);
+	lg->win[lg->len] = '\0';
+	lg->off = start;
+
+	lg->moving = 1;
+	gtk_text_buffer_set_text(text_buf, lg->win, lg->len);
+	gtk_text_buffer_set_modified(text_buf, FALSE);
+	lg->moving = 0;
+}
+
+/*
+ * Point iter at offset off of the large text, which must be in the window.
+ */
+static void
+large_iter(GtkTextBuffer *text_buf, struct large *lg, size_t off,
+    GtkTextIter *iter)
+{
+	gtk_text_buffer_get_iter_at_offset(text_buf, iter,
+	    g_utf8_strlen(lg->win, off - lg->off));
+}
+
+/*
+ * RETURN: the offset in the large text of the place iter points at in the
+ * window, which must be up to date.
  */
 static size_t
-accumulate_mem_buf(char *ptr, size_t size, size_t nmemb, void *userdata)
+large_offset(struct large *lg, const GtkTextIter *iter)
+{
+	return lg->off + (g_utf8_offset_to_pointer(lg->win,
+	    gtk_text_iter_get_offset(iter)) - lg->win);
+}
+
+/*
+ * RETURN: how many characters there are in all of the text in the text
+ * buffer, including any of a large text that is not on screen.
+ */
+static size_t
+buffer_chars(GtkTextBuffer *text_buf)
+{
+	struct large	*lg;
+
+	if ((lg = large_of(text_buf)) == NULL)
+		return gtk_text_buffer_get_char_count(text_buf);
+
+	large_sync(text_buf, lg);
+	return piece_chars(lg->pt, 0, piece_len(lg->pt));
+}
+
+/*
+ * When a view of a large text scrolls to within a page of either end of its
+ * window, move the window to be around the line at the top of the view, and
+ * keep that line where it is.
+ */
+static void
+scrolled_cb(GtkAdjustment *adj, gpointer user_data)
 {
-	size_t	len;
-	struct mem_buf	*m;
+	GtkTextView	*text_view;
+	GtkTextBuffer	*text_buf;
+	GtkTextIter	 iter;
+	GtkTextMark	*mark;
+	GdkRectangle	 rect;
+	struct large	*lg;
+	gdouble		 value, page;
+	size_t		 top;
+
+	text_view = GTK_TEXT_VIEW(user_data);
+	text_buf = gtk_text_view_get_buffer(text_view);
+	if ((lg = large_of(text_buf)) == NULL || lg->moving)
+		return;
 
-	len = size * nmemb;
-	m = (struct mem_buf *)userdata;
+	value = gtk_adjustment_get_value(adj);
+	page = gtk_adjustment_get_page_size(adj);
+	if (!(value + 2 * page >= gtk_adjustment_get_upper(adj) &&
+	    lg->off + lg->len < piece_len(lg->pt)) &&
+	    !(value <= page && lg->off > 0))
+		return;
 
-	if ((m->mem = realloc(m->mem, m->size + len + 1)) == NULL)
-		err(1, "realloc");
+	gtk_text_view_get_visible_rect(text_view, &rect);
+	gtk_text_view_get_line_at_y(text_view, &iter, rect.y, NULL);
+	large_sync(text_buf, lg);
+	top = large_offset(lg, &iter);
 
-	memcpy(&(m->mem[m->size]), ptr, len);
-	m->size += len;
-	m->mem[m->size] = 0;
+	large_move(text_buf, lg, top);
 
-	return len;
+	large_iter(text_buf, lg, top, &iter);
+	if ((mark = gtk_text_buffer_get_mark(text_buf, LARGE_KEY)) == NULL)
+		mark = gtk_text_buffer_create_mark(text_buf, LARGE_KEY, &iter,
+		    TRUE);
+	else
+		gtk_text_buffer_move_mark(text_buf, mark, &iter);
+	gtk_text_view_scroll_to_mark(text_view, mark, 0.0, TRUE, 0.0, 0.0);
 }
 
 /*
- * Build a new empty memory buffer: size zero, allocated space for a single
- * char.
+ * Note text put into either box in the index of which sentences translate
+ * to which.
  */
-static struct mem_buf*
-mem_buf_new()
+static void
+inserted_cb(GtkTextBuffer *text_buf, GtkTextIter *location, gchar *text,
+    gint len, gpointer user_data)
 {
-	struct mem_buf	*m;
+	struct state	*s;
+	enum align_side	 side;
+	size_t		 off;
 
-	if ((m = (struct mem_buf *)malloc(sizeof(struct mem_buf))) == NULL)
-		err(1, "malloc");
+	s = (struct state *)user_data;
+	if (!text_offset(s, text_buf, location, &side, &off))
+		return;
 
-	m->size = 0;
-	if ((m->mem = calloc(1, sizeof(char))) == NULL)
-		err(1, "calloc");
+	align_insert(s->align, side, off, g_utf8_strlen(text, len));
+}
+
+/*
+ * Note text taken out of either box in the index of which sentences
+ * translate to which.
+ */
+static void
+deleted_cb(GtkTextBuffer *text_buf, GtkTextIter *start, GtkTextIter *end,
+    gpointer user_data)
+{
+	struct state	*s;
+	enum align_side	 side;
+	size_t		 off;
 
-	return m;
+	s = (struct state *)user_data;
+	if (!text_offset(s, text_buf, start, &side, &off))
+		return;
+
+	align_delete(s->align, side, off, gtk_text_iter_get_offset(end) -
+	    gtk_text_iter_get_offset(start));
 }
 
 /*
- * Free the memory buffer.
+ * When the cursor moves in either box, mark the sentence it is in and its
+ * counterpart in the other box, and bring that into line with it.
  */
 static void
-mem_buf_free(struct mem_buf *m)
+cursor_cb(GtkTextBuffer *text_buf, GtkTextIter *location, GtkTextMark *mark,
+    gpointer user_data)
 {
-	if (m) {
-		free(m->mem);
-		m->mem = NULL;
-		m->size = 0;
-		free(m);
-	}
+	struct state	*s;
+
+	s = (struct state *)user_data;
+	if (mark != gtk_text_buffer_get_insert(text_buf))
+		return;
+
+	follow(s, text_buf == s->top_buf ? s->top_view : s->bot_view,
+	    location, 1);
 }
 
 /*
- * Load the contents of the file into the given text buffer widget.
+ * When either box is scrolled, scroll the other so that the counterpart of
+ * the line at the top of the one is at the top of the other.
  */
-void
-replace_text_from_file(GtkTextBuffer *text_buf, char *path)
+static void
+follow_scroll_cb(GtkAdjustment *adj, gpointer user_data)
 {
-	char	*buf;
-	int	 fd;
+	GtkTextView	*text_view;
+	GtkTextIter	 iter;
+	GdkRectangle	 rect;
+	struct state	*s;
 
-	buf = NULL;
+	s = (struct state *)user_data;
+	if (s->align == NULL || s->following)
+		return;
 
-	if ((fd = open(path, O_RDONLY)) == -1) {
-		xwarn("open");
-		goto cleanup;
+	if (adj == gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(s->top_view)))
+		text_view = s->top_view;
+	else
+		text_view = s->bot_view;
+
+	gtk_text_view_get_visible_rect(text_view, &rect);
+	gtk_text_view_get_line_at_y(text_view, &iter, rect.y, NULL);
+	follow(s, text_view, &iter, 0);
+}
+
+/*
+ * Find the piece of the text in the view that iter is in, in the index of
+ * which sentences translate to which, and scroll the other box so that its
+ * counterpart there is as high up as iter is. If mark is set, a sentence and
+ * its translation are both marked as well.
+ *
+ * Both take O(log n) in the number of sentences; neither box is read.
+ */
+static void
+follow(struct state *s, GtkTextView *from, const GtkTextIter *iter, int mark)
+{
+	GtkTextView	*to;
+	GtkTextBuffer	*from_buf, *to_buf;
+	GtkTextIter	 there;
+	GdkRectangle	 rect, loc;
+	enum align_side	 side, other;
+	size_t		 off, i, start, len, at;
+	gdouble		 y;
+
+	from_buf = gtk_text_view_get_buffer(from);
+	if (s->following || !text_offset(s, from_buf, iter, &side, &off))
+		return;
+
+	to = from == s->top_view ? s->bot_view : s->top_view;
+	to_buf = gtk_text_view_get_buffer(to);
+	other = side == ALIGN_SRC ? ALIGN_DST : ALIGN_SRC;
+
+	/* As far into the counterpart as iter is into its own piece */
+	i = align_find(s->align, side, off);
+	start = align_start(s->align, side, i);
+	len = align_len(s->align, side, i);
+	at = align_start(s->align, other, i);
+	if (len > 0 && off > start)
+		at += (double)MIN(off - start, len) / len *
+		    align_len(s->align, other, i);
+
+	/* Moving the other view must not send it back here */
+	s->following = 1;
+
+	text_show(to_buf, at);
+	if (mark) {
+		highlight(s, from_buf, side, i);
+		highlight(s, to_buf, other, i);
 	}
-	buf = read_fd(fd);
-	close(fd);
 
-	gtk_text_buffer_set_text(text_buf, buf, -1);
+	gtk_text_view_get_visible_rect(from, &rect);
+	gtk_text_view_get_iter_location(from, iter, &loc);
+	y = MIN(MAX(loc.y - rect.y, 0), rect.height);
 
-cleanup:
+	text_iter(to_buf, at, &there);
+	gtk_text_view_get_iter_location(to, &there, &loc);
+	gtk_adjustment_set_value(gtk_scrollable_get_vadjustment(
+	    GTK_SCROLLABLE(to)), loc.y - y);
+
+	s->following = 0;
+}
+
+/*
+ * Drop the index of which sentences translate to which, and unmark what it
+ * marked.
+ */
+static void
+unfollow(struct state *s)
+{
+	GtkTextIter	 start, end;
+
+	align_free(s->align);
+	s->align = NULL;
+	s->align_src = NULL;
 
-	free(buf);
+	gtk_text_buffer_get_bounds(s->top_buf, &start, &end);
+	gtk_text_buffer_remove_tag(s->top_buf, s->top_tag, &start, &end);
+	gtk_text_buffer_get_bounds(s->bot_buf, &start, &end);
+	gtk_text_buffer_remove_tag(s->bot_buf, s->bot_tag, &start, &end);
+}
+
+/*
+ * Mark piece i of the text in the box, if it is a sentence rather than what
+ * lies between two, and nothing else.
+ */
+static void
+highlight(struct state *s, GtkTextBuffer *text_buf, enum align_side side,
+    size_t i)
+{
+	GtkTextTag	*tag;
+	GtkTextIter	 start, end;
+	size_t		 off;
+
+	tag = text_buf == s->top_buf ? s->top_tag : s->bot_tag;
+	gtk_text_buffer_get_bounds(text_buf, &start, &end);
+	gtk_text_buffer_remove_tag(text_buf, tag, &start, &end);
+
+	/* The pieces between sentences come first, and take turns with them */
+	if (i % 2 == 0)
+		return;
+
+	off = align_start(s->align, side, i);
+	text_iter(text_buf, off, &start);
+	text_iter(text_buf, off + align_len(s->align, side, i), &end);
+	gtk_text_buffer_apply_tag(text_buf, tag, &start, &end);
+}
+
+/*
+ * Find where iter is in the whole of the text of a box, in characters, and
+ * which side of the index of which sentences translate to which the box is.
+ *
+ * RETURN: 0 if there is no index, or the window of a large text is on the
+ * move, so that nothing is to be done, and 1 otherwise.
+ */
+static int
+text_offset(struct state *s, GtkTextBuffer *text_buf, const GtkTextIter *iter,
+    enum align_side *side, size_t *off)
+{
+	struct large	*lg;
+
+	if (s->align == NULL)
+		return 0;
+	if ((lg = large_of(text_buf)) != NULL && lg->moving)
+		return 0;
+
+	*side = text_buf == s->align_src ? ALIGN_SRC : ALIGN_DST;
+	*off = (lg != NULL ? lg->choff : 0) + gtk_text_iter_get_offset(iter);
+	return 1;
+}
+
+/*
+ * Point iter at character off of the whole of the text in the text buffer,
+ * or as near to it as the window of a large text goes.
+ */
+static void
+text_iter(GtkTextBuffer *text_buf, size_t off, GtkTextIter *iter)
+{
+	struct large	*lg;
+	size_t		 base;
+
+	base = (lg = large_of(text_buf)) != NULL ? lg->choff : 0;
+	off = off > base ? off - base : 0;
+	gtk_text_buffer_get_iter_at_offset(text_buf, iter,
+	    MIN(off, (size_t)gtk_text_buffer_get_char_count(text_buf)));
+}
+
+/*
+ * Move the window of a large text, if need be, so that character off of the
+ * whole of it is in the window.
+ */
+static void
+text_show(GtkTextBuffer *text_buf, size_t off)
+{
+	struct large	*lg;
+	size_t		 at;
+
+	if ((lg = large_of(text_buf)) == NULL)
+		return;
+	if (off >= lg->choff && off - lg->choff <=
+	    (size_t)gtk_text_buffer_get_char_count(text_buf))
+		return;
+
+	/* Count on from the window if it is behind off, else from the start */
+	large_sync(text_buf, lg);
+	if (off >= lg->choff)
+		at = piece_seek(lg->pt, lg->off, off - lg->choff);
+	else
+		at = piece_seek(lg->pt, 0, off);
+	large_move(text_buf, lg, at);
 }
 
 /*
  * Read the contents of a file descriptor and produce that as a character
- * pointer.
+ * pointer, storing its length into len.
  */
 static char *
-read_fd(int fd)
+read_fd(int fd, size_t *len)
 {
 	char	*buf, *nbuf;
-	int	 nread;
 	ssize_t	 ret;
-	size_t	 nbytes;
+	size_t	 nread, nbytes;
 
 	nbytes = 1024;
 	nread = 0;
 
-	if ((buf = calloc(nbytes, sizeof(char))) == NULL)
-		err(1, "calloc");
-
-	while ((ret = read(fd, buf + nread, nbytes)) > 0) {
-		nread += nbytes;
-		nbuf = reallocarray(buf, nread + nbytes, sizeof(char));
-		if (nbuf == NULL)
-			err(1, "reallocarray");
+	if ((buf = malloc(nbytes)) == NULL)
+		err(1, "malloc");
 
+	/* Keep room for the NUL, and double, so large files read quickly */
+	while ((ret = read(fd, buf + nread, nbytes - nread - 1)) > 0) {
+		nread += ret;
+		if (nread + 1 < nbytes)
+			continue;
+		nbytes *= 2;
+		if ((nbuf = realloc(buf, nbytes)) == NULL)
+			err(1, "realloc");
 		buf = nbuf;
 	}
 
 	if (ret == -1)
 		xwarn("read");
 
+	buf[nread] = '\0';
+	*len = nread;
 	return buf;
 }
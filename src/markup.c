@@ -0,0 +1,641 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ctype.h>
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "compat.h"
+#include "markup.h"
+#include "segment.h"
+
+#define BLOCK_LIST	0x1	/* The line starts a list item */
+#define BLOCK_HEADING	0x2	/* The line is an ATX heading */
+
+/*
+ * Which file names mean which kind of document.
+ */
+static const struct {
+	const char	*ext;
+	enum markup	 kind;
+} kinds[] = {
+	{ "htm",	MARKUP_HTML },
+	{ "html",	MARKUP_HTML },
+	{ "xhtml",	MARKUP_HTML },
+	{ "xml",	MARKUP_XML },
+	{ "md",		MARKUP_MARKDOWN },
+	{ "markdown",	MARKUP_MARKDOWN },
+};
+
+/* HTML elements whose contents are code, not text */
+static const char *raw_elements[] = { "script", "style" };
+
+/*
+ * One pass over a document. Text is gathered into a run until markup cuts
+ * it off; the run is then split into segments like plain text is.
+ */
+struct scan {
+	const char	*text;		/* The document */
+	size_t		 max;		/* How long a segment may be */
+	size_t		 run;		/* Where the unsplit text starts */
+	struct segment	*segs;		/* The segments found so far */
+	size_t		 nsegs;		/* How many there are */
+	size_t		 cap;		/* How many there is room for */
+};
+
+static void	scan_tags(struct scan *, size_t, int);
+static void	scan_markdown(struct scan *, size_t);
+static size_t	scan_inline(struct scan *, size_t, size_t, size_t, int);
+static void	skip(struct scan *, size_t, size_t);
+static void	split_run(struct scan *, size_t);
+static int	has_words(const char *, size_t);
+static size_t	tag_end(const char *, size_t, size_t, int);
+static size_t	raw_end(const char *, size_t, size_t, const char *, size_t);
+static size_t	past(const char *, size_t, size_t, const char *);
+static size_t	line_end(const char *, size_t, size_t);
+static size_t	indent(const char *, size_t, size_t, size_t *);
+static size_t	block_markers(const char *, size_t, size_t, int *);
+static size_t	fence_open(const char *, size_t, size_t, char *);
+static int	fence_close(const char *, size_t, size_t, char, size_t);
+static int	is_rule(const char *, size_t, size_t);
+static int	is_refdef(const char *, size_t, size_t);
+
+/*
+ * Guess what kind of document a file is from its name.
+ *
+ * RETURN: the kind of markup, or MARKUP_NONE for plain text.
+ */
+enum markup
+markup_guess(const char *path)
+{
+	const char	*ext;
+	size_t		 i;
+
+	if ((ext = strrchr(path, '.')) == NULL || strchr(ext, '/') != NULL)
+		return MARKUP_NONE;
+	ext++;
+
+	for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+		if (strcasecmp(ext, kinds[i].ext) == 0)
+			return kinds[i].kind;
+
+	return MARKUP_NONE;
+}
+
+/*
+ * Split the text of a document into segments, each no longer than max
+ * bytes, the way segment_text does, but only where there is text to
+ * translate: tags, comments, code, and the like fall between segments, so
+ * they are never sent and are copied through as they are. A piece of text
+ * with no letters in it, such as a number or a table border, is not a
+ * segment either.
+ *
+ * RETURN: the number of segments stored into the newly-allocated segs.
+ */
+size_t
+markup_text(const char *text, size_t len, size_t max, enum markup kind,
+    struct segment **segs)
+{
+	struct scan	sc;
+
+	if (kind == MARKUP_NONE)
+		return segment_text(text, len, max, segs);
+
+	sc.text = text;
+	sc.max = max;
+	sc.run = 0;
+	sc.nsegs = 0;
+	sc.cap = 8;
+	if ((sc.segs = reallocarray(NULL, sc.cap, sizeof(struct segment)))
+	    == NULL)
+		err(1, "reallocarray");
+
+	if (kind == MARKUP_MARKDOWN)
+		scan_markdown(&sc, len);
+	else
+		scan_tags(&sc, len, kind == MARKUP_HTML);
+	split_run(&sc, len);
+
+	*segs = sc.segs;
+	return sc.nsegs;
+}
+
+/*
+ * Find the text between the tags of an HTML or XML document. Comments,
+ * processing instructions, CDATA sections, and declarations are left
+ * alone, and so, in HTML, are scripts and style sheets.
+ */
+static void
+scan_tags(struct scan *sc, size_t len, int html)
+{
+	const char	*lt;
+	size_t		 i, end;
+
+	for (i = 0; i < len; i = end) {
+		if ((lt = memchr(sc->text + i, '<', len - i)) == NULL)
+			break;
+		i = lt - sc->text;
+		if ((end = tag_end(sc->text, i, len, html)) == i)
+			end++;
+		else
+			skip(sc, i, end);
+	}
+}
+
+/*
+ * Find the prose in a Markdown document, a line at a time. Front matter,
+ * fenced and indented code blocks, rules, and link reference definitions
+ * are left alone, as are the markers that start headings, quotes, and list
+ * items. What is left of each line goes to scan_inline.
+ *
+ * A heading is a segment of its own. Other lines run on into the same
+ * segment until a blank line, as in plain text.
+ */
+static void
+scan_markdown(struct scan *sc, size_t len)
+{
+	const char	*text;
+	size_t		 ls, le, p, q, width, fenced, end;
+	char		 fch;
+	int		 blank, code, list, front, flags;
+
+	text = sc->text;
+	fenced = 0;
+	fch = '\0';
+	blank = 1;
+	code = list = 0;
+	front = len >= 4 && strncmp(text, "---\n", 4) == 0;
+
+	for (ls = 0; ls < len; ls = le < len ? le + 1 : len) {
+		le = line_end(text, ls, len);
+		p = indent(text, ls, le, &width);
+
+		if (front) {
+			if (ls > 0 && le - ls == 3 &&
+			    (strncmp(text + ls, "---", 3) == 0 ||
+			    strncmp(text + ls, "...", 3) == 0))
+				front = 0;
+			skip(sc, ls, le);
+			continue;
+		}
+
+		if (fenced > 0) {
+			if (width < 4 && fence_close(text, p, le, fch, fenced))
+				fenced = 0;
+			skip(sc, ls, le);
+			continue;
+		}
+
+		if (p == le) {
+			blank = 1;
+			continue;
+		}
+
+		if (width >= 4 && !list && (blank || code)) {
+			code = 1;
+			blank = 0;
+			skip(sc, ls, le);
+			continue;
+		}
+		code = 0;
+
+		if (width < 4 &&
+		    ((fenced = fence_open(text, p, le, &fch)) > 0 ||
+		    is_rule(text, p, le) || is_refdef(text, p, le))) {
+			blank = 0;
+			skip(sc, ls, le);
+			continue;
+		}
+
+		if (width == 0 && blank)
+			list = 0;
+		blank = 0;
+
+		q = block_markers(text, p, le, &flags);
+		if (flags & BLOCK_LIST)
+			list = 1;
+		if (q > p)
+			skip(sc, ls, q);
+
+		/* Markup that runs past the line carries on after it */
+		for (end = scan_inline(sc, q, le, len, text[p] == '|');
+		    end > le; end = scan_inline(sc, end, le, len, 0))
+			le = line_end(text, end, len);
+
+		if (flags & BLOCK_HEADING)
+			skip(sc, le, le);
+	}
+}
+
+/*
+ * Find the prose in what is left of a line of Markdown, from off to le:
+ * code spans, link destinations, and inline HTML are left alone, as are the
+ * cell borders of a table row.
+ *
+ * RETURN: le, or where an HTML tag or comment that runs past le ends.
+ */
+static size_t
+scan_inline(struct scan *sc, size_t off, size_t le, size_t len, int table)
+{
+	const char	*text;
+	size_t		 i, j, k, n, depth, end;
+
+	text = sc->text;
+
+	for (i = off; i < le; i++) {
+		switch (text[i]) {
+		case '`':
+			for (n = 1; i + n < le && text[i + n] == '`'; n++)
+				;
+			for (j = i + n, end = 0; j < le && end == 0; j = k) {
+				for (k = j; k < le && text[k] == '`'; k++)
+					;
+				if (k == j)
+					k++;
+				else if (k - j == n)
+					end = k;
+			}
+			if (end > 0) {
+				skip(sc, i, end);
+				i = end - 1;
+			} else
+				i += n - 1;
+			break;
+		case ']':
+			if (i + 1 == le || text[i + 1] != '(')
+				break;
+			for (j = i + 2, depth = 1; j < le && depth > 0; j++) {
+				if (text[j] == '(')
+					depth++;
+				else if (text[j] == ')')
+					depth--;
+			}
+			if (depth == 0) {
+				skip(sc, i + 1, j);
+				i = j - 1;
+			}
+			break;
+		case '<':
+			/* Never closed, it is more likely text than a tag */
+			if ((end = tag_end(text, i, len, 1)) == i ||
+			    text[end - 1] != '>')
+				break;
+			skip(sc, i, end);
+			if (end > le)
+				return end;
+			i = end - 1;
+			break;
+		case '|':
+			if (table)
+				skip(sc, i, i + 1);
+			break;
+		}
+	}
+
+	return le;
+}
+
+/*
+ * Leave the bytes from off to end untranslated: the text gathered before
+ * them is split into segments, and a new run starts after them.
+ */
+static void
+skip(struct scan *sc, size_t off, size_t end)
+{
+	split_run(sc, off);
+	sc->run = end;
+}
+
+/*
+ * Split the current run, which ends at end, into segments.
+ */
+static void
+split_run(struct scan *sc, size_t end)
+{
+	struct segment	 seg;
+	size_t		 off, used;
+
+	for (off = sc->run; off < end; off += used) {
+		used = segment_next(sc->text + off, end - off, sc->max, 1,
+		    &seg);
+		if (seg.len == 0 || !has_words(sc->text + off + seg.off,
+		    seg.len))
+			continue;
+
+		if (sc->nsegs == sc->cap) {
+			sc->cap *= 2;
+			sc->segs = reallocarray(sc->segs, sc->cap,
+			    sizeof(struct segment));
+			if (sc->segs == NULL)
+				err(1, "reallocarray");
+		}
+		sc->segs[sc->nsegs].off = off + seg.off;
+		sc->segs[sc->nsegs].len = seg.len;
+		sc->nsegs++;
+	}
+
+	if (sc->run < end)
+		sc->run = end;
+}
+
+/*
+ * RETURN: whether there is a letter in the text, counting anything beyond
+ * ASCII as one, but not the name of an entity such as "&nbsp;".
+ */
+static int
+has_words(const char *s, size_t len)
+{
+	size_t	i, j;
+
+	for (i = 0; i < len; i++) {
+		if (s[i] == '&') {
+			for (j = i + 1; j < len && j - i < 12 &&
+			    (isalnum((unsigned char)s[j]) || s[j] == '#'); j++)
+				;
+			if (j < len && s[j] == ';')
+				i = j;
+		} else if ((unsigned char)s[i] >= 0x80 ||
+		    isalpha((unsigned char)s[i]))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Find the end of the tag, comment, or other markup that starts with the
+ * '<' at off. A '<' that does not start any, as in "a < b", is text.
+ * Markup that is never closed runs to the end of the document. In HTML, a
+ * script or style element is taken whole, contents and all.
+ *
+ * RETURN: the offset just past the markup, or off if there is none.
+ */
+static size_t
+tag_end(const char *text, size_t off, size_t len, int html)
+{
+	size_t	i, name, nlen;
+	char	quote;
+
+	if (len - off >= 4 && strncmp(text + off, "<!--", 4) == 0)
+		return past(text, off + 4, len, "-->");
+	if (len - off >= 9 && strncmp(text + off, "<![CDATA[", 9) == 0)
+		return past(text, off + 9, len, "]]>");
+	if (len - off >= 2 && strncmp(text + off, "<?", 2) == 0)
+		return past(text, off + 2, len, html ? ">" : "?>");
+	if (len - off >= 2 && strncmp(text + off, "<!", 2) == 0)
+		return past(text, off + 2, len, ">");
+
+	i = off + 1;
+	if (i < len && text[i] == '/')
+		i++;
+	if (i == len || !isalpha((unsigned char)text[i]))
+		return off;
+
+	for (name = i; i < len && (isalnum((unsigned char)text[i]) ||
+	    strchr("-_:.", text[i]) != NULL); i++)
+		;
+	nlen = i - name;
+
+	for (quote = '\0'; i < len; i++) {
+		if (quote != '\0') {
+			if (text[i] == quote)
+				quote = '\0';
+		} else if (text[i] == '"' || text[i] == '\'')
+			quote = text[i];
+		else if (text[i] == '>')
+			break;
+	}
+	if (i == len)
+		return len;
+	i++;
+
+	if (html && text[off + 1] != '/' && text[i - 2] != '/')
+		return raw_end(text, i, len, text + name, nlen);
+	return i;
+}
+
+/*
+ * Find the end of an HTML element whose start tag ends at off, if its
+ * contents are code: that is, past its end tag.
+ *
+ * RETURN: the offset just past the end tag, or off if the element's
+ * contents are text.
+ */
+static size_t
+raw_end(const char *text, size_t off, size_t len, const char *name,
+    size_t nlen)
+{
+	size_t	i, end;
+
+	for (i = 0; i < sizeof(raw_elements) / sizeof(raw_elements[0]); i++)
+		if (strlen(raw_elements[i]) == nlen &&
+		    strncasecmp(raw_elements[i], name, nlen) == 0)
+			break;
+	if (i == sizeof(raw_elements) / sizeof(raw_elements[0]))
+		return off;
+
+	for (i = off; (end = past(text, i, len, "</")) < len; i = end) {
+		if (len - end > nlen &&
+		    strncasecmp(text + end, name, nlen) == 0 &&
+		    !isalnum((unsigned char)text[end + nlen]))
+			return past(text, end + nlen, len, ">");
+	}
+
+	return len;
+}
+
+/*
+ * RETURN: the offset just past the first pat at or after off, or len if
+ * there is none.
+ */
+static size_t
+past(const char *text, size_t off, size_t len, const char *pat)
+{
+	const char	*p;
+	size_t		 plen;
+
+	plen = strlen(pat);
+	if ((p = memmem(text + off, len - off, pat, plen)) == NULL)
+		return len;
+	return p - text + plen;
+}
+
+/*
+ * RETURN: the offset of the newline that ends the line at off, or len.
+ */
+static size_t
+line_end(const char *text, size_t off, size_t len)
+{
+	const char	*nl;
+
+	if ((nl = memchr(text + off, '\n', len - off)) == NULL)
+		return len;
+	return nl - text;
+}
+
+/*
+ * Skip the spaces and tabs at the start of a line, noting how many columns
+ * they span, with tab stops every four.
+ *
+ * RETURN: the offset of the first other byte, or le.
+ */
+static size_t
+indent(const char *text, size_t off, size_t le, size_t *width)
+{
+	*width = 0;
+	for (; off < le; off++) {
+		if (text[off] == ' ')
+			(*width)++;
+		else if (text[off] == '\t')
+			*width += 4 - *width % 4;
+		else if (text[off] != '\r')
+			break;
+	}
+	return off;
+}
+
+/*
+ * Skip the quote markers, list markers, and heading marker at the start of
+ * a line of Markdown, setting flags to say what was found.
+ *
+ * RETURN: the offset of the line's own text.
+ */
+static size_t
+block_markers(const char *text, size_t off, size_t le, int *flags)
+{
+	size_t	i;
+
+	*flags = 0;
+
+	for (;;) {
+		while (off < le && (text[off] == ' ' || text[off] == '\t'))
+			off++;
+		if (off == le)
+			break;
+
+		if (text[off] == '>') {
+			off++;
+			continue;
+		}
+
+		if (text[off] == '#') {
+			for (i = off; i < le && text[i] == '#'; i++)
+				;
+			if (i - off <= 6 && (i == le || text[i] == ' ' ||
+			    text[i] == '\t')) {
+				*flags |= BLOCK_HEADING;
+				off = i;
+			}
+			break;
+		}
+
+		i = off;
+		if (strchr("-*+", text[i]) != NULL)
+			i++;
+		else {
+			while (i < le && i - off < 9 &&
+			    isdigit((unsigned char)text[i]))
+				i++;
+			if (i == off || i == le ||
+			    (text[i] != '.' && text[i] != ')'))
+				break;
+			i++;
+		}
+		if (i < le && text[i] != ' ' && text[i] != '\t')
+			break;
+		*flags |= BLOCK_LIST;
+		off = i;
+
+		/* A task list item's box */
+		while (off < le && (text[off] == ' ' || text[off] == '\t'))
+			off++;
+		if (le - off >= 3 && text[off] == '[' && text[off + 2] == ']' &&
+		    strchr(" xX", text[off + 1]) != NULL)
+			off += 3;
+	}
+
+	while (off < le && (text[off] == ' ' || text[off] == '\t'))
+		off++;
+	return off;
+}
+
+/*
+ * RETURN: how many backticks or tildes open the fenced code block that
+ * starts at off, or 0 if none does; the character is stored into fch.
+ */
+static size_t
+fence_open(const char *text, size_t off, size_t le, char *fch)
+{
+	size_t	i;
+
+	if (text[off] != '`' && text[off] != '~')
+		return 0;
+
+	for (i = off; i < le && text[i] == text[off]; i++)
+		;
+	if (i - off < 3)
+		return 0;
+
+	*fch = text[off];
+	return i - off;
+}
+
+/*
+ * RETURN: whether the line closes a code block opened by n of fch.
+ */
+static int
+fence_close(const char *text, size_t off, size_t le, char fch, size_t n)
+{
+	size_t	i;
+
+	for (i = off; i < le && text[i] == fch; i++)
+		;
+	if (i - off < n)
+		return 0;
+
+	for (; i < le; i++)
+		if (!isspace((unsigned char)text[i]))
+			return 0;
+	return 1;
+}
+
+/*
+ * RETURN: whether the line is a thematic break or underlines a heading.
+ */
+static int
+is_rule(const char *text, size_t off, size_t le)
+{
+	size_t	i, n;
+	char	c;
+
+	c = text[off];
+	if (strchr("-*_=", c) == NULL)
+		return 0;
+
+	for (i = off, n = 0; i < le; i++) {
+		if (text[i] == c)
+			n++;
+		else if (!isspace((unsigned char)text[i]))
+			return 0;
+	}
+
+	return n >= 3 || c == '=' || c == '-';
+}
+
+/*
+ * RETURN: whether the line defines a link reference, as in "[id]: url".
+ */
+static int
+is_refdef(const char *text, size_t off, size_t le)
+{
+	size_t	i;
+
+	if (text[off] != '[')
+		return 0;
+
+	for (i = off + 1; i + 1 < le && text[i] != ']'; i++)
+		;
+	return i + 1 < le && text[i] == ']' && text[i + 1] == ':';
+}
@@ -0,0 +1,23 @@
+#ifndef MARKUP_H
+#define MARKUP_H
+
+#include <sys/types.h>
+
+#include "segment.h"
+
+/*
+ * What kind of document the text is, which decides what of it is worth
+ * translating.
+ */
+enum markup {
+	MARKUP_NONE,		/* Plain text: all of it */
+	MARKUP_HTML,		/* Text between tags, but not scripts or styles */
+	MARKUP_XML,		/* Text between tags */
+	MARKUP_MARKDOWN,	/* Prose, but not code, links, or block markers */
+};
+
+enum markup	markup_guess(const char *);
+size_t		markup_text(const char *, size_t, size_t, enum markup,
+		    struct segment **);
+
+#endif /* !MARKUP_H */
@@ -0,0 +1,64 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "membuf.h"
+
+/*
+ * Add the string to the memory buffer.
+ */
+size_t
+accumulate_mem_buf(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	size_t	len;
+	struct mem_buf	*m;
+
+	len = size * nmemb;
+	m = (struct mem_buf *)userdata;
+
+	if ((m->mem = realloc(m->mem, m->size + len + 1)) == NULL)
+		err(1, "realloc");
+
+	memcpy(&(m->mem[m->size]), ptr, len);
+	m->size += len;
+	m->mem[m->size] = 0;
+
+	return len;
+}
+
+/*
+ * Build a new empty memory buffer: size zero, allocated space for a single
+ * char.
+ */
+struct mem_buf*
+mem_buf_new()
+{
+	struct mem_buf	*m;
+
+	if ((m = (struct mem_buf *)malloc(sizeof(struct mem_buf))) == NULL)
+		err(1, "malloc");
+
+	m->size = 0;
+	if ((m->mem = calloc(1, sizeof(char))) == NULL)
+		err(1, "calloc");
+
+	return m;
+}
+
+/*
+ * Free the memory buffer.
+ */
+void
+mem_buf_free(struct mem_buf *m)
+{
+	if (m) {
+		free(m->mem);
+		m->mem = NULL;
+		m->size = 0;
+		free(m);
+	}
+}
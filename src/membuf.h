@@ -0,0 +1,16 @@
+#ifndef MEMBUF_H
+#define MEMBUF_H
+
+#include <sys/types.h>
+
+/* This is used to transfer data out of curl */
+struct mem_buf {
+	char	*mem;	/* The actual string */
+	size_t	 size;	/* The size of the string */
+};
+
+size_t		 accumulate_mem_buf(char *, size_t, size_t, void *);
+struct mem_buf	*mem_buf_new();
+void		 mem_buf_free(struct mem_buf*);
+
+#endif /* !MEMBUF_H */
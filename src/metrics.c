@@ -0,0 +1,236 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "compat.h"
+#include "metrics.h"
+
+#define NBUCKETS	11	/* Latency buckets, not counting +Inf */
+
+/*
+ * Counters, latency histograms, and gauges, written out now and then in the
+ * Prometheus text format for node_exporter's textfile collector to pick up.
+ * Everything is updated with atomic adds and stores, so recording costs
+ * next to nothing whether or not anything is written.
+ */
+static struct {
+	guint64	 counters[METRIC_COUNTER_COUNT];
+	guint64	 buckets[PHASE_COUNT][NBUCKETS + 1];	/* Not cumulative */
+	guint64	 sum_us[PHASE_COUNT];
+	gint64	 gauges[GAUGE_COUNT];
+	char	*path;		/* Where to write them, or NULL */
+	GMutex	 lock;		/* Guards writing them */
+} m;
+
+/* The upper bounds of the buckets, in microseconds */
+static const gint64 bounds_us[NBUCKETS] = {
+	5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000,
+	5000000, 10000000
+};
+
+static const struct {
+	const char	*name;
+	const char	*help;
+} counters[METRIC_COUNTER_COUNT] = {
+	{ "idiom_requests_total", "Transfers sent to the backend." },
+	{ "idiom_request_failures_total",
+	    "Requests that got no translation." },
+	{ "idiom_retries_total", "Transfers repeated after a failure." },
+	{ "idiom_hedges_total", "Second copies sent of a slow transfer." },
+	{ "idiom_cancellations_total", "Transfers or guesses abandoned." },
+	{ "idiom_preemptions_total",
+	    "Background transfers stopped to make room, and sent again." },
+	{ "idiom_cache_hits_total", "Segments found in the cache." },
+	{ "idiom_cache_misses_total", "Segments not found in the cache." },
+	{ "idiom_sent_bytes_total", "Bytes of request bodies sent." },
+	{ "idiom_received_bytes_total", "Bytes of response bodies received." },
+	{ "idiom_dedup_hits_total",
+	    "Repeated segments of a document not sent again." },
+	{ "idiom_dedup_saved_bytes_total",
+	    "Bytes of repeated segments not sent again." },
+};
+
+static const char *phases[PHASE_COUNT] = {
+	"dns", "connect", "tls", "wait", "receive", "total", "parse"
+};
+
+static const struct {
+	const char	*name;
+	const char	*label;
+	const char	*help;
+} gauges[GAUGE_COUNT] = {
+	{ "idiom_inflight_requests", NULL, "Requests in flight." },
+	{ "idiom_concurrency_limit", NULL,
+	    "How many requests may be in flight." },
+	{ "idiom_queue_depth", "segment",
+	    "Items waiting for each batch stage." },
+	{ "idiom_queue_depth", "cache", NULL },
+	{ "idiom_queue_depth", "network", NULL },
+	{ "idiom_queue_depth", "parse", NULL },
+	{ "idiom_queue_depth", "write", NULL },
+};
+
+static gpointer	 metrics_func(gpointer);
+static void	 write_metrics(void);
+static void	 print_metrics(FILE *);
+
+/*
+ * Start writing the metrics to the file named by IDIOM_METRICS, if it is
+ * set, every METRICS_INTERVAL_MS and once more on exit. The file is
+ * replaced whole each time, so a reader never sees half of it.
+ */
+void
+metrics_init(void)
+{
+	const char	*s;
+	GThread		*thr;
+
+	if ((s = getenv("IDIOM_METRICS")) == NULL || *s == '\0')
+		return;
+	if ((m.path = strdup(s)) == NULL)
+		err(1, "strdup");
+
+	if (atexit(write_metrics) != 0)
+		err(1, "atexit");
+	thr = g_thread_new("metrics", metrics_func, NULL);
+	g_thread_unref(thr);
+}
+
+/*
+ * Add n to a counter.
+ */
+void
+metrics_add(enum metric_counter c, guint64 n)
+{
+	__atomic_add_fetch(&m.counters[c], n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Record that a phase took us microseconds.
+ */
+void
+metrics_observe(enum metric_phase p, gint64 us)
+{
+	size_t	i;
+
+	us = MAX(us, 0);
+	for (i = 0; i < NBUCKETS && us > bounds_us[i]; i++)
+		;
+
+	__atomic_add_fetch(&m.buckets[p][i], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&m.sum_us[p], us, __ATOMIC_RELAXED);
+}
+
+/*
+ * Set a gauge.
+ */
+void
+metrics_set(enum metric_gauge g, gint64 value)
+{
+	__atomic_store_n(&m.gauges[g], value, __ATOMIC_RELAXED);
+}
+
+/*
+ * Write the metrics out every so often, for as long as the program runs.
+ */
+static gpointer
+metrics_func(gpointer data)
+{
+	for (;;) {
+		g_usleep(METRICS_INTERVAL_MS * 1000);
+		write_metrics();
+	}
+
+	return NULL;
+}
+
+/*
+ * Replace the metrics file with the current values: write them beside it,
+ * then rename them over it.
+ */
+static void
+write_metrics(void)
+{
+	FILE	*fp;
+	char	*tmp;
+
+	if (asprintf(&tmp, "%s.tmp", m.path) == -1)
+		err(1, "asprintf");
+
+	g_mutex_lock(&m.lock);
+
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		warn("%s", tmp);
+		goto done;
+	}
+	print_metrics(fp);
+	if (fclose(fp) == EOF) {
+		warn("%s", tmp);
+		goto done;
+	}
+	if (rename(tmp, m.path) == -1)
+		warn("rename %s", m.path);
+
+done:
+	g_mutex_unlock(&m.lock);
+	free(tmp);
+}
+
+/*
+ * Print every metric in the Prometheus text exposition format.
+ */
+static void
+print_metrics(FILE *fp)
+{
+	guint64	n, total;
+	size_t	i, p, b;
+
+	for (i = 0; i < METRIC_COUNTER_COUNT; i++)
+		fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+		    counters[i].name, counters[i].help, counters[i].name,
+		    counters[i].name, (unsigned long long)
+		    __atomic_load_n(&m.counters[i], __ATOMIC_RELAXED));
+
+	fprintf(fp, "# HELP idiom_phase_seconds "
+	    "Time spent in each phase of a request.\n"
+	    "# TYPE idiom_phase_seconds histogram\n");
+	for (p = 0; p < PHASE_COUNT; p++) {
+		for (b = total = 0; b <= NBUCKETS; b++) {
+			n = __atomic_load_n(&m.buckets[p][b], __ATOMIC_RELAXED);
+			total += n;
+			if (b < NBUCKETS)
+				fprintf(fp, "idiom_phase_seconds_bucket"
+				    "{phase=\"%s\",le=\"%g\"} %llu\n",
+				    phases[p], bounds_us[b] / 1e6,
+				    (unsigned long long)total);
+		}
+		fprintf(fp, "idiom_phase_seconds_bucket"
+		    "{phase=\"%s\",le=\"+Inf\"} %llu\n",
+		    phases[p], (unsigned long long)total);
+		fprintf(fp, "idiom_phase_seconds_sum{phase=\"%s\"} %.6f\n",
+		    phases[p], __atomic_load_n(&m.sum_us[p],
+		    __ATOMIC_RELAXED) / 1e6);
+		fprintf(fp, "idiom_phase_seconds_count{phase=\"%s\"} %llu\n",
+		    phases[p], (unsigned long long)total);
+	}
+
+	for (i = 0; i < GAUGE_COUNT; i++) {
+		if (gauges[i].help != NULL)
+			fprintf(fp, "# HELP %s %s\n# TYPE %s gauge\n",
+			    gauges[i].name, gauges[i].help, gauges[i].name);
+		if (gauges[i].label != NULL)
+			fprintf(fp, "%s{queue=\"%s\"} %lld\n", gauges[i].name,
+			    gauges[i].label, (long long)
+			    __atomic_load_n(&m.gauges[i], __ATOMIC_RELAXED));
+		else
+			fprintf(fp, "%s %lld\n", gauges[i].name, (long long)
+			    __atomic_load_n(&m.gauges[i], __ATOMIC_RELAXED));
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+/* How often to rewrite the metrics file */
+#define METRICS_INTERVAL_MS	10000
+
+/*
+ * Things that only ever go up.
+ */
+enum metric_counter {
+	METRIC_REQUESTS,	/* Transfers to the backend */
+	METRIC_FAILURES,	/* Requests that got no translation */
+	METRIC_RETRIES,		/* Transfers repeated after a failure */
+	METRIC_HEDGES,		/* Second copies of a slow transfer */
+	METRIC_CANCELLED,	/* Transfers or guesses abandoned */
+	METRIC_PREEMPTED,	/* Background transfers sent back to wait */
+	METRIC_CACHE_HITS,	/* Segments found in the cache */
+	METRIC_CACHE_MISSES,	/* Segments not found there */
+	METRIC_BYTES_SENT,	/* Request bodies */
+	METRIC_BYTES_RECEIVED,	/* Response bodies */
+	METRIC_DEDUP_HITS,	/* Repeated segments not sent again */
+	METRIC_DEDUP_BYTES,	/* How many bytes those came to */
+	METRIC_COUNTER_COUNT
+};
+
+/*
+ * The parts of a request whose time is measured.
+ */
+enum metric_phase {
+	PHASE_DNS,		/* Looking up the host */
+	PHASE_CONNECT,		/* Opening the connection */
+	PHASE_TLS,		/* The TLS handshake */
+	PHASE_WAIT,		/* From sending to the first byte back */
+	PHASE_RECEIVE,		/* From the first byte back to the last */
+	PHASE_TOTAL,		/* The whole transfer */
+	PHASE_PARSE,		/* Pulling the translations out */
+	PHASE_COUNT
+};
+
+/*
+ * Things that go up and down.
+ */
+enum metric_gauge {
+	GAUGE_INFLIGHT,		/* Requests in flight */
+	GAUGE_LIMIT,		/* How many may be in flight */
+	GAUGE_QUEUE_SEGMENT,	/* Batch mode's queues, one per stage */
+	GAUGE_QUEUE_CACHE,
+	GAUGE_QUEUE_NETWORK,
+	GAUGE_QUEUE_PARSE,
+	GAUGE_QUEUE_WRITE,
+	GAUGE_COUNT
+};
+
+void	metrics_init(void);
+void	metrics_add(enum metric_counter, guint64);
+void	metrics_observe(enum metric_phase, gint64);
+void	metrics_set(enum metric_gauge, gint64);
+
+#endif /* !METRICS_H */
@@ -0,0 +1,360 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "compat.h"
+#include "piece.h"
+
+#define PIECE_BLOCK	65536	/* How much to search through at a time */
+
+/*
+ * A stretch of the text, which is in either the original or the added text.
+ */
+struct piece {
+	int	add;	/* Whether it is in the added text */
+	size_t	off;	/* Where it starts there */
+	size_t	len;	/* How long it is */
+};
+
+/*
+ * A text that is cheap to edit however large it is. The original is never
+ * copied or changed; whatever replaces part of it is appended to the added
+ * text, and the text itself is the list of pieces of the two, in order.
+ */
+struct piece_table {
+	GBytes		*orig;		/* The text it started as */
+	char		*add;		/* Everything put in since */
+	size_t		 nadd;		/* How long that is */
+	size_t		 addcap;	/* How long it has room to be */
+	struct piece	*pieces;	/* The text, in order */
+	size_t		 npieces;	/* How many pieces there are */
+	size_t		 len;		/* How long the text is */
+};
+
+static const char	*base(const struct piece_table *,
+			    const struct piece *);
+static size_t		 locate(const struct piece_table *, size_t, size_t *);
+
+/*
+ * RETURN: a new piece table holding the text, which it keeps a reference to
+ * rather than a copy of.
+ */
+struct piece_table *
+piece_new(GBytes *text)
+{
+	struct piece_table	*pt;
+
+	if ((pt = calloc(1, sizeof(struct piece_table))) == NULL)
+		err(1, "calloc");
+
+	pt->orig = g_bytes_ref(text);
+	pt->len = g_bytes_get_size(text);
+
+	if (pt->len > 0) {
+		if ((pt->pieces = malloc(sizeof(struct piece))) == NULL)
+			err(1, "malloc");
+		pt->pieces[0].add = 0;
+		pt->pieces[0].off = 0;
+		pt->pieces[0].len = pt->len;
+		pt->npieces = 1;
+	}
+
+	return pt;
+}
+
+void
+piece_free(struct piece_table *pt)
+{
+	if (pt == NULL)
+		return;
+
+	g_bytes_unref(pt->orig);
+	free(pt->add);
+	free(pt->pieces);
+	free(pt);
+}
+
+/*
+ * RETURN: how long the text is, in bytes.
+ */
+size_t
+piece_len(const struct piece_table *pt)
+{
+	return pt->len;
+}
+
+/*
+ * Copy up to len bytes of the text, starting at off, into dst.
+ *
+ * RETURN: how many bytes were copied, which is fewer than len only at the
+ * end of the text.
+ */
+size_t
+piece_read(const struct piece_table *pt, size_t off, size_t len, char *dst)
+{
+	const struct piece	*p;
+	size_t			 i, at, n, done;
+
+	if (off >= pt->len)
+		return 0;
+	if (len > pt->len - off)
+		len = pt->len - off;
+
+	for (i = locate(pt, off, &at), done = 0; done < len; i++, at = 0) {
+		p = &pt->pieces[i];
+		n = MIN(p->len - at, len - done);
+		memcpy(dst + done, base(pt, p) + p->off + at, n);
+		done += n;
+	}
+
+	return done;
+}
+
+/*
+ * Replace the len bytes of the text starting at off with the ilen bytes at
+ * ins. Either length can be zero, to insert or to delete.
+ */
+void
+piece_replace(struct piece_table *pt, size_t off, size_t len,
+    const char *ins, size_t ilen)
+{
+	struct piece	*pieces, *p;
+	size_t		 i, n, pos, end, keep, start;
+	int		 put;
+
+	if (off > pt->len)
+		off = pt->len;
+	if (len > pt->len - off)
+		len = pt->len - off;
+	end = off + len;
+
+	if (pt->nadd + ilen > pt->addcap) {
+		pt->addcap = MAX(pt->nadd + ilen, pt->addcap * 2);
+		if ((pt->add = realloc(pt->add, pt->addcap)) == NULL)
+			err(1, "realloc");
+	}
+	if (ilen > 0)
+		memcpy(pt->add + pt->nadd, ins, ilen);
+
+	/* At worst one piece is split in two around the new one */
+	if ((pieces = reallocarray(NULL, pt->npieces + 2,
+	    sizeof(struct piece))) == NULL)
+		err(1, "reallocarray");
+
+	for (i = n = pos = 0, put = ilen == 0; i < pt->npieces; i++) {
+		p = &pt->pieces[i];
+
+		if (pos < off) {
+			keep = MIN(p->len, off - pos);
+			pieces[n] = *p;
+			pieces[n++].len = keep;
+		}
+
+		if (pos + p->len > end) {
+			if (!put) {
+				pieces[n].add = 1;
+				pieces[n].off = pt->nadd;
+				pieces[n++].len = ilen;
+				put = 1;
+			}
+			start = MAX(pos, end);
+			pieces[n].add = p->add;
+			pieces[n].off = p->off + (start - pos);
+			pieces[n++].len = pos + p->len - start;
+		}
+
+		pos += p->len;
+	}
+
+	if (!put) {
+		pieces[n].add = 1;
+		pieces[n].off = pt->nadd;
+		pieces[n++].len = ilen;
+	}
+
+	free(pt->pieces);
+	pt->pieces = pieces;
+	pt->npieces = n;
+	pt->nadd += ilen;
+	pt->len = pt->len - len + ilen;
+}
+
+/*
+ * Look for the n bytes at needle in the text, starting at off.
+ *
+ * RETURN: where they first appear, or -1 if they do not.
+ */
+ssize_t
+piece_find(const struct piece_table *pt, size_t off, const char *needle,
+    size_t n)
+{
+	char	*buf, *p;
+	size_t	 got;
+	ssize_t	 found;
+
+	if (n == 0 || n > PIECE_BLOCK)
+		return -1;
+
+	if ((buf = malloc(PIECE_BLOCK + n - 1)) == NULL)
+		err(1, "malloc");
+
+	/* Blocks overlap so that a match across two of them is not missed */
+	for (found = -1; off < pt->len && pt->len - off >= n;
+	    off += PIECE_BLOCK) {
+		got = piece_read(pt, off, PIECE_BLOCK + n - 1, buf);
+		if ((p = memmem(buf, got, needle, n)) != NULL) {
+			found = off + (p - buf);
+			break;
+		}
+	}
+
+	free(buf);
+	return found;
+}
+
+/*
+ * Find a good place to cut the text at or just before off: the start of
+ * the line, if that is no more than limit bytes back, or else the start of
+ * the UTF-8 sequence at off.
+ *
+ * RETURN: the offset of that place.
+ */
+size_t
+piece_boundary(const struct piece_table *pt, size_t off, size_t limit)
+{
+	char	*buf;
+	size_t	 start, i;
+
+	if (off >= pt->len)
+		return pt->len;
+
+	start = off > limit ? off - limit : 0;
+	if ((buf = malloc(off - start + 1)) == NULL)
+		err(1, "malloc");
+	piece_read(pt, start, off - start + 1, buf);
+
+	for (i = off - start; i > 0 && buf[i - 1] != '\n'; i--)
+		;
+	if (i == 0 && start > 0)
+		for (i = off - start; i > 0 && (buf[i] & 0xc0) == 0x80; i--)
+			;
+
+	free(buf);
+	return start + i;
+}
+
+/*
+ * RETURN: how many UTF-8 characters there are in the len bytes of the text
+ * starting at off.
+ */
+size_t
+piece_chars(const struct piece_table *pt, size_t off, size_t len)
+{
+	const struct piece	*p;
+	const unsigned char	*s;
+	size_t			 i, at, n, k, chars;
+
+	if (off >= pt->len)
+		return 0;
+	if (len > pt->len - off)
+		len = pt->len - off;
+
+	for (i = locate(pt, off, &at), chars = 0; len > 0; i++, at = 0) {
+		p = &pt->pieces[i];
+		n = MIN(p->len - at, len);
+		s = (const unsigned char *)base(pt, p) + p->off + at;
+		for (k = 0; k < n; k++)
+			if ((s[k] & 0xc0) != 0x80)
+				chars++;
+		len -= n;
+	}
+
+	return chars;
+}
+
+/*
+ * Count chars UTF-8 characters on from off.
+ *
+ * RETURN: the offset of the character reached, or the length of the text if
+ * it runs out first.
+ */
+size_t
+piece_seek(const struct piece_table *pt, size_t off, size_t chars)
+{
+	const struct piece	*p;
+	const unsigned char	*s;
+	size_t			 i, at, k;
+
+	for (i = locate(pt, off, &at); i < pt->npieces; i++, at = 0) {
+		p = &pt->pieces[i];
+		s = (const unsigned char *)base(pt, p) + p->off;
+		for (k = at; k < p->len; k++, off++)
+			if ((s[k] & 0xc0) != 0x80 && chars-- == 0)
+				return off;
+	}
+
+	return pt->len;
+}
+
+/*
+ * Write all of the text to the file descriptor.
+ *
+ * RETURN: 0 on success, or -1 with errno set.
+ */
+int
+piece_write(const struct piece_table *pt, int fd)
+{
+	const struct piece	*p;
+	const char		*s;
+	size_t			 i, done;
+	ssize_t			 n;
+
+	for (i = 0; i < pt->npieces; i++) {
+		p = &pt->pieces[i];
+		s = base(pt, p) + p->off;
+		for (done = 0; done < p->len; done += n)
+			if ((n = write(fd, s + done, p->len - done)) == -1) {
+				if (errno == EINTR) {
+					n = 0;
+					continue;
+				}
+				return -1;
+			}
+	}
+
+	return 0;
+}
+
+/*
+ * RETURN: the text the piece is part of.
+ */
+static const char *
+base(const struct piece_table *pt, const struct piece *p)
+{
+	return p->add ? pt->add : g_bytes_get_data(pt->orig, NULL);
+}
+
+/*
+ * Find the piece that the byte at off is in.
+ *
+ * RETURN: its index, with how far into it the byte is stored into at.
+ */
+static size_t
+locate(const struct piece_table *pt, size_t off, size_t *at)
+{
+	size_t	i;
+
+	for (i = 0; i < pt->npieces && off >= pt->pieces[i].len; i++)
+		off -= pt->pieces[i].len;
+
+	*at = off;
+	return i;
+}
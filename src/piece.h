@@ -0,0 +1,26 @@
+#ifndef PIECE_H
+#define PIECE_H
+
+#include <sys/types.h>
+
+#include <glib.h>
+
+struct piece_table;
+
+struct piece_table	*piece_new(GBytes *);
+void			 piece_free(struct piece_table *);
+size_t			 piece_len(const struct piece_table *);
+size_t			 piece_read(const struct piece_table *, size_t, size_t,
+			    char *);
+void			 piece_replace(struct piece_table *, size_t, size_t,
+			    const char *, size_t);
+ssize_t			 piece_find(const struct piece_table *, size_t,
+			    const char *, size_t);
+size_t			 piece_boundary(const struct piece_table *, size_t,
+			    size_t);
+size_t			 piece_chars(const struct piece_table *, size_t,
+			    size_t);
+size_t			 piece_seek(const struct piece_table *, size_t, size_t);
+int			 piece_write(const struct piece_table *, int);
+
+#endif /* !PIECE_H */
@@ -0,0 +1,759 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "cache.h"
+#include "compat.h"
+#include "dedup.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "queue.h"
+#include "segment.h"
+#include "upstream.h"
+#include "warmup.h"
+
+/*
+ * The stages a line goes through, in order, as are their queue depth gauges.
+ * Reading is done by the calling thread; encoding happens as the request
+ * goes out, in the network stage.
+ */
+enum stage_id {
+	STAGE_SEGMENT,
+	STAGE_CACHE,
+	STAGE_NETWORK,
+	STAGE_PARSE,
+	STAGE_WRITE,
+	STAGE_COUNT
+};
+
+struct pipeline;
+
+/*
+ * A set of threads that take work from one queue and hand it on.
+ */
+struct stage {
+	const char	*name;		/* What it is called in IDIOM_STAGES */
+	int		 threads;	/* How many threads run it */
+	int		 live;		/* How many have not yet finished */
+	gpointer	 (*func)(gpointer);
+	struct queue	*in;		/* Where its work comes from */
+	struct queue	*done;		/* What to close once it finishes */
+	struct pipeline	*p;		/* The pipeline it belongs to */
+	guint64		 items;		/* How many items it has taken */
+	gint64		 busy_us;	/* Time spent working on them */
+	gint64		 wait_us;	/* Time spent waiting for them */
+};
+
+struct pipeline {
+	const char	 *src_lang;	/* The language translated from */
+	const char	**dst_langs;	/* The languages translated to */
+	size_t		  ndst;		/* How many there are */
+	FILE		 *out;		/* Where the translations go */
+	struct stage	  stages[STAGE_COUNT];
+	struct queue	 *write;	/* Lines ready to be written */
+	GMutex		  lock;		/* Guards written */
+	GCond		  cond;		/* Signals a change to written */
+	size_t		  written;	/* How many lines are out */
+	guint64		  repeats;	/* Segments not sent again */
+	guint64		  saved;	/* How many bytes they came to */
+	int		  failed;	/* Set if any line fails */
+};
+
+/*
+ * One line of input, with its translation into every language.
+ */
+struct job {
+	size_t		  seq;		/* Which line it is, from 0 */
+	GBytes		 *line;		/* The line, without its newline */
+	struct segment	 *segs;		/* Its segments */
+	size_t		  nsegs;	/* How many there are */
+	char		**results;	/* Per language, then per segment */
+	int		  missing;	/* Segments still to be fetched */
+	int		  failed;	/* Set if any of them failed */
+};
+
+/*
+ * One request: segments of any number of lines, all to one language. A
+ * segment that comes up more than once is sent once, and its translation
+ * goes to every place it came from.
+ */
+struct request {
+	size_t		  dst;		/* Which language */
+	GBytes		**q;		/* The segments, each only once */
+	size_t		  nq;		/* How many there are */
+	struct job	**jobs;		/* The line each place is in */
+	char		***slots;	/* Where each translation goes */
+	size_t		 *which;	/* Which segment goes there */
+	size_t		  n;		/* How many places there are */
+	size_t		  size;		/* How many there is room for */
+	struct dedup	 *seen;		/* The segments, to find repeats */
+	size_t		  body;		/* The length of the POST body */
+	char		 *raw;		/* The response, if any */
+	size_t		  rawlen;	/* Its length */
+};
+
+static void		 parse_stages(struct pipeline *);
+static void		*take(struct stage *);
+static void		 account(struct stage *, gint64);
+static void		 finish(struct stage *);
+static void		 print_stats(struct pipeline *, gint64);
+
+static void		 add_segment(struct pipeline *, struct request **,
+    struct job *, size_t, size_t);
+static void		 send_request(struct pipeline *, struct request *);
+static struct request	*new_request(size_t);
+static void		 free_request(struct request *);
+static void		 resolve(struct pipeline *, struct job *);
+static void		 write_job(struct pipeline *, struct job *);
+static void		 free_job(struct pipeline *, struct job *);
+
+gpointer		 segment_func(gpointer);
+gpointer		 cache_func(gpointer);
+gpointer		 network_func(gpointer);
+gpointer		 parse_func(gpointer);
+gpointer		 write_func(gpointer);
+
+/*
+ * What each stage is called, and how many threads it has unless IDIOM_STAGES
+ * says otherwise. Most of the time goes on waiting for the network.
+ */
+static const struct {
+	const char	*name;
+	int		 threads;
+	gpointer	 (*func)(gpointer);
+} defaults[STAGE_COUNT] = {
+	{ "segment",	1,	segment_func },
+	{ "cache",	1,	cache_func },
+	{ "network",	4,	network_func },
+	{ "parse",	2,	parse_func },
+	{ "write",	1,	write_func },
+};
+
+/*
+ * Translate each line of in into every language in dst_langs, writing the
+ * translations to out in the order the lines came. With more than one
+ * language, each line is printed once per language, in the order given,
+ * after the language and a tab. A line that failed is left blank.
+ *
+ * The work is split into stages, each with its own threads, joined by
+ * bounded queues: a full queue holds back the stage that feeds it, and the
+ * reader holds back once PIPELINE_WINDOW lines are in flight. So parsing
+ * one response overlaps with waiting for the next, and a slow request holds
+ * up only the lines in it. The number of threads per stage can be set with
+ * IDIOM_STAGES, such as "network=8,parse=2", and IDIOM_STATS=1 prints how
+ * busy each stage was.
+ *
+ * RETURN: the exit status.
+ */
+int
+pipeline_run(FILE *in, FILE *out, const char *src_lang,
+    const char **dst_langs, size_t ndst)
+{
+	struct pipeline	 p;
+	struct stage	*st;
+	struct job	*j;
+	struct queue	*first;
+	GThread		**thr;
+	char		*line;
+	size_t		 size, seq, nthr, i;
+	ssize_t		 len;
+	gint64		 start;
+	int		 k;
+	const char	*s;
+
+	memset(&p, 0, sizeof(p));
+	p.src_lang = src_lang;
+	p.dst_langs = dst_langs;
+	p.ndst = ndst;
+	p.out = out;
+	g_mutex_init(&p.lock);
+	g_cond_init(&p.cond);
+
+	for (k = 0; k < STAGE_COUNT; k++) {
+		p.stages[k].name = defaults[k].name;
+		p.stages[k].threads = defaults[k].threads;
+		p.stages[k].func = defaults[k].func;
+	}
+	parse_stages(&p);
+
+	/* Each stage closes the next one's queue; the cache also feeds write */
+	nthr = 0;
+	for (k = 0; k < STAGE_COUNT; k++) {
+		st = &p.stages[k];
+		st->p = &p;
+		st->live = st->threads;
+		st->in = queue_new(PIPELINE_QUEUE);
+		if (k > 0)
+			p.stages[k - 1].done = st->in;
+		nthr += st->threads;
+	}
+	first = p.stages[STAGE_SEGMENT].in;
+	p.write = p.stages[STAGE_WRITE].in;
+
+	if ((thr = reallocarray(NULL, nthr, sizeof(GThread *))) == NULL)
+		err(1, "reallocarray");
+	nthr = 0;
+	for (k = 0; k < STAGE_COUNT; k++)
+		for (i = 0; i < (size_t)p.stages[k].threads; i++)
+			thr[nthr++] = g_thread_new(p.stages[k].name,
+			    p.stages[k].func, &p.stages[k]);
+
+	start = g_get_monotonic_time();
+	line = NULL;
+	size = 0;
+
+	/* Each line is handed over whole, and getline(3) starts a new one */
+	for (seq = 0; (len = getline(&line, &size, in)) != -1; seq++) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		g_mutex_lock(&p.lock);
+		while (seq - p.written >= PIPELINE_WINDOW)
+			g_cond_wait(&p.cond, &p.lock);
+		g_mutex_unlock(&p.lock);
+
+		if ((j = calloc(1, sizeof(struct job))) == NULL)
+			err(1, "calloc");
+		j->seq = seq;
+		j->line = g_bytes_new_with_free_func(line, len, free, line);
+		queue_push(first, j);
+
+		line = NULL;
+		size = 0;
+	}
+
+	if (ferror(in)) {
+		warn("getline");
+		__atomic_store_n(&p.failed, 1, __ATOMIC_RELAXED);
+	}
+	free(line);
+	queue_close(first);
+
+	for (i = 0; i < nthr; i++)
+		g_thread_join(thr[i]);
+	free(thr);
+
+	if ((s = getenv("IDIOM_STATS")) != NULL && atoi(s) != 0)
+		print_stats(&p, g_get_monotonic_time() - start);
+
+	for (k = 0; k < STAGE_COUNT; k++)
+		queue_free(p.stages[k].in);
+	g_mutex_clear(&p.lock);
+	g_cond_clear(&p.cond);
+
+	return p.failed ? 1 : 0;
+}
+
+/*
+ * Split each line into segments.
+ */
+gpointer
+segment_func(gpointer data)
+{
+	struct stage	*st;
+	struct job	*j;
+	const char	*text;
+	size_t		 len;
+	gint64		 t;
+
+	st = (struct stage *)data;
+
+	while ((j = take(st)) != NULL) {
+		t = g_get_monotonic_time();
+		text = g_bytes_get_data(j->line, &len);
+		j->nsegs = segment_text(text, len, UPSTREAM_MAX_SEGMENT,
+		    &j->segs);
+		j->results = calloc(MAX(j->nsegs * st->p->ndst, 1),
+		    sizeof(char *));
+		if (j->results == NULL)
+			err(1, "calloc");
+		account(st, t);
+		queue_push(st->done, j);
+	}
+
+	finish(st);
+	return NULL;
+}
+
+/*
+ * Fill in what the cache already has. A line with nothing left to fetch
+ * goes straight to be written.
+ */
+gpointer
+cache_func(gpointer data)
+{
+	struct stage	*st;
+	struct pipeline	*p;
+	struct job	*j;
+	const char	*text;
+	char		**r;
+	size_t		 d, i;
+	gint64		 t;
+
+	st = (struct stage *)data;
+	p = st->p;
+
+	while ((j = take(st)) != NULL) {
+		t = g_get_monotonic_time();
+		text = g_bytes_get_data(j->line, NULL);
+		for (d = 0; d < p->ndst; d++)
+			for (i = 0; i < j->nsegs; i++) {
+				r = &j->results[d * j->nsegs + i];
+				*r = cache_get(p->src_lang, p->dst_langs[d],
+				    text + j->segs[i].off, j->segs[i].len);
+				if (*r == NULL)
+					j->missing++;
+			}
+		account(st, t);
+		queue_push(j->missing > 0 ? st->done : p->write, j);
+	}
+
+	finish(st);
+	return NULL;
+}
+
+/*
+ * Gather the segments still missing into requests, as many to a request as
+ * fit, and send them. Lines keep being gathered for as long as more are
+ * waiting, so a busy pipeline sends full requests, while an idle one sends
+ * what it has at once. The form encoding is done here too, straight into
+ * curl's buffer, as the request goes out.
+ */
+gpointer
+network_func(gpointer data)
+{
+	struct stage	 *st;
+	struct pipeline	 *p;
+	struct request	**reqs;
+	struct job	 *j;
+	size_t		  d, i;
+	gint64		  t;
+
+	st = (struct stage *)data;
+	p = st->p;
+
+	if ((reqs = calloc(p->ndst, sizeof(struct request *))) == NULL)
+		err(1, "calloc");
+
+	while ((j = take(st)) != NULL) {
+		t = g_get_monotonic_time();
+		for (;;) {
+			for (d = 0; d < p->ndst; d++)
+				for (i = 0; i < j->nsegs; i++)
+					if (j->results[d * j->nsegs + i] ==
+					    NULL)
+						add_segment(p, &reqs[d], j, d,
+						    i);
+			if ((j = queue_try_pop(st->in)) == NULL)
+				break;
+			__atomic_add_fetch(&st->items, 1, __ATOMIC_RELAXED);
+		}
+
+		for (d = 0; d < p->ndst; d++)
+			if (reqs[d] != NULL) {
+				send_request(p, reqs[d]);
+				queue_push(st->done, reqs[d]);
+				reqs[d] = NULL;
+			}
+		account(st, t);
+	}
+
+	free(reqs);
+	finish(st);
+	return NULL;
+}
+
+/*
+ * Pull the translations out of each response and put them where they
+ * belong. A line is passed on to be written once its last segment is in.
+ */
+gpointer
+parse_func(gpointer data)
+{
+	struct stage	 *st;
+	struct pipeline	 *p;
+	struct request	 *r;
+	char		**out;
+	const char	 *text;
+	size_t		  i, len;
+	gint64		  t;
+	int		  ok;
+
+	st = (struct stage *)data;
+	p = st->p;
+
+	while ((r = take(st)) != NULL) {
+		t = g_get_monotonic_time();
+
+		if ((out = calloc(r->nq, sizeof(char *))) == NULL)
+			err(1, "calloc");
+		ok = r->raw != NULL &&
+		    upstream_parse(r->raw, r->rawlen, r->q, r->nq, out) == 0;
+
+		for (i = 0; ok && i < r->nq; i++) {
+			text = g_bytes_get_data(r->q[i], &len);
+			cache_put(p->src_lang, p->dst_langs[r->dst], text, len,
+			    out[i]);
+		}
+
+		for (i = 0; i < r->n; i++) {
+			if (!ok)
+				__atomic_store_n(&r->jobs[i]->failed, 1,
+				    __ATOMIC_RELAXED);
+			else if ((*r->slots[i] = strdup(out[r->which[i]])) ==
+			    NULL)
+				err(1, "strdup");
+			resolve(p, r->jobs[i]);
+		}
+
+		for (i = 0; i < r->nq; i++)
+			free(out[i]);
+		free(out);
+		free_request(r);
+		account(st, t);
+	}
+
+	finish(st);
+	return NULL;
+}
+
+/*
+ * Write the lines out in the order they came, holding back any that are
+ * ready early.
+ */
+gpointer
+write_func(gpointer data)
+{
+	struct stage	 *st;
+	struct pipeline	 *p;
+	struct job	**ready, *j;
+	size_t		  next;
+	gint64		  t;
+
+	st = (struct stage *)data;
+	p = st->p;
+	next = 0;
+
+	if ((ready = calloc(PIPELINE_WINDOW, sizeof(struct job *))) == NULL)
+		err(1, "calloc");
+
+	while ((j = take(st)) != NULL) {
+		t = g_get_monotonic_time();
+		ready[j->seq % PIPELINE_WINDOW] = j;
+
+		while ((j = ready[next % PIPELINE_WINDOW]) != NULL &&
+		    j->seq == next) {
+			ready[next % PIPELINE_WINDOW] = NULL;
+			write_job(p, j);
+			free_job(p, j);
+			next++;
+		}
+		fflush(p->out);
+
+		g_mutex_lock(&p->lock);
+		p->written = next;
+		g_cond_signal(&p->cond);
+		g_mutex_unlock(&p->lock);
+
+		account(st, t);
+	}
+
+	free(ready);
+	finish(st);
+	return NULL;
+}
+
+/*
+ * Read the number of threads for each stage from IDIOM_STAGES: a
+ * comma-separated list of "stage=threads". Lines have to be written in
+ * order, so the write stage keeps its one thread.
+ */
+static void
+parse_stages(struct pipeline *p)
+{
+	const char	*s;
+	char		*copy, *list, *item, *val, *end;
+	long		 n;
+	int		 k;
+
+	if ((s = getenv("IDIOM_STAGES")) == NULL || *s == '\0')
+		return;
+	if ((copy = list = strdup(s)) == NULL)
+		err(1, "strdup");
+
+	while ((item = strsep(&list, ",")) != NULL) {
+		if (*item == '\0')
+			continue;
+		if ((val = strchr(item, '=')) == NULL) {
+			warnx("IDIOM_STAGES: missing '=': %s", item);
+			continue;
+		}
+		*val++ = '\0';
+
+		for (k = 0; k < STAGE_COUNT; k++)
+			if (strcmp(item, p->stages[k].name) == 0)
+				break;
+		n = strtol(val, &end, 10);
+		if (k == STAGE_COUNT)
+			warnx("IDIOM_STAGES: unknown stage: %s", item);
+		else if (k == STAGE_WRITE)
+			warnx("IDIOM_STAGES: write has only one thread");
+		else if (*val == '\0' || *end != '\0' || n < 1 || n > 64)
+			warnx("IDIOM_STAGES: invalid number of threads: %s",
+			    val);
+		else
+			p->stages[k].threads = n;
+	}
+
+	free(copy);
+}
+
+/*
+ * RETURN: the next item for the stage, or NULL once there are no more.
+ */
+static void *
+take(struct stage *st)
+{
+	void	*data;
+	gint64	 t;
+
+	metrics_set(GAUGE_QUEUE_SEGMENT + (st - st->p->stages),
+	    queue_len(st->in));
+
+	t = g_get_monotonic_time();
+	data = queue_pop(st->in);
+	__atomic_add_fetch(&st->wait_us, g_get_monotonic_time() - t,
+	    __ATOMIC_RELAXED);
+	if (data != NULL)
+		__atomic_add_fetch(&st->items, 1, __ATOMIC_RELAXED);
+
+	return data;
+}
+
+/*
+ * Count the time since start as time the stage spent working.
+ */
+static void
+account(struct stage *st, gint64 start)
+{
+	__atomic_add_fetch(&st->busy_us, g_get_monotonic_time() - start,
+	    __ATOMIC_RELAXED);
+}
+
+/*
+ * End one of the stage's threads. The last one out closes the next queue.
+ */
+static void
+finish(struct stage *st)
+{
+	if (__atomic_sub_fetch(&st->live, 1, __ATOMIC_ACQ_REL) == 0 &&
+	    st->done != NULL)
+		queue_close(st->done);
+}
+
+/*
+ * Print, for each stage, how many items it took, and what share of its
+ * threads' time went on working and on waiting for work; then how much
+ * sending repeated segments once saved.
+ */
+static void
+print_stats(struct pipeline *p, gint64 elapsed)
+{
+	struct stage	*st;
+	double		 total;
+	int		 k;
+
+	fprintf(stderr, "%-8s %7s %10s %6s %6s\n",
+	    "stage", "threads", "items", "busy", "wait");
+
+	for (k = 0; k < STAGE_COUNT; k++) {
+		st = &p->stages[k];
+		total = (double)MAX(elapsed, 1) * st->threads;
+		fprintf(stderr, "%-8s %7d %10llu %5.1f%% %5.1f%%\n",
+		    st->name, st->threads, (unsigned long long)st->items,
+		    100.0 * st->busy_us / total, 100.0 * st->wait_us / total);
+	}
+
+	fprintf(stderr, "%llu repeated segments sent once, %llu bytes saved\n",
+	    (unsigned long long)p->repeats, (unsigned long long)p->saved);
+}
+
+/*
+ * Add segment i of the line to the request for language d, first sending
+ * the request on if the segment would not fit.
+ */
+static void
+add_segment(struct pipeline *p, struct request **rp, struct job *j,
+    size_t d, size_t i)
+{
+	struct request	*r;
+	const char	*text;
+	size_t		 len, field;
+	ssize_t		 same;
+
+	text = (const char *)g_bytes_get_data(j->line, NULL) + j->segs[i].off;
+	len = j->segs[i].len;
+	field = upstream_field_len(text, len);
+
+	same = -1;
+	if ((r = *rp) != NULL &&
+	    (same = dedup_find(r->seen, text, len, r->nq)) == -1 &&
+	    r->body + field > UPSTREAM_MAX_BODY) {
+		send_request(p, r);
+		queue_push(p->stages[STAGE_NETWORK].done, r);
+		r = NULL;
+	}
+	if (r == NULL) {
+		r = *rp = new_request(d);
+		dedup_find(r->seen, text, len, 0);
+	}
+
+	if (r->n == r->size) {
+		r->size *= 2;
+		r->q = reallocarray(r->q, r->size, sizeof(GBytes *));
+		r->jobs = reallocarray(r->jobs, r->size, sizeof(struct job *));
+		r->slots = reallocarray(r->slots, r->size, sizeof(char **));
+		r->which = reallocarray(r->which, r->size, sizeof(size_t));
+		if (r->q == NULL || r->jobs == NULL || r->slots == NULL ||
+		    r->which == NULL)
+			err(1, "reallocarray");
+	}
+
+	if (same == -1) {
+		r->q[r->nq] = g_bytes_new_from_bytes(j->line, j->segs[i].off,
+		    len);
+		same = r->nq++;
+		r->body += field;
+	} else {
+		__atomic_add_fetch(&p->repeats, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&p->saved, len, __ATOMIC_RELAXED);
+	}
+	r->jobs[r->n] = j;
+	r->slots[r->n] = &j->results[d * j->nsegs + i];
+	r->which[r->n] = same;
+	r->n++;
+}
+
+/*
+ * Send the request off. On failure raw is left NULL, and the parse stage
+ * marks its lines failed.
+ */
+static void
+send_request(struct pipeline *p, struct request *r)
+{
+	warmup_defer();
+	if (upstream_fetch(p->src_lang, p->dst_langs[r->dst], r->q, r->nq,
+	    &r->raw, &r->rawlen, LIMIT_BATCH) == -1)
+		r->raw = NULL;
+}
+
+/*
+ * RETURN: an empty request for language d.
+ */
+static struct request *
+new_request(size_t d)
+{
+	struct request	*r;
+
+	if ((r = calloc(1, sizeof(struct request))) == NULL)
+		err(1, "calloc");
+	r->dst = d;
+	r->size = 16;
+	r->q = reallocarray(NULL, r->size, sizeof(GBytes *));
+	r->jobs = reallocarray(NULL, r->size, sizeof(struct job *));
+	r->slots = reallocarray(NULL, r->size, sizeof(char **));
+	r->which = reallocarray(NULL, r->size, sizeof(size_t));
+	if (r->q == NULL || r->jobs == NULL || r->slots == NULL ||
+	    r->which == NULL)
+		err(1, "reallocarray");
+	r->seen = dedup_new();
+
+	return r;
+}
+
+/*
+ * Free the request; the translations it got now belong to their lines.
+ */
+static void
+free_request(struct request *r)
+{
+	size_t	i;
+
+	for (i = 0; i < r->nq; i++)
+		g_bytes_unref(r->q[i]);
+	free(r->q);
+	free(r->jobs);
+	free(r->slots);
+	free(r->which);
+	dedup_free(r->seen);
+	free(r->raw);
+	free(r);
+}
+
+/*
+ * Count one more of the line's segments as done, and pass the line on to be
+ * written if it was the last.
+ */
+static void
+resolve(struct pipeline *p, struct job *j)
+{
+	if (__atomic_sub_fetch(&j->missing, 1, __ATOMIC_ACQ_REL) == 0)
+		queue_push(p->write, j);
+}
+
+/*
+ * Write the line once per language: each segment replaced by its
+ * translation, and the whitespace between them kept.
+ */
+static void
+write_job(struct pipeline *p, struct job *j)
+{
+	const char	*text;
+	char		**r;
+	size_t		 d, i, off, len;
+
+	text = g_bytes_get_data(j->line, &len);
+
+	for (d = 0; d < p->ndst; d++) {
+		if (p->ndst > 1)
+			fprintf(p->out, "%s\t", p->dst_langs[d]);
+
+		if (__atomic_load_n(&j->failed, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&p->failed, 1, __ATOMIC_RELAXED);
+			fputc('\n', p->out);
+			continue;
+		}
+
+		r = &j->results[d * j->nsegs];
+		for (i = off = 0; i < j->nsegs; i++) {
+			fwrite(text + off, 1, j->segs[i].off - off, p->out);
+			fputs(r[i], p->out);
+			off = j->segs[i].off + j->segs[i].len;
+		}
+		fwrite(text + off, 1, len - off, p->out);
+		fputc('\n', p->out);
+	}
+}
+
+/*
+ * Free the line and all its translations.
+ */
+static void
+free_job(struct pipeline *p, struct job *j)
+{
+	size_t	i;
+
+	for (i = 0; i < j->nsegs * p->ndst; i++)
+		free(j->results[i]);
+	free(j->results);
+	free(j->segs);
+	g_bytes_unref(j->line);
+	free(j);
+}
@@ -0,0 +1,14 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+
+/* Room in each queue between two stages */
+#define PIPELINE_QUEUE		64
+
+/* The most lines read but not yet written out */
+#define PIPELINE_WINDOW		1024
+
+int	pipeline_run(FILE *, FILE *, const char *, const char **, size_t);
+
+#endif /* !PIPELINE_H */
@@ -0,0 +1,281 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "compat.h"
+#include "cache.h"
+#include "limit.h"
+#include "markup.h"
+#include "metrics.h"
+#include "prefetch.h"
+#include "segment.h"
+#include "upstream.h"
+
+#define PREFETCH_PAIRS		32	/* How many language pairs to remember */
+#define PREFETCH_TARGETS	2	/* How many other targets to guess at */
+#define PREFETCH_POLL_MS	50	/* How often to check for quiet */
+
+/*
+ * A language pair the user has translated between, and how often.
+ */
+struct pair {
+	char		*src_lang;
+	char		*dst_lang;
+	unsigned int	 count;
+};
+
+/*
+ * A round of guesses at what the user will translate next, made after a
+ * translation completes.
+ */
+struct guess {
+	gint	 gen;				/* The round this is */
+	GBytes	*text;				/* What was translated */
+	GBytes	*translation;			/* What it translated to */
+	char	*src_lang;			/* From which language */
+	char	*dst_lang;			/* Into which language */
+	char	*targets[PREFETCH_TARGETS];	/* Other likely targets */
+	enum markup	 markup;			/* What kind of document it is */
+};
+
+/*
+ * Guesses land in the cache, so that if the user then swaps the direction or
+ * picks another favorite target, the translation is already there.
+ *
+ * Guessing never gets in the way of real work. Each guess is at most one
+ * request, is only sent when no other request is in flight, and a round is
+ * abandoned as soon as the user starts a new translation.
+ */
+static struct {
+	GMutex		lock;			/* Guards the pairs */
+	struct pair	pairs[PREFETCH_PAIRS];	/* Pairs used, in no order */
+	size_t		npairs;			/* How many pairs there are */
+	gint		gen;			/* The current round */
+} pf;
+
+static gpointer	prefetch_func(gpointer);
+static void	prefetch_one(struct guess *, GBytes *, const char *,
+		    const char *);
+static int	live(struct guess *);
+static char	*xstrdup(const char *);
+
+/*
+ * Count a translation from one language into another, replacing the least
+ * used pair if there are too many.
+ */
+void
+prefetch_note(const char *src_lang, const char *dst_lang)
+{
+	struct pair	*p;
+	size_t		 i;
+
+	g_mutex_lock(&pf.lock);
+
+	for (i = 0, p = NULL; i < pf.npairs; i++) {
+		if (strcmp(pf.pairs[i].src_lang, src_lang) == 0 &&
+		    strcmp(pf.pairs[i].dst_lang, dst_lang) == 0) {
+			p = &pf.pairs[i];
+			break;
+		}
+	}
+
+	if (p == NULL) {
+		if (pf.npairs < PREFETCH_PAIRS)
+			p = &pf.pairs[pf.npairs++];
+		else {
+			p = &pf.pairs[0];
+			for (i = 1; i < pf.npairs; i++)
+				if (pf.pairs[i].count < p->count)
+					p = &pf.pairs[i];
+			free(p->src_lang);
+			free(p->dst_lang);
+		}
+		p->src_lang = xstrdup(src_lang);
+		p->dst_lang = xstrdup(dst_lang);
+		p->count = 0;
+	}
+
+	p->count++;
+
+	g_mutex_unlock(&pf.lock);
+}
+
+/*
+ * Start a new round of guesses after a translation: the translation back
+ * into the source language, and the text into the other targets most often
+ * used from the source language. Any earlier round is abandoned.
+ */
+void
+prefetch_start(GBytes *text, GBytes *translation, const char *src_lang,
+    const char *dst_lang, enum markup markup)
+{
+	struct guess	*g;
+	struct pair	*best[PREFETCH_TARGETS], *p;
+	size_t		 i, j, n;
+	GThread		*thr;
+
+	if ((g = calloc(1, sizeof(struct guess))) == NULL)
+		err(1, "calloc");
+
+	g->gen = g_atomic_int_add(&pf.gen, 1) + 1;
+	g->text = g_bytes_ref(text);
+	g->translation = g_bytes_ref(translation);
+	g->src_lang = xstrdup(src_lang);
+	g->dst_lang = xstrdup(dst_lang);
+	g->markup = markup;
+
+	g_mutex_lock(&pf.lock);
+
+	for (i = n = 0; i < pf.npairs; i++) {
+		if (strcmp(pf.pairs[i].src_lang, src_lang) != 0 ||
+		    strcmp(pf.pairs[i].dst_lang, dst_lang) == 0)
+			continue;
+
+		/* Keep the best few, most used first */
+		p = &pf.pairs[i];
+		if (n < PREFETCH_TARGETS)
+			n++;
+		else if (best[n - 1]->count >= p->count)
+			continue;
+		for (j = n - 1; j > 0 && best[j - 1]->count < p->count; j--)
+			best[j] = best[j - 1];
+		best[j] = p;
+	}
+
+	for (i = 0; i < n; i++)
+		g->targets[i] = xstrdup(best[i]->dst_lang);
+
+	g_mutex_unlock(&pf.lock);
+
+	thr = g_thread_new("prefetch", prefetch_func, g);
+	g_thread_unref(thr);
+}
+
+/*
+ * Abandon the current round of guesses. A request already sent is allowed
+ * to finish, but nothing more is sent.
+ */
+void
+prefetch_cancel(void)
+{
+	g_atomic_int_inc(&pf.gen);
+}
+
+/*
+ * Make a round of guesses, once the user has had a moment to settle.
+ */
+static gpointer
+prefetch_func(gpointer data)
+{
+	struct guess	*g;
+	size_t		 i;
+
+	g = (struct guess *)data;
+
+	g_usleep(PREFETCH_DELAY_MS * 1000);
+
+	if (strcmp(g->src_lang, "auto") != 0)
+		prefetch_one(g, g->translation, g->dst_lang, g->src_lang);
+	for (i = 0; i < PREFETCH_TARGETS && g->targets[i] != NULL; i++)
+		prefetch_one(g, g->text, g->src_lang, g->targets[i]);
+
+	for (i = 0; i < PREFETCH_TARGETS; i++)
+		free(g->targets[i]);
+	g_bytes_unref(g->text);
+	g_bytes_unref(g->translation);
+	free(g->src_lang);
+	free(g->dst_lang);
+	free(g);
+
+	return NULL;
+}
+
+/*
+ * Translate the segments of the text that are not already cached, and cache
+ * them. Text that needs more than one request is not worth a guess.
+ */
+static void
+prefetch_one(struct guess *g, GBytes *bytes, const char *src_lang,
+    const char *dst_lang)
+{
+	struct segment	 *segs;
+	GBytes		**q;
+	const char	 *text;
+	char		**out, *hit;
+	size_t		  i, n, nq, len, body;
+
+	text = g_bytes_get_data(bytes, &len);
+	n = markup_text(text, len, UPSTREAM_MAX_SEGMENT, g->markup, &segs);
+
+	q = reallocarray(NULL, n, sizeof(GBytes *));
+	out = reallocarray(NULL, n, sizeof(char *));
+	if (n > 0 && (q == NULL || out == NULL))
+		err(1, "reallocarray");
+
+	for (i = nq = body = 0; i < n; i++) {
+		if (segs[i].len == 0)
+			continue;
+		if ((hit = cache_get(src_lang, dst_lang, text + segs[i].off,
+		    segs[i].len)) != NULL) {
+			free(hit);
+			continue;
+		}
+		q[nq++] = g_bytes_new_from_bytes(bytes, segs[i].off,
+		    segs[i].len);
+		body += upstream_field_len(text + segs[i].off, segs[i].len);
+	}
+
+	if (nq == 0 || body > UPSTREAM_MAX_BODY)
+		goto cleanup;
+
+	while (live(g) && !limit_idle())
+		g_usleep(PREFETCH_POLL_MS * 1000);
+	if (!live(g)) {
+		metrics_add(METRIC_CANCELLED, 1);
+		goto cleanup;
+	}
+
+	if (upstream_translate(src_lang, dst_lang, q, nq, out, NULL,
+	    LIMIT_BACKGROUND) == 0) {
+		for (i = 0; i < nq; i++) {
+			cache_put(src_lang, dst_lang, g_bytes_get_data(q[i], NULL),
+			    g_bytes_get_size(q[i]), out[i]);
+			free(out[i]);
+		}
+	}
+
+cleanup:
+	for (i = 0; i < nq; i++)
+		g_bytes_unref(q[i]);
+	free(q);
+	free(out);
+	free(segs);
+}
+
+/*
+ * RETURN: whether the round of guesses is still wanted.
+ */
+static int
+live(struct guess *g)
+{
+	return g_atomic_int_get(&pf.gen) == g->gen;
+}
+
+/*
+ * RETURN: a copy of the string; exits if there is no memory for one.
+ */
+static char *
+xstrdup(const char *s)
+{
+	char	*t;
+
+	if ((t = strdup(s)) == NULL)
+		err(1, "strdup");
+	return t;
+}
@@ -0,0 +1,16 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <glib.h>
+
+#include "markup.h"
+
+/* How long to wait after a translation before guessing at the next one */
+#define PREFETCH_DELAY_MS	500
+
+void	prefetch_note(const char *, const char *);
+void	prefetch_start(GBytes *, GBytes *, const char *, const char *,
+	    enum markup);
+void	prefetch_cancel(void);
+
+#endif /* !PREFETCH_H */
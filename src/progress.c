@@ -0,0 +1,150 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "progress.h"
+
+/*
+ * How far along all the translations running at once are, together. Each
+ * one adds its segments to the total when it starts, and takes them back
+ * off when it ends; in between, segments count as done when they are found
+ * in the cache or come back, and a request in flight counts for part of
+ * its segments as its bytes go out and come in.
+ *
+ * Nothing here ticks on its own. A change schedules one redraw, at most
+ * PROGRESS_FRAME_MS away, and any further changes before then ride along
+ * with it, so the main loop wakes only while there is something to show.
+ */
+static struct {
+	GMutex	 lock;		/* Guards everything below */
+	gint64	 total;		/* Units in the running translations */
+	gint64	 done;		/* How many of those are done */
+	int	 jobs;		/* How many translations are running */
+	gint64	 start;		/* When the first of them started */
+	int	 pending;	/* Whether a redraw is scheduled */
+	void	 (*draw)(double, gint64, void *);
+	void	*arg;		/* Passed to draw */
+} pg;
+
+static void	 schedule(void);
+static gboolean	 redraw(gpointer);
+
+/*
+ * Start tracking progress, to be shown by calling draw on the main loop
+ * with the fraction done and the milliseconds likely left, or -1 if that
+ * is not yet known. The fraction is -1 once nothing is running.
+ */
+void
+progress_init(void (*draw)(double, gint64, void *), void *arg)
+{
+	pg.arg = arg;
+	pg.draw = draw;
+}
+
+/*
+ * RETURN: whether progress is being tracked at all.
+ */
+int
+progress_on(void)
+{
+	return pg.draw != NULL;
+}
+
+/*
+ * Start a translation of n segments.
+ */
+void
+progress_begin(size_t n)
+{
+	if (pg.draw == NULL)
+		return;
+
+	g_mutex_lock(&pg.lock);
+	if (pg.jobs++ == 0)
+		pg.start = g_get_monotonic_time();
+	pg.total += (gint64)n * PROGRESS_UNIT;
+	schedule();
+	g_mutex_unlock(&pg.lock);
+}
+
+/*
+ * Count units more as done; fewer, if negative.
+ */
+void
+progress_advance(gint64 units)
+{
+	if (pg.draw == NULL || units == 0)
+		return;
+
+	g_mutex_lock(&pg.lock);
+	pg.done += units;
+	schedule();
+	g_mutex_unlock(&pg.lock);
+}
+
+/*
+ * End a translation of n segments, all of which have been counted as done,
+ * whether or not they were translated.
+ */
+void
+progress_end(size_t n)
+{
+	if (pg.draw == NULL)
+		return;
+
+	g_mutex_lock(&pg.lock);
+	pg.total -= (gint64)n * PROGRESS_UNIT;
+	pg.done -= (gint64)n * PROGRESS_UNIT;
+	if (--pg.jobs == 0)
+		pg.total = pg.done = 0;
+	schedule();
+	g_mutex_unlock(&pg.lock);
+}
+
+/*
+ * Make sure a redraw is coming. The lock must be held.
+ */
+static void
+schedule(void)
+{
+	if (pg.pending)
+		return;
+
+	pg.pending = 1;
+	g_timeout_add(PROGRESS_FRAME_MS, redraw, NULL);
+}
+
+/*
+ * Show the progress as it stands. The time left is guessed from how fast
+ * the work has gone so far.
+ *
+ * RETURN: false, so the function is not run again.
+ */
+static gboolean
+redraw(gpointer data)
+{
+	double	fraction;
+	gint64	elapsed, eta;
+
+	g_mutex_lock(&pg.lock);
+
+	pg.pending = 0;
+	fraction = -1;
+	eta = -1;
+
+	if (pg.jobs > 0 && pg.total > 0) {
+		fraction = CLAMP((double)pg.done / pg.total, 0.0, 1.0);
+		elapsed = (g_get_monotonic_time() - pg.start) / 1000;
+		if (fraction > 0)
+			eta = elapsed * (1 - fraction) / fraction;
+	} else if (pg.jobs > 0)
+		fraction = 0;
+
+	g_mutex_unlock(&pg.lock);
+
+	pg.draw(fraction, eta, pg.arg);
+
+	return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,23 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <sys/types.h>
+
+#include <glib.h>
+
+/* How much progress one segment is worth */
+#define PROGRESS_UNIT		1000
+
+/* Redraw no more often than this, about once a frame */
+#define PROGRESS_FRAME_MS	33
+
+/* Don't bother showing less time than this as left */
+#define PROGRESS_ETA_MIN_MS	3000
+
+void	progress_init(void (*)(double, gint64, void *), void *);
+int	progress_on(void);
+void	progress_begin(size_t);
+void	progress_advance(gint64);
+void	progress_end(size_t);
+
+#endif /* !PROGRESS_H */
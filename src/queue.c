@@ -0,0 +1,261 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "compat.h"
+#include "queue.h"
+
+#define CACHE_LINE	64	/* Keep the two ends this far apart */
+#define PARK_US		10000	/* Look again after this long, regardless */
+
+/*
+ * A bounded queue of pointers for any number of producers and consumers.
+ *
+ * Pushing and popping never take a lock: each end is a counter that threads
+ * claim positions from with compare-and-swap, and each cell carries a
+ * sequence number that says whether it is ready to be written or read at
+ * that position. Only when the queue is full, for a producer, or empty, for
+ * a consumer, does a thread park on the condition variable, which is the
+ * backpressure; whoever next changes the queue wakes it.
+ */
+struct cell {
+	size_t	 seq;	/* Which position this cell is ready for */
+	void	*data;	/* The item */
+};
+
+struct queue {
+	struct cell	*cells;			/* The ring */
+	size_t		 mask;			/* Its size, less one */
+	char		 pad0[CACHE_LINE];
+	size_t		 head;			/* The next position to pop */
+	char		 pad1[CACHE_LINE];
+	size_t		 tail;			/* The next position to push */
+	char		 pad2[CACHE_LINE];
+	int		 waiters;		/* How many threads are parked */
+	int		 closed;		/* No more will be pushed */
+	GMutex		 lock;			/* For parking only */
+	GCond		 cond;			/* Signals a change */
+};
+
+static int	can_push(struct queue *);
+static int	can_pop(struct queue *);
+static void	park(struct queue *, int (*)(struct queue *));
+static void	wake(struct queue *);
+
+/*
+ * RETURN: an empty queue with room for at least size items.
+ */
+struct queue *
+queue_new(size_t size)
+{
+	struct queue	*q;
+	size_t		 n, i;
+
+	for (n = 2; n < size; n *= 2)
+		;
+
+	if ((q = calloc(1, sizeof(struct queue))) == NULL)
+		err(1, "calloc");
+	if ((q->cells = reallocarray(NULL, n, sizeof(struct cell))) == NULL)
+		err(1, "reallocarray");
+
+	for (i = 0; i < n; i++)
+		q->cells[i].seq = i;
+	q->mask = n - 1;
+	g_mutex_init(&q->lock);
+	g_cond_init(&q->cond);
+
+	return q;
+}
+
+/*
+ * Add an item, which must not be NULL, waiting for room if the queue is
+ * full.
+ */
+void
+queue_push(struct queue *q, void *data)
+{
+	struct cell	*c;
+	size_t		 pos, seq;
+	intptr_t	 dif;
+
+	pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		c = &q->cells[pos & q->mask];
+		seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		dif = (intptr_t)seq - (intptr_t)pos;
+
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1,
+			    1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			park(q, can_push);
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		} else
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	}
+
+	c->data = data;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+	wake(q);
+}
+
+/*
+ * Take the oldest item, waiting for one if the queue is empty.
+ *
+ * RETURN: the item, or NULL once the queue is closed and empty.
+ */
+void *
+queue_pop(struct queue *q)
+{
+	void	*data;
+
+	for (;;) {
+		if ((data = queue_try_pop(q)) != NULL)
+			return data;
+		if (__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE))
+			return queue_try_pop(q);
+		park(q, can_pop);
+	}
+}
+
+/*
+ * RETURN: the oldest item, or NULL if the queue is empty.
+ */
+void *
+queue_try_pop(struct queue *q)
+{
+	struct cell	*c;
+	size_t		 pos, seq;
+	intptr_t	 dif;
+	void		*data;
+
+	pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	for (;;) {
+		c = &q->cells[pos & q->mask];
+		seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1,
+			    1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0)
+			return NULL;
+		else
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	}
+
+	data = c->data;
+	__atomic_store_n(&c->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+	wake(q);
+
+	return data;
+}
+
+/*
+ * RETURN: roughly how many items are in the queue; it may change at any
+ * moment.
+ */
+size_t
+queue_len(struct queue *q)
+{
+	size_t	head, tail;
+
+	head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	return tail > head ? tail - head : 0;
+}
+
+/*
+ * Say that nothing more will be pushed, so that consumers stop once the
+ * queue is empty.
+ */
+void
+queue_close(struct queue *q)
+{
+	__atomic_store_n(&q->closed, 1, __ATOMIC_RELEASE);
+
+	g_mutex_lock(&q->lock);
+	g_cond_broadcast(&q->cond);
+	g_mutex_unlock(&q->lock);
+}
+
+/*
+ * Free the queue, which must be empty and unused.
+ */
+void
+queue_free(struct queue *q)
+{
+	g_mutex_clear(&q->lock);
+	g_cond_clear(&q->cond);
+	free(q->cells);
+	free(q);
+}
+
+/*
+ * RETURN: whether there is room to push.
+ */
+static int
+can_push(struct queue *q)
+{
+	size_t	pos;
+
+	pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	return __atomic_load_n(&q->cells[pos & q->mask].seq,
+	    __ATOMIC_ACQUIRE) == pos;
+}
+
+/*
+ * RETURN: whether there is anything to pop, or never will be.
+ */
+static int
+can_pop(struct queue *q)
+{
+	size_t	pos;
+
+	pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	return __atomic_load_n(&q->cells[pos & q->mask].seq,
+	    __ATOMIC_ACQUIRE) == pos + 1 ||
+	    __atomic_load_n(&q->closed, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Sleep until the queue changes, unless ready says there is no need. The
+ * waiter count is raised before looking, and wake() looks at it after the
+ * change, so one of the two always sees the other.
+ */
+static void
+park(struct queue *q, int (*ready)(struct queue *))
+{
+	g_mutex_lock(&q->lock);
+	__atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+	if (!ready(q))
+		g_cond_wait_until(&q->cond, &q->lock,
+		    g_get_monotonic_time() + PARK_US);
+	__atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+	g_mutex_unlock(&q->lock);
+}
+
+/*
+ * Wake any parked threads after a change.
+ */
+static void
+wake(struct queue *q)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->waiters, __ATOMIC_RELAXED) == 0)
+		return;
+
+	g_mutex_lock(&q->lock);
+	g_cond_broadcast(&q->cond);
+	g_mutex_unlock(&q->lock);
+}
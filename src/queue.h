@@ -0,0 +1,16 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <sys/types.h>
+
+struct queue;
+
+struct queue	*queue_new(size_t);
+void		 queue_push(struct queue *, void *);
+void		*queue_pop(struct queue *);
+void		*queue_try_pop(struct queue *);
+size_t		 queue_len(struct queue *);
+void		 queue_close(struct queue *);
+void		 queue_free(struct queue *);
+
+#endif /* !QUEUE_H */
@@ -0,0 +1,209 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rawjson.h"
+#include "scan.h"
+
+/*
+ * The backend answers with one big JSON array, of which a translation only
+ * needs the first element. It also leaves out nulls, so that "[1,,3]" is an
+ * array of three with an empty second element; that is not JSON, and must be
+ * filled in before a JSON parser will take it.
+ *
+ * These find an element of the top-level array without parsing anything,
+ * then copy out just that element in a form a parser will take. Both skip
+ * from one quote, backslash, bracket, brace or comma to the next a block at
+ * a time, and the copy checks the text between them is UTF-8 on the way.
+ */
+
+static char	*fill_nulls(const char *, size_t);
+static int	is_space(char);
+
+/*
+ * Find element idx of the top-level array.
+ *
+ * RETURN: 0 with the offset and length of the element, whitespace trimmed;
+ * the length is 0 for a left-out null. -1 if there is no such element.
+ */
+int
+rawjson_element(const char *json, size_t len, size_t idx, size_t *off,
+    size_t *elen)
+{
+	size_t	i, start, end, n;
+	int	depth, in_str, high;
+
+	for (i = 0; i < len && is_space(json[i]); i++)
+		;
+	if (i == len || json[i] != '[')
+		return -1;
+
+	depth = in_str = 0;
+	n = 0;
+	start = i + 1;
+
+	for (i++; i < len; i++) {
+		if ((i += scan_next(json + i, len - i, in_str, &high)) == len)
+			break;
+
+		if (in_str) {
+			if (json[i] == '\\')
+				i++;
+			else if (json[i] == '"')
+				in_str = 0;
+			continue;
+		}
+
+		switch (json[i]) {
+		case '"':
+			in_str = 1;
+			break;
+		case '[':
+		case '{':
+			depth++;
+			break;
+		case ']':
+		case '}':
+			if (depth-- > 0)
+				break;
+			/* The end of the top-level array */
+			if (n != idx)
+				return -1;
+			goto found;
+		case ',':
+			if (depth > 0)
+				break;
+			if (n == idx)
+				goto found;
+			n++;
+			start = i + 1;
+			break;
+		}
+	}
+
+	return -1;
+
+found:
+	end = i;
+	while (start < end && is_space(json[start]))
+		start++;
+	while (end > start && is_space(json[end - 1]))
+		end--;
+
+	/* "[]" has no elements at all, rather than one empty one */
+	if (start == end && n == 0 && json[i] == ']')
+		return -1;
+
+	*off = start;
+	*elen = end - start;
+	return 0;
+}
+
+/*
+ * Copy an element as JSON, with any left-out nulls in it filled in. An empty
+ * element is itself a null.
+ *
+ * RETURN: the NUL-terminated copy, to be freed by the caller, or NULL if the
+ * element is not valid UTF-8.
+ */
+char *
+rawjson_dup(const char *json, size_t len)
+{
+	char	*out;
+
+	if (len == 0) {
+		if ((out = strdup("null")) == NULL)
+			err(1, "strdup");
+		return out;
+	}
+
+	return fill_nulls(json, len);
+}
+
+/*
+ * Copy the JSON, writing "null" wherever an array element was left out:
+ * between "[" or "," and a ",", and between a "," and a "]". Check that it
+ * is UTF-8 on the way.
+ *
+ * RETURN: the NUL-terminated copy, to be freed by the caller, or NULL if the
+ * text is not UTF-8.
+ */
+static char *
+fill_nulls(const char *json, size_t len)
+{
+	char	*out;
+	size_t	 i, n, run, end, extra;
+	char	 prev;
+	int	 in_str, high;
+
+	/* Room for a null in every eighth byte before growing */
+	extra = len / 8 + 4;
+	if ((out = malloc(len + extra + 1)) == NULL)
+		err(1, "malloc");
+
+	prev = '\0';
+	in_str = 0;
+
+	for (i = n = 0; i < len; i++) {
+		/* Copy up to the next byte that matters whole */
+		if ((run = scan_next(json + i, len - i, in_str, &high)) > 0) {
+			if (high && !scan_utf8(json + i, run)) {
+				free(out);
+				return NULL;
+			}
+			if (!in_str) {
+				for (end = i + run; end > i &&
+				    is_space(json[end - 1]); end--)
+					;
+				if (end > i)
+					prev = json[end - 1];
+			}
+			memcpy(out + n, json + i, run);
+			n += run;
+			if ((i += run) == len)
+				break;
+		}
+
+		if (in_str) {
+			if (json[i] == '\\' && i + 1 < len)
+				out[n++] = json[i++];
+			else if (json[i] == '"')
+				in_str = 0;
+		} else if (json[i] == '"') {
+			in_str = 1;
+			prev = '"';
+		} else {
+			if ((json[i] == ',' && (prev == '[' || prev == ',')) ||
+			    (json[i] == ']' && prev == ',')) {
+				/* The copy runs ahead of the JSON by n - i */
+				if (n - i + 4 > extra) {
+					extra *= 2;
+					if ((out = realloc(out, len + extra + 1)) ==
+					    NULL)
+						err(1, "realloc");
+				}
+				memcpy(out + n, "null", 4);
+				n += 4;
+			}
+			prev = json[i];
+		}
+
+		out[n++] = json[i];
+	}
+
+	out[n] = '\0';
+	return out;
+}
+
+/*
+ * RETURN: whether the character is JSON whitespace.
+ */
+static int
+is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
@@ -0,0 +1,9 @@
+#ifndef RAWJSON_H
+#define RAWJSON_H
+
+#include <sys/types.h>
+
+int	 rawjson_element(const char *, size_t, size_t, size_t *, size_t *);
+char	*rawjson_dup(const char *, size_t);
+
+#endif /* !RAWJSON_H */
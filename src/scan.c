@@ -0,0 +1,371 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86	1
+#include <immintrin.h>
+#endif
+
+/*
+ * Kernels for scanning backend responses a block at a time.
+ *
+ * Each comes in a plain C version and, on x86, in SSE2 and AVX2 versions
+ * that look at 16 or 32 bytes per step. The best one the CPU has is picked
+ * the first time any is used; scan_use() can pick another, for comparing
+ * them.
+ */
+
+typedef size_t	(*next_fn)(const char *, size_t, int, int *);
+typedef int	(*utf8_fn)(const char *, size_t);
+
+static void	pick_best(void);
+static enum scan_isa select_isa(enum scan_isa);
+static size_t	next_scalar(const char *, size_t, int, int *);
+static int	utf8_scalar(const char *, size_t);
+static size_t	utf8_seq(const unsigned char *, size_t);
+#ifdef SCAN_X86
+static size_t	next_sse2(const char *, size_t, int, int *);
+static int	utf8_sse2(const char *, size_t);
+static size_t	next_avx2(const char *, size_t, int, int *);
+static int	utf8_avx2(const char *, size_t);
+#endif
+
+static pthread_once_t	 scan_once = PTHREAD_ONCE_INIT;
+static next_fn		 next_impl = next_scalar;
+static utf8_fn		 utf8_impl = utf8_scalar;
+
+#define IN_STRING	0x1	/* Ends or escapes within a string */
+#define OUTSIDE		0x2	/* Means something outside of a string */
+
+/*
+ * The bytes that mean something to JSON: quotes and backslashes everywhere,
+ * and brackets, braces, and commas outside of strings.
+ */
+static const unsigned char special[256] = {
+	['"'] = IN_STRING | OUTSIDE, ['\\'] = IN_STRING | OUTSIDE,
+	[','] = OUTSIDE, ['['] = OUTSIDE, [']'] = OUTSIDE, ['{'] = OUTSIDE,
+	['}'] = OUTSIDE
+};
+
+/*
+ * Find the next byte that JSON cares about, inside a string or not, and note
+ * on the way whether the bytes skipped over were all ASCII, so that only
+ * runs that were not need checking as UTF-8.
+ *
+ * RETURN: its offset, or len if there is none. high is set to whether any
+ * byte before it had its high bit set.
+ */
+size_t
+scan_next(const char *s, size_t len, int in_str, int *high)
+{
+	pthread_once(&scan_once, pick_best);
+	return next_impl(s, len, in_str, high);
+}
+
+/*
+ * RETURN: whether the text is valid UTF-8: no stray continuation bytes,
+ * overlong forms, surrogates, or code points past U+10FFFF.
+ */
+int
+scan_utf8(const char *s, size_t len)
+{
+	pthread_once(&scan_once, pick_best);
+	return utf8_impl(s, len);
+}
+
+/*
+ * Use the kernels for the given instruction set, or for the best one below
+ * it that the CPU has.
+ *
+ * RETURN: the instruction set now in use.
+ */
+enum scan_isa
+scan_use(enum scan_isa isa)
+{
+	pthread_once(&scan_once, pick_best);
+	return select_isa(isa);
+}
+
+/*
+ * RETURN: the name of the instruction set.
+ */
+const char *
+scan_isa_name(enum scan_isa isa)
+{
+	switch (isa) {
+	case SCAN_AVX2:
+		return "avx2";
+	case SCAN_SSE2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
+
+/*
+ * Use the best kernels the CPU has.
+ */
+static void
+pick_best(void)
+{
+	select_isa(SCAN_AVX2);
+}
+
+/*
+ * Point the kernels at the given instruction set or the best one below it.
+ *
+ * RETURN: the instruction set picked.
+ */
+static enum scan_isa
+select_isa(enum scan_isa isa)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+
+	if (isa >= SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+		next_impl = next_avx2;
+		utf8_impl = utf8_avx2;
+		return SCAN_AVX2;
+	}
+	if (isa >= SCAN_SSE2 && __builtin_cpu_supports("sse2")) {
+		next_impl = next_sse2;
+		utf8_impl = utf8_sse2;
+		return SCAN_SSE2;
+	}
+#endif
+
+	next_impl = next_scalar;
+	utf8_impl = utf8_scalar;
+	return SCAN_SCALAR;
+}
+
+static size_t
+next_scalar(const char *s, size_t len, int in_str, int *high)
+{
+	const unsigned char	*p;
+	size_t			 i;
+	int			 h, want;
+
+	p = (const unsigned char *)s;
+	want = in_str ? IN_STRING : OUTSIDE;
+	h = 0;
+
+	for (i = 0; i < len && !(special[p[i]] & want); i++)
+		h |= p[i] >> 7;
+
+	*high = h;
+	return i;
+}
+
+static int
+utf8_scalar(const char *s, size_t len)
+{
+	const unsigned char	*p;
+	size_t			 i, n;
+
+	p = (const unsigned char *)s;
+
+	for (i = 0; i < len; i += n) {
+		if (p[i] < 0x80)
+			n = 1;
+		else if ((n = utf8_seq(p + i, len - i)) == 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * RETURN: the length of the multi-byte UTF-8 sequence at the start of s, or
+ * 0 if it is not a valid one.
+ */
+static size_t
+utf8_seq(const unsigned char *s, size_t len)
+{
+	unsigned char	lo, hi;
+	size_t		n, i;
+
+	lo = 0x80;
+	hi = 0xbf;
+
+	if (s[0] >= 0xc2 && s[0] <= 0xdf)
+		n = 2;
+	else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+		n = 3;
+		if (s[0] == 0xe0)
+			lo = 0xa0;	/* overlong */
+		else if (s[0] == 0xed)
+			hi = 0x9f;	/* surrogates */
+	} else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+		n = 4;
+		if (s[0] == 0xf0)
+			lo = 0x90;	/* overlong */
+		else if (s[0] == 0xf4)
+			hi = 0x8f;	/* past U+10FFFF */
+	} else
+		return 0;
+
+	if (n > len || s[1] < lo || s[1] > hi)
+		return 0;
+	for (i = 2; i < n; i++)
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+
+	return n;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * The SIMD versions compare a block against each special byte at once, or
+ * just the quote and backslash within a string, and turn the result into a
+ * bit mask, one bit per byte; the sign bits of the
+ * block give the non-ASCII bytes the same way. Whatever is left over at the
+ * end, short of a block, goes to the plain C version.
+ *
+ * For UTF-8 that only makes a fast path for ASCII: a block with no sign
+ * bits set is skipped whole, but one with any is checked a sequence at a
+ * time with utf8_seq(), as in the plain C version, so text mostly outside
+ * of ASCII goes no faster.
+ */
+
+__attribute__((target("sse2"))) static size_t
+next_sse2(const char *s, size_t len, int in_str, int *high)
+{
+	__m128i		v, m;
+	unsigned int	mask, hmask;
+	size_t		i, n;
+	int		h;
+
+	h = 0;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(s + i));
+		m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+		    _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+		if (!in_str)
+			m = _mm_or_si128(m,
+			    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')),
+			    _mm_or_si128(
+			    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')),
+			    _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))),
+			    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')),
+			    _mm_cmpeq_epi8(v, _mm_set1_epi8('}'))))));
+		mask = _mm_movemask_epi8(m);
+		hmask = _mm_movemask_epi8(v);
+
+		if (mask != 0) {
+			n = __builtin_ctz(mask);
+			*high = h | ((hmask & ((1U << n) - 1)) != 0);
+			return i + n;
+		}
+		h |= hmask != 0;
+	}
+
+	n = next_scalar(s + i, len - i, in_str, high);
+	*high |= h;
+	return i + n;
+}
+
+__attribute__((target("sse2"))) static int
+utf8_sse2(const char *s, size_t len)
+{
+	const unsigned char	*p;
+	unsigned int		 mask;
+	size_t			 i, n, end;
+
+	p = (const unsigned char *)s;
+
+	for (i = 0; i + 16 <= len; i = end) {
+		end = i + 16;
+		mask = _mm_movemask_epi8(
+		    _mm_loadu_si128((const __m128i *)(p + i)));
+		if (mask == 0)
+			continue;
+
+		/* The rest of the block, and the sequence that ends past it */
+		for (i += __builtin_ctz(mask); i < end; i += n)
+			if (p[i] < 0x80)
+				n = 1;
+			else if ((n = utf8_seq(p + i, len - i)) == 0)
+				return 0;
+		end = i;
+	}
+
+	return utf8_scalar((const char *)p + i, len - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+next_avx2(const char *s, size_t len, int in_str, int *high)
+{
+	__m256i		v, m;
+	unsigned int	mask, hmask;
+	size_t		i, n;
+	int		h;
+
+	h = 0;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(s + i));
+		m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+		    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+		if (!in_str)
+			m = _mm256_or_si256(m, _mm256_or_si256(
+			    _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')),
+			    _mm256_or_si256(_mm256_or_si256(
+			    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')),
+			    _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']'))),
+			    _mm256_or_si256(
+			    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')),
+			    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'))))));
+		mask = (unsigned int)_mm256_movemask_epi8(m);
+		hmask = (unsigned int)_mm256_movemask_epi8(v);
+
+		if (mask != 0) {
+			n = __builtin_ctz(mask);
+			*high = h | ((hmask & ((1U << n) - 1)) != 0);
+			return i + n;
+		}
+		h |= hmask != 0;
+	}
+
+	n = next_sse2(s + i, len - i, in_str, high);
+	*high |= h;
+	return i + n;
+}
+
+__attribute__((target("avx2"))) static int
+utf8_avx2(const char *s, size_t len)
+{
+	const unsigned char	*p;
+	unsigned int		 mask;
+	size_t			 i, n, end;
+
+	p = (const unsigned char *)s;
+
+	for (i = 0; i + 32 <= len; i = end) {
+		end = i + 32;
+		mask = (unsigned int)_mm256_movemask_epi8(
+		    _mm256_loadu_si256((const __m256i *)(p + i)));
+		if (mask == 0)
+			continue;
+
+		/* The rest of the block, and the sequence that ends past it */
+		for (i += __builtin_ctz(mask); i < end; i += n)
+			if (p[i] < 0x80)
+				n = 1;
+			else if ((n = utf8_seq(p + i, len - i)) == 0)
+				return 0;
+		end = i;
+	}
+
+	return utf8_sse2((const char *)p + i, len - i);
+}
+
+#endif /* SCAN_X86 */
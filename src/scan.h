@@ -0,0 +1,20 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <sys/types.h>
+
+/*
+ * The instruction sets a scanner can be built on, from least to most.
+ */
+enum scan_isa {
+	SCAN_SCALAR,
+	SCAN_SSE2,
+	SCAN_AVX2
+};
+
+size_t		 scan_next(const char *, size_t, int, int *);
+int		 scan_utf8(const char *, size_t);
+enum scan_isa	 scan_use(enum scan_isa);
+const char	*scan_isa_name(enum scan_isa);
+
+#endif /* !SCAN_H */
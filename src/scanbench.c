@@ -0,0 +1,266 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compat.h"
+#include "rawjson.h"
+#include "scan.h"
+
+static char	*make_response(const char *, size_t, size_t, size_t *);
+static void	 run(const char *, const char *, size_t, int);
+static double	 bench_commas(const char *, size_t, int);
+static double	 bench_dup(const char *, size_t, int);
+static double	 bench_utf8(const char *, size_t, int);
+static double	 now(void);
+static long	 number(const char *, long, const char *);
+
+__dead void	 usage();
+
+/*
+ * A sentence as the backend sends it, mostly ASCII, and another with none
+ * but the JSON around it; and what follows the sentences.
+ */
+static const char	 latin[] =
+    "[\"Le caf\xc3\xa9 est pr\xc3\xaat, viens vite avant qu'il ne refroidisse "
+    "et que les autres le boivent \\\"tout\\\". \","
+    "\"The coffee is ready, come quickly before it gets cold and the others "
+    "drink \\\"all\\\" of it. \",,,3],";
+static const char	 nonlatin[] =
+    "[\"\xd0\x9a\xd0\xbe\xd1\x84\xd0\xb5 \xd0\xb3\xd0\xbe\xd1\x82\xd0\xbe"
+    "\xd0\xb2, \xd0\xb8\xd0\xb4\xd0\xb8 \xd1\x81\xd0\xba\xd0\xbe\xd1\x80"
+    "\xd0\xb5\xd0\xb5, \xd0\xbf\xd0\xbe\xd0\xba\xd0\xb0 \xd0\xbe\xd0\xbd "
+    "\xd0\xbd\xd0\xb5 \xd0\xbe\xd1\x81\xd1\x82\xd1\x8b\xd0\xbb \xd0\xb8 "
+    "\xd0\xb4\xd1\x80\xd1\x83\xd0\xb3\xd0\xb8\xd0\xb5 \xd0\xbd\xd0\xb5 "
+    "\xd0\xb2\xd1\x8b\xd0\xbf\xd0\xb8\xd0\xbb\xd0\xb8 \xd0\xb5\xd0\xb3"
+    "\xd0\xbe \\\"\xd0\xb2\xd0\xb5\xd1\x81\xd1\x8c\\\". \",\"\xe3\x82\xb3"
+    "\xe3\x83\xbc\xe3\x83\x92\xe3\x83\xbc\xe3\x81\x8c\xe3\x81\xa7\xe3\x81"
+    "\x8d\xe3\x81\x9f\xe3\x82\x88\xe3\x80\x81\xe5\x86\xb7\xe3\x82\x81\xe3"
+    "\x81\xa6\xe7\x9a\x86\xe3\x81\xab\\\"\xe5\x85\xa8\xe9\x83\xa8\\\"\xe9"
+    "\xa3\xb2\xe3\x81\xbe\xe3\x82\x8c\xe3\x82\x8b\xe5\x89\x8d\xe3\x81\xab"
+    "\xe6\x97\xa9\xe3\x81\x8f\xe6\x9d\xa5\xe3\x81\xa6\xe3\x80\x82\",,,3],";
+static const char	 trailer[] =
+    ",,\"fr\",,,[[\"caf\xc3\xa9\",,[[\"coffee\",1000,true,false]]]],"
+    "0.9,,[[\"fr\"],,[0.9],[\"fr\"]]]";
+
+/*
+ * scanbench times the response scanning kernels with each instruction set
+ * the CPU has, against the byte at a time loop they replaced, over made-up
+ * responses of the given size: one mostly in ASCII, and one mostly not.
+ * The SIMD versions of scan_utf8() only skip over ASCII a block at a time,
+ * so on the second they are not much faster than the plain C version.
+ */
+int
+main(int argc, char *argv[])
+{
+	char		*json;
+	size_t		 mb, len;
+	int		 ch, rounds;
+
+	mb = 8;
+	rounds = 20;
+
+	while ((ch = getopt(argc, argv, "n:r:")) != -1)
+		switch (ch) {
+		case 'n':
+			mb = number(optarg, 1024, "megabytes");
+			break;
+		case 'r':
+			rounds = number(optarg, 10000, "rounds");
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+			break;
+		}
+
+	json = make_response(latin, sizeof(latin) - 1, mb * 1024 * 1024,
+	    &len);
+	run("latin", json, len, rounds);
+	free(json);
+
+	json = make_response(nonlatin, sizeof(nonlatin) - 1, mb * 1024 * 1024,
+	    &len);
+	run("nonlatin", json, len, rounds);
+	free(json);
+
+	return 0;
+}
+
+/*
+ * Display a usage message and exit.
+ */
+void
+usage()
+{
+	fprintf(stderr, "usage: scanbench [-n megabytes] [-r rounds]\n");
+	exit(EX_USAGE);
+}
+
+/*
+ * RETURN: a response of about the given size, mostly the slen bytes of
+ * sentence over and over, to be freed by the caller; len is set to its
+ * length.
+ */
+static char *
+make_response(const char *sentence, size_t slen, size_t size, size_t *len)
+{
+	char	*json;
+	size_t	 n, i, tlen;
+
+	tlen = sizeof(trailer) - 1;
+	n = size / slen + 1;
+
+	if ((json = malloc(n * slen + tlen + 3)) == NULL)
+		err(1, "malloc");
+
+	json[0] = '[';
+	json[1] = '[';
+	for (i = 0; i < n; i++)
+		memcpy(json + 2 + i * slen, sentence, slen);
+	/* Swap the last sentence's comma for the end of the sentences */
+	json[1 + n * slen] = ']';
+	memcpy(json + 2 + n * slen, trailer, tlen);
+	*len = 2 + n * slen + tlen;
+	json[*len] = '\0';
+
+	return json;
+}
+
+/*
+ * Time each kernel with each instruction set over the response, and print
+ * the results under its name.
+ */
+static void
+run(const char *name, const char *json, size_t len, int rounds)
+{
+	enum scan_isa	isa, got;
+	double		mb;
+
+	mb = (double)len / (1024 * 1024) * rounds;
+
+	printf("%-24s %10s\n", name, "MB/s");
+	printf("%-24s %10.0f\n", "commas/bytewise",
+	    mb / bench_commas(json, len, rounds));
+
+	for (isa = SCAN_SCALAR; isa <= SCAN_AVX2; isa++) {
+		if ((got = scan_use(isa)) != isa)
+			continue;
+		printf("rawjson_dup/%-12s %10.0f\n", scan_isa_name(got),
+		    mb / bench_dup(json, len, rounds));
+		printf("scan_utf8/%-14s %10.0f\n", scan_isa_name(got),
+		    mb / bench_utf8(json, len, rounds));
+	}
+}
+
+/*
+ * The loop the translations used to run over the whole response, blanking
+ * the second of each pair of commas in a copy of it.
+ *
+ * RETURN: the seconds it took.
+ */
+static double
+bench_commas(const char *json, size_t len, int rounds)
+{
+	double	 start;
+	char	*copy;
+	size_t	 i;
+	int	 r;
+
+	if ((copy = malloc(len)) == NULL)
+		err(1, "malloc");
+
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		memcpy(copy, json, len);
+		for (i = len - 1; i > 0; i--)
+			if (copy[i - 1] == ',' && copy[i] == ',')
+				copy[i] = ' ';
+	}
+	start = now() - start;
+
+	free(copy);
+	return start;
+}
+
+/*
+ * Find the sentences and copy them out with their nulls filled in, which
+ * also checks them as UTF-8.
+ *
+ * RETURN: the seconds it took.
+ */
+static double
+bench_dup(const char *json, size_t len, int rounds)
+{
+	double	 start;
+	char	*first;
+	size_t	 off, flen;
+	int	 r;
+
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		if (rawjson_element(json, len, 0, &off, &flen) == -1)
+			errx(1, "rawjson_element");
+		if ((first = rawjson_dup(json + off, flen)) == NULL)
+			errx(1, "rawjson_dup");
+		free(first);
+	}
+
+	return now() - start;
+}
+
+/*
+ * Check the whole response as UTF-8.
+ *
+ * RETURN: the seconds it took.
+ */
+static double
+bench_utf8(const char *json, size_t len, int rounds)
+{
+	double	start;
+	int	r;
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		if (!scan_utf8(json, len))
+			errx(1, "scan_utf8");
+
+	return now() - start;
+}
+
+/*
+ * RETURN: the monotonic time in seconds.
+ */
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(1, "clock_gettime");
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * RETURN: the number in s, which must be from 1 to max; exit if it is not.
+ */
+static long
+number(const char *s, long max, const char *what)
+{
+	char	*end;
+	long	 n;
+
+	n = strtol(s, &end, 10);
+	if (*s == '\0' || *end != '\0' || n < 1 || n > max)
+		errx(EX_USAGE, "%s must be from 1 to %ld: %s", what, max, s);
+
+	return n;
+}
@@ -0,0 +1,170 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+#include "segment.h"
+
+static int	is_space(char);
+static size_t	paragraph_end(const char *, size_t, size_t);
+static size_t	split_point(const char *, size_t, size_t);
+
+/*
+ * Find the next segment in the buffer. A segment is a paragraph - text up to
+ * the next blank line - with the surrounding whitespace trimmed off. A
+ * paragraph longer than max bytes is split at the last line break, sentence
+ * end, or space that fits.
+ *
+ * When eof is false the buffer is assumed to continue past len, so a
+ * paragraph that runs to the end of the buffer is not a segment yet.
+ *
+ * RETURN: the number of bytes consumed, which is the whitespace before the
+ * segment plus the segment itself, or 0 if more input is needed. A segment
+ * of length zero means only whitespace was consumed. When more input is
+ * needed, seg still says how much whitespace comes before the paragraph.
+ */
+size_t
+segment_next(const char *buf, size_t len, size_t max, int eof,
+    struct segment *seg)
+{
+	size_t	off, end;
+
+	for (off = 0; off < len && is_space(buf[off]); off++)
+		;
+
+	if (off == len) {
+		seg->off = len;
+		seg->len = 0;
+		return len;
+	}
+
+	end = paragraph_end(buf, off, len);
+	if (end == len && !eof && len - off <= max) {
+		seg->off = off;
+		seg->len = 0;
+		return 0;
+	}
+
+	if (end - off > max)
+		end = split_point(buf, off, max);
+
+	while (end > off && is_space(buf[end - 1]))
+		end--;
+
+	seg->off = off;
+	seg->len = end - off;
+	return end;
+}
+
+/*
+ * Split all of the text into segments, each no longer than max bytes.
+ *
+ * RETURN: the number of segments stored into the newly-allocated segs.
+ */
+size_t
+segment_text(const char *text, size_t len, size_t max, struct segment **segs)
+{
+	struct segment	*ss, seg;
+	size_t		 n, cap, off, used;
+
+	n = off = 0;
+	cap = 8;
+	if ((ss = reallocarray(NULL, cap, sizeof(struct segment))) == NULL)
+		err(1, "reallocarray");
+
+	while (off < len) {
+		used = segment_next(text + off, len - off, max, 1, &seg);
+		if (seg.len > 0) {
+			if (n == cap) {
+				cap *= 2;
+				ss = reallocarray(ss, cap, sizeof(struct segment));
+				if (ss == NULL)
+					err(1, "reallocarray");
+			}
+			ss[n].off = off + seg.off;
+			ss[n].len = seg.len;
+			n++;
+		}
+		off += used;
+	}
+
+	*segs = ss;
+	return n;
+}
+
+/*
+ * RETURN: the offset of the blank line that ends the paragraph starting at
+ * off, or len if the paragraph runs to the end of the buffer.
+ */
+static size_t
+paragraph_end(const char *buf, size_t off, size_t len)
+{
+	size_t	i, j;
+
+	for (i = off; i < len; i++) {
+		if (buf[i] != '\n')
+			continue;
+
+		for (j = i + 1; j < len && (buf[j] == ' ' || buf[j] == '\t' ||
+		    buf[j] == '\r'); j++)
+			;
+		if (j < len && buf[j] == '\n')
+			return i;
+	}
+
+	return len;
+}
+
+/*
+ * Pick where to cut an over-long paragraph: the last newline, else the last
+ * sentence end, else the last space within max bytes of off. Failing all
+ * that, cut at max bytes, backing up to the start of a UTF-8 sequence.
+ *
+ * RETURN: the offset just past the end of the first piece.
+ */
+static size_t
+split_point(const char *buf, size_t off, size_t max)
+{
+	size_t	i, end, nl, stop, sp;
+
+	end = off + max;
+	nl = stop = sp = 0;
+
+	for (i = off + 1; i < end; i++) {
+		if (!is_space(buf[i]))
+			continue;
+
+		if (buf[i] == '\n')
+			nl = i;
+		else if (buf[i - 1] == '.' || buf[i - 1] == '!' ||
+		    buf[i - 1] == '?')
+			stop = i;
+		else
+			sp = i;
+	}
+
+	if (nl > off)
+		return nl;
+	if (stop > off)
+		return stop;
+	if (sp > off)
+		return sp;
+
+	while (end > off + 1 && (buf[end] & 0xc0) == 0x80)
+		end--;
+	return end;
+}
+
+/*
+ * RETURN: whether the byte is ASCII whitespace.
+ */
+static int
+is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+	    c == '\f' || c == '\v';
+}
@@ -0,0 +1,19 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <sys/types.h>
+
+/*
+ * A piece of the source text that is translated on its own. The offset is
+ * relative to the start of the text handed to the segmenter; whatever lies
+ * between two segments is whitespace that is copied through untranslated.
+ */
+struct segment {
+	size_t	off;	/* Where the segment starts */
+	size_t	len;	/* How many bytes it spans */
+};
+
+size_t	segment_next(const char *, size_t, size_t, int, struct segment *);
+size_t	segment_text(const char *, size_t, size_t, struct segment **);
+
+#endif /* !SEGMENT_H */
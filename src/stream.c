@@ -0,0 +1,456 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "batcher.h"
+#include "cache.h"
+#include "segment.h"
+#include "stream.h"
+#include "upstream.h"
+
+enum slot_state {
+	SLOT_PENDING,	/* Waiting on its translation */
+	SLOT_DONE,	/* Ready to be written out */
+	SLOT_FAILED	/* Could not be translated */
+};
+
+/*
+ * A segment that has been read but not yet written out, with the whitespace
+ * that came before it. A run of whitespace at the end of the buffer gets a
+ * slot of its own, with no segment.
+ */
+struct slot {
+	struct stream	*st;		/* The stream it is part of */
+	GBytes		*text;		/* The segment, while it is sent */
+	char		*ws;		/* The whitespace before it */
+	size_t		 wslen;		/* How long that is */
+	char		*result;	/* Its translation, once done */
+	off_t		 in_end;	/* Where it ends in the input */
+	enum slot_state	 state;		/* Whether it is done */
+};
+
+/*
+ * One file being translated into another. Segments go out through the
+ * batchers as they are read, and come back into a ring of slots in the order
+ * they were read; whatever is done at the head of the ring is written out.
+ * The ring is the window: when it is full, reading waits for the head to be
+ * written out, so only so much of the file is ever held at once.
+ *
+ * Every so often, how far the input has been read and the output written is
+ * saved next to the output, so that a run cut short picks up from there.
+ */
+struct stream {
+	const char	*src_lang;		/* The source language */
+	const char	*dst_lang;		/* The destination language */
+	FILE		*out;			/* Where the translation goes */
+	char		*ckpt;			/* The checkpoint file */
+	off_t		 in_done;		/* Input covered by the output */
+	off_t		 out_done;		/* Output written so far */
+	gint64		 saved;			/* When the checkpoint was saved */
+	GMutex		 lock;			/* Guards the ring */
+	GCond		 cond;			/* Signals a slot is done */
+	struct slot	 slots[STREAM_WINDOW];	/* The ring */
+	size_t		 head;			/* The oldest slot */
+	size_t		 n;			/* How many slots are in use */
+	int		 failed;		/* Whether a segment failed */
+};
+
+static off_t	open_output(struct stream *, const char *);
+static int	add_slot(struct stream *, struct batcher *, const char *,
+    const struct segment *, off_t);
+static void	drain(struct stream *, int);
+static void	write_slot(struct stream *, struct slot *);
+static int	checkpoint(struct stream *);
+static void	slot_result(const char *, void *);
+
+/*
+ * Translate one file into another, a piece at a time, holding no more than
+ * STREAM_BUF_SIZE bytes of input and STREAM_WINDOW segments at once. If a
+ * checkpoint from an earlier run into the same output file is found, carry
+ * on from where it left off.
+ *
+ * RETURN: the exit status.
+ */
+int
+stream_file(const char *in_path, const char *out_path, const char *src_lang,
+    const char *dst_lang)
+{
+	struct stream	*st;
+	struct batcher	*b[STREAM_SENDERS];
+	struct segment	 seg;
+	char		*buf;
+	size_t		 pos, fill, used, next, i;
+	ssize_t		 nr;
+	off_t		 base;
+	int		 fd, eof, cut, ret;
+
+	if ((st = calloc(1, sizeof(struct stream))) == NULL)
+		err(1, "calloc");
+	st->src_lang = src_lang;
+	st->dst_lang = dst_lang;
+	g_mutex_init(&st->lock);
+	g_cond_init(&st->cond);
+
+	ret = 1;
+	fd = -1;
+	buf = NULL;
+
+	if ((fd = open(in_path, O_RDONLY)) == -1) {
+		warn("%s", in_path);
+		goto done;
+	}
+	if ((base = open_output(st, out_path)) == -1)
+		goto done;
+	if (base > 0 && lseek(fd, base, SEEK_SET) == -1) {
+		warn("%s", in_path);
+		goto done;
+	}
+
+	if ((buf = malloc(STREAM_BUF_SIZE)) == NULL)
+		err(1, "malloc");
+	for (i = 0; i < STREAM_SENDERS; i++)
+		b[i] = batcher_new(src_lang, dst_lang, NULL, LIMIT_BATCH);
+
+	pos = fill = next = 0;
+	eof = cut = 0;
+	st->saved = g_get_monotonic_time();
+
+	while (!st->failed) {
+		used = segment_next(buf + pos, fill - pos, UPSTREAM_MAX_SEGMENT,
+		    eof || cut, &seg);
+		if (used == 0) {
+			if (eof)
+				break;
+
+			/* The whitespace before the paragraph need not wait */
+			if (seg.off > 0) {
+				add_slot(st, b[next], buf + pos, &seg,
+				    base + pos + seg.off);
+				pos += seg.off;
+			}
+
+			/* Keep the start of the paragraph and read the rest */
+			memmove(buf, buf + pos, fill - pos);
+			base += pos;
+			fill -= pos;
+			pos = 0;
+
+			/* A paragraph that fills the buffer is cut where it is */
+			if (fill == STREAM_BUF_SIZE) {
+				cut = 1;
+				continue;
+			}
+
+			if ((nr = read(fd, buf + fill, STREAM_BUF_SIZE - fill)) ==
+			    -1) {
+				warn("%s", in_path);
+				st->failed = 1;
+				break;
+			}
+			eof = nr == 0;
+			fill += nr;
+			continue;
+		}
+
+		if (add_slot(st, b[next], buf + pos, &seg, base + pos + used))
+			next = (next + 1) % STREAM_SENDERS;
+		pos += used;
+		cut = 0;
+		drain(st, 0);
+	}
+
+	/* Send whatever is still waiting, then write out what came back */
+	for (i = 0; i < STREAM_SENDERS; i++)
+		batcher_free(b[i]);
+	while (st->n > 0 && !st->failed)
+		drain(st, 1);
+
+	if (st->failed) {
+		if (checkpoint(st) == 0)
+			warnx("stopped after %lld bytes of %s; run again to "
+			    "carry on", (long long)st->in_done, in_path);
+		goto done;
+	}
+
+	if (fflush(st->out) == EOF || ferror(st->out)) {
+		warn("%s", out_path);
+		goto done;
+	}
+	if (unlink(st->ckpt) == -1 && errno != ENOENT)
+		warn("%s", st->ckpt);
+	ret = 0;
+
+done:
+	if (st->out != NULL && fclose(st->out) == EOF) {
+		warn("%s", out_path);
+		ret = 1;
+	}
+	if (fd != -1)
+		close(fd);
+	for (i = 0; i < st->n; i++) {
+		free(st->slots[(st->head + i) % STREAM_WINDOW].ws);
+		free(st->slots[(st->head + i) % STREAM_WINDOW].result);
+	}
+	g_mutex_clear(&st->lock);
+	g_cond_clear(&st->cond);
+	free(st->ckpt);
+	free(st);
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * Open the output file. If there is a checkpoint for it, made translating
+ * between the same languages, cut the output back to what the checkpoint
+ * covers and carry on from there; otherwise start it afresh.
+ *
+ * RETURN: where in the input to start reading, or -1 on error.
+ */
+static off_t
+open_output(struct stream *st, const char *path)
+{
+	FILE		*f;
+	char		 sl[64], tl[64];
+	long long	 in_off, out_off;
+	int		 n;
+
+	if (asprintf(&st->ckpt, "%s.ckpt", path) == -1)
+		err(1, "asprintf");
+
+	if ((f = fopen(st->ckpt, "r")) == NULL) {
+		if (errno != ENOENT) {
+			warn("%s", st->ckpt);
+			return -1;
+		}
+		if ((st->out = fopen(path, "w")) == NULL) {
+			warn("%s", path);
+			return -1;
+		}
+		return 0;
+	}
+
+	n = fscanf(f, "%63s %63s %lld %lld", sl, tl, &in_off, &out_off);
+	fclose(f);
+	if (n != 4 || in_off < 0 || out_off < 0) {
+		warnx("%s: not a checkpoint", st->ckpt);
+		return -1;
+	}
+	if (strcmp(sl, st->src_lang) != 0 || strcmp(tl, st->dst_lang) != 0) {
+		warnx("%s: from %s to %s, not %s to %s", st->ckpt, sl, tl,
+		    st->src_lang, st->dst_lang);
+		return -1;
+	}
+
+	if ((st->out = fopen(path, "r+")) == NULL ||
+	    ftruncate(fileno(st->out), out_off) == -1 ||
+	    fseeko(st->out, out_off, SEEK_SET) == -1) {
+		warn("%s", path);
+		return -1;
+	}
+
+	st->in_done = in_off;
+	st->out_done = out_off;
+	return in_off;
+}
+
+/*
+ * Take the next segment, and the whitespace before it, into the ring, and
+ * send the segment unless its translation is cached. Wait for room first.
+ *
+ * RETURN: whether the segment went to the batcher.
+ */
+static int
+add_slot(struct stream *st, struct batcher *b, const char *text,
+    const struct segment *seg, off_t in_end)
+{
+	struct slot	*s;
+	char		*result;
+	int		 sent;
+
+	while (st->n == STREAM_WINDOW && !st->failed)
+		drain(st, 1);
+	if (st->failed)
+		return 0;
+
+	result = seg->len > 0 ?
+	    cache_get(st->src_lang, st->dst_lang, text + seg->off, seg->len) :
+	    NULL;
+	sent = seg->len > 0 && result == NULL;
+
+	g_mutex_lock(&st->lock);
+
+	s = &st->slots[(st->head + st->n) % STREAM_WINDOW];
+	s->st = st;
+	s->wslen = seg->off;
+	if ((s->ws = malloc(seg->off + 1)) == NULL)
+		err(1, "malloc");
+	memcpy(s->ws, text, seg->off);
+	s->result = result;
+	s->in_end = in_end;
+	s->state = sent ? SLOT_PENDING : SLOT_DONE;
+	s->text = sent ? g_bytes_new(text + seg->off, seg->len) : NULL;
+	st->n++;
+
+	g_mutex_unlock(&st->lock);
+
+	if (sent)
+		batcher_add(b, s->text, slot_result, s);
+
+	return sent;
+}
+
+/*
+ * Write out the slots at the head of the ring that are done. If wait is
+ * true, first wait for the head to be done. Save a checkpoint if it is
+ * time.
+ */
+static void
+drain(struct stream *st, int wait)
+{
+	struct slot	*s;
+
+	g_mutex_lock(&st->lock);
+
+	while (st->n > 0) {
+		s = &st->slots[st->head];
+		if (s->state == SLOT_FAILED) {
+			st->failed = 1;
+			break;
+		}
+		if (s->state == SLOT_PENDING) {
+			if (!wait)
+				break;
+			g_cond_wait(&st->cond, &st->lock);
+			continue;
+		}
+
+		/* Nothing else touches a slot once it is done */
+		g_mutex_unlock(&st->lock);
+		write_slot(st, s);
+		g_mutex_lock(&st->lock);
+
+		st->head = (st->head + 1) % STREAM_WINDOW;
+		st->n--;
+		wait = 0;
+	}
+
+	g_mutex_unlock(&st->lock);
+
+	if (g_get_monotonic_time() - st->saved >= STREAM_CHECKPOINT_MS * 1000)
+		checkpoint(st);
+}
+
+/*
+ * Write out a slot, whitespace first, and empty it.
+ */
+static void
+write_slot(struct stream *st, struct slot *s)
+{
+	size_t	len;
+
+	fwrite(s->ws, 1, s->wslen, st->out);
+	st->out_done += s->wslen;
+	if (s->result != NULL) {
+		len = strlen(s->result);
+		fwrite(s->result, 1, len, st->out);
+		st->out_done += len;
+	}
+	st->in_done = s->in_end;
+
+	free(s->ws);
+	free(s->result);
+	s->ws = s->result = NULL;
+}
+
+/*
+ * Save how far the input has been read and the output written, once the
+ * output is safely on disk. The checkpoint is replaced whole, so that it is
+ * never seen half-written.
+ *
+ * RETURN: 0 on success, -1 on failure.
+ */
+static int
+checkpoint(struct stream *st)
+{
+	FILE	*f;
+	char	*tmp;
+	int	 ret;
+
+	st->saved = g_get_monotonic_time();
+
+	if (fflush(st->out) == EOF || fsync(fileno(st->out)) == -1) {
+		warn("checkpoint");
+		return -1;
+	}
+
+	if (asprintf(&tmp, "%s.tmp", st->ckpt) == -1)
+		err(1, "asprintf");
+
+	ret = -1;
+	if ((f = fopen(tmp, "w")) == NULL) {
+		warn("%s", tmp);
+		goto done;
+	}
+	fprintf(f, "%s %s %lld %lld\n", st->src_lang, st->dst_lang,
+	    (long long)st->in_done, (long long)st->out_done);
+	if (fflush(f) == EOF || fsync(fileno(f)) == -1) {
+		warn("%s", tmp);
+		fclose(f);
+		goto done;
+	}
+	fclose(f);
+
+	if (rename(tmp, st->ckpt) == -1) {
+		warn("%s", st->ckpt);
+		goto done;
+	}
+	ret = 0;
+
+done:
+	free(tmp);
+	return ret;
+}
+
+/*
+ * Keep the translation of a segment in its slot, and remember it. This runs
+ * on a batcher's thread.
+ */
+static void
+slot_result(const char *translation, void *data)
+{
+	struct slot	*s;
+	struct stream	*st;
+	const char	*text;
+	char		*result;
+	gsize		 len;
+
+	s = (struct slot *)data;
+	st = s->st;
+
+	result = NULL;
+	if (translation != NULL) {
+		if ((result = strdup(translation)) == NULL)
+			err(1, "strdup");
+		text = g_bytes_get_data(s->text, &len);
+		cache_put(st->src_lang, st->dst_lang, text, len, translation);
+	}
+
+	g_mutex_lock(&st->lock);
+	g_bytes_unref(s->text);
+	s->text = NULL;
+	s->result = result;
+	s->state = result != NULL ? SLOT_DONE : SLOT_FAILED;
+	g_cond_broadcast(&st->cond);
+	g_mutex_unlock(&st->lock);
+}
@@ -0,0 +1,18 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+/* How much of the input to hold at once; more than any segment */
+#define STREAM_BUF_SIZE		(64 * 1024)
+
+/* The most segments read but not yet written out */
+#define STREAM_WINDOW		256
+
+/* How many batchers send at once */
+#define STREAM_SENDERS		4
+
+/* How often to record how far the output has got */
+#define STREAM_CHECKPOINT_MS	1000
+
+int	stream_file(const char *, const char *, const char *, const char *);
+
+#endif /* !STREAM_H */
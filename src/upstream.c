@@ -0,0 +1,1053 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <curl/curl.h>
+#include <json-glib/json-glib.h>
+
+#include "compat.h"
+#include "extern.h"
+#include "limit.h"
+#include "membuf.h"
+#include "metrics.h"
+#include "progress.h"
+#include "rawjson.h"
+#include "upstream.h"
+
+#define TRANS_URL_FMT "https://translate.google.com/translate_a/single?client=t&sl=%s&tl=%s&dt=bd&dt=t&dt=at"
+
+#define PREWARM_URL "https://translate.google.com/"
+
+#define USER_AGENT "User-Agent: Mozilla/5.0 (X11; Linux i686; rv:10.0.12) Gecko/20100101 Firefox/10.0.12 Iceweasel/10.0.12"
+
+#define BACKOFF_BASE_MS		250	/* The first retry waits up to this */
+#define BACKOFF_CAP_MS		4000	/* No retry waits longer than this */
+#define MAX_PREEMPTS		3	/* Then a request keeps its slot */
+#define LATENCY_SAMPLES		64	/* How many latencies make the p95 */
+#define HEDGE_MIN_SAMPLES	16	/* Don't hedge on less than this */
+
+/*
+ * Where a transfer is in form-encoding its POST body. The text is escaped
+ * straight into curl's upload buffer as curl asks for it, so the body never
+ * exists as a whole.
+ */
+struct form_reader {
+	GBytes	**q;		/* The "q" fields */
+	size_t	  nq;		/* How many there are */
+	size_t	  field;	/* The field being read */
+	size_t	  pos;		/* How far into it; 0 before its "q=" */
+	int	  named;	/* Whether its "q=" has been read */
+};
+
+/*
+ * One copy of a request in flight. There are two of these when a request is
+ * hedged.
+ */
+struct transfer {
+	CURL		*handle;		/* The curl easy handle */
+	struct mem_buf	*resp;			/* The response body */
+	gint64		 start;			/* When it was sent */
+	gint64		 end;			/* When it finished */
+	CURLcode	 code;			/* How it finished */
+	int		 attached;		/* Whether it is still running */
+	gint64		 units;			/* Its worth as progress */
+	gint64		 credit;		/* How much of that is shown */
+	struct form_reader body;		/* Its own place in the body */
+	char		 errbuf[CURL_ERROR_SIZE];	/* What went wrong */
+};
+
+/*
+ * The deadlines and retry policy, set from the environment.
+ */
+static struct {
+	long	connect_ms;	/* How long to wait for a connection */
+	long	total_ms;	/* How long to wait for the whole transfer */
+	int	retries;	/* How many times to retry a transient failure */
+	int	hedge;		/* Whether to hedge slow requests */
+} opts = { 10000, 30000, 3, 0 };
+
+/*
+ * A ring of recent successful latencies, in milliseconds.
+ */
+static struct {
+	GMutex	lock;
+	gint64	ms[LATENCY_SAMPLES];
+	size_t	n;
+	size_t	next;
+} latency;
+
+/*
+ * What every request shares with the others, whatever thread it runs on:
+ * open connections, DNS answers, and TLS sessions. Requests that run at the
+ * same time, such as one for each target language, then reuse each other's
+ * connections instead of each opening their own.
+ */
+static CURLSH	*share;
+static GMutex	 share_locks[CURL_LOCK_DATA_LAST];
+
+/*
+ * The connection opened ahead of the first request. Until it is open, or
+ * has failed, requests wait for it rather than racing it with one of their
+ * own.
+ */
+static struct {
+	GMutex	lock;
+	GCond	cond;
+	int	busy;	/* Whether it is still being opened */
+} prewarm;
+
+static void	 lock_share(CURL *, curl_lock_data, curl_lock_access, void *);
+static void	 unlock_share(CURL *, curl_lock_data, void *);
+static gpointer	 prewarm_func(gpointer);
+static void	 wait_prewarm(void);
+static CURLcode	 perform(CURL *, const struct form_reader *, enum limit_class,
+    int, struct mem_buf **, long *, char *);
+static CURL	*start_transfer(CURLM *, struct transfer *, CURL *,
+    const struct form_reader *, enum limit_class, int);
+static int	 transient(CURLcode, long);
+static enum limit_outcome outcome(CURLcode, long);
+static void	 backoff(int);
+static void	 record_latency(gint64);
+static void	 record_transfer(CURL *);
+static gint64	 hedge_delay(void);
+static long	 env_ms(const char *, long);
+static int	 cmp_gint64(const void *, const void *);
+static curl_off_t form_len(GBytes **, size_t);
+static size_t	 read_form(char *, size_t, size_t, void *);
+static int	 xferinfo(void *, curl_off_t, curl_off_t, curl_off_t,
+    curl_off_t);
+static int	 seek_form(void *, curl_off_t, int);
+static int	 demux_sentences(JsonArray *, GBytes **, size_t, char **);
+static size_t	 count_visible(const char *, size_t);
+static char	*trim_dup(const char *, size_t);
+
+/*
+ * Read the deadlines and retry policy from the environment:
+ *
+ * IDIOM_CONNECT_TIMEOUT: seconds to wait for a connection.
+ * IDIOM_TIMEOUT: seconds to wait for a whole transfer.
+ * IDIOM_RETRIES: how many times to retry a transient failure.
+ * IDIOM_HEDGE: if set to 1, send a second copy of any request that is
+ * slower than 95% of recent ones, and take whichever answers first.
+ */
+void
+upstream_init(void)
+{
+	const char	*s;
+
+	opts.connect_ms = env_ms("IDIOM_CONNECT_TIMEOUT", opts.connect_ms);
+	opts.total_ms = env_ms("IDIOM_TIMEOUT", opts.total_ms);
+
+	if ((s = getenv("IDIOM_RETRIES")) != NULL && *s != '\0')
+		opts.retries = MAX(atoi(s), 0);
+	if ((s = getenv("IDIOM_HEDGE")) != NULL && *s != '\0')
+		opts.hedge = atoi(s) != 0;
+
+	if ((share = curl_share_init()) == NULL)
+		errx(1, "curl_share_init");
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock_share);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock_share);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+/*
+ * Start connecting to the backend in the background: look up its address,
+ * connect, and do the TLS handshake, with a HEAD request whose connection
+ * is then kept open, shared, for the first real request to use. This
+ * overlaps the slow part of the first translation with starting up.
+ */
+void
+upstream_prewarm(void)
+{
+	GThread	*thr;
+
+	prewarm.busy = 1;
+	thr = g_thread_new("prewarm", prewarm_func, NULL);
+	g_thread_unref(thr);
+}
+
+/*
+ * RETURN: the number of bytes that the text takes up as a "q=" form field,
+ * including the "&" that joins it to the field before it.
+ */
+size_t
+upstream_field_len(const char *text, size_t len)
+{
+	size_t		 i, n;
+	unsigned char	 c;
+
+	n = 3;
+	for (i = 0; i < len; i++) {
+		c = (unsigned char)text[i];
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		    (c >= '0' && c <= '9') || c == '-' || c == '.' ||
+		    c == '_' || c == '~')
+			n++;
+		else
+			n += 3;
+	}
+
+	return n;
+}
+
+/*
+ * Translate nq pieces of text from the source language to the destination
+ * language in a single request, of class cls. Each piece is sent as its
+ * own "q" field, read straight out of q as the request goes out.
+ *
+ * On success out[i] holds the newly-allocated translation of q[i], and, if
+ * raw is not NULL, *raw holds the whole response, for anyone who wants more
+ * from it than the translation. Only the translation is parsed here.
+ *
+ * RETURN: 0 on success, -1 on failure.
+ */
+int
+upstream_translate(const char *src_lang, const char *dst_lang, GBytes **q,
+    size_t nq, char **out, char **raw, enum limit_class cls)
+{
+	char	*resp;
+	size_t	 i, len;
+	int	 ret;
+
+	for (i = 0; i < nq; i++)
+		out[i] = NULL;
+
+	if (upstream_fetch(src_lang, dst_lang, q, nq, &resp, &len, cls) == -1)
+		return -1;
+
+	if ((ret = upstream_parse(resp, len, q, nq, out)) == 0 &&
+	    raw != NULL)
+		*raw = resp;
+	else
+		free(resp);
+
+	return ret;
+}
+
+/*
+ * Send nq pieces of text off for translation in a single request, without
+ * looking at the answer; upstream_parse() takes it from there. Each piece is
+ * form-encoded straight into curl's buffer as the request goes out. The
+ * request waits its turn among others of class cls; a background request
+ * that is preempted backs off and waits its turn again, up to MAX_PREEMPTS
+ * times, after which it keeps its slot to the end.
+ *
+ * RETURN: 0 on success, with raw set to the NUL-terminated response, to be
+ * freed by the caller, and len to its length; -1 on failure.
+ */
+int
+upstream_fetch(const char *src_lang, const char *dst_lang, GBytes **q,
+    size_t nq, char **raw, size_t *rawlen, enum limit_class cls)
+{
+	CURL			*handle;
+	CURLcode		 code;
+	struct curl_slist	*headers;
+	struct form_reader	 body;
+	char			*url;
+	char			 errbuf[CURL_ERROR_SIZE];
+	size_t			 len;
+	struct mem_buf		*raw_json;
+	long			 status;
+	int			 ret, attempt, preempts;
+
+	ret = -1;
+	headers = NULL;
+	url = NULL;
+	raw_json = NULL;
+
+	/* get the translation JSON */
+
+	if ((handle = curl_easy_init()) == NULL) {
+		xwarn("curl_easy_init failed");
+		goto done;
+	}
+
+	memset(&body, 0, sizeof(body));
+	body.q = q;
+	body.nq = nq;
+
+	len = strlen(TRANS_URL_FMT) + strlen(src_lang) + strlen(dst_lang) + 1;
+	if ((url = calloc(len, sizeof(char))) == NULL)
+		err(1, "calloc");
+	snprintf(url, len, TRANS_URL_FMT, src_lang, dst_lang);
+
+	if ((headers = curl_slist_append(headers, "User-Agent: "USER_AGENT)) == NULL) {
+		xwarn("curl_slist_append");
+		goto done;
+	}
+
+	curl_easy_setopt(handle, CURLOPT_URL, url);
+	curl_easy_setopt(handle, CURLOPT_SHARE, share);
+	curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, accumulate_mem_buf);
+	curl_easy_setopt(handle, CURLOPT_POST, 1);
+	curl_easy_setopt(handle, CURLOPT_READFUNCTION, read_form);
+	curl_easy_setopt(handle, CURLOPT_SEEKFUNCTION, seek_form);
+	curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, form_len(q, nq));
+	curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, opts.connect_ms);
+	curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, opts.total_ms);
+	curl_easy_setopt(handle, CURLOPT_VERBOSE, 0);
+
+	wait_prewarm();
+
+	for (attempt = preempts = 0;; attempt++) {
+		code = perform(handle, &body, cls, preempts < MAX_PREEMPTS,
+		    &raw_json, &status, errbuf);
+		if (code == CURLE_OK && status == 200)
+			break;
+
+		/* Preempted: not a failure, just back in line after a while */
+		if (code == CURLE_ABORTED_BY_CALLBACK) {
+			mem_buf_free(raw_json);
+			raw_json = NULL;
+			backoff(preempts++);
+			attempt--;
+			continue;
+		}
+
+		if (attempt >= opts.retries || !transient(code, status)) {
+			if (code != CURLE_OK)
+				xwarn("curl: %s", *errbuf != '\0' ? errbuf :
+				    curl_easy_strerror(code));
+			else
+				xwarn("HTTP status %ld", status);
+			goto done;
+		}
+
+		mem_buf_free(raw_json);
+		raw_json = NULL;
+		metrics_add(METRIC_RETRIES, 1);
+		backoff(attempt);
+	}
+
+	if (raw_json->size == 0) {
+		xwarn("empty response");
+		goto done;
+	}
+
+	*raw = raw_json->mem;
+	*rawlen = raw_json->size;
+	raw_json->mem = NULL;
+	ret = 0;
+
+done:
+	if (ret == -1)
+		metrics_add(METRIC_FAILURES, 1);
+	curl_easy_cleanup(handle);
+	curl_slist_free_all(headers);
+
+	free(url);
+	mem_buf_free(raw_json);
+
+	return ret;
+}
+
+/*
+ * Pull the translations of the nq pieces of text in q out of a response.
+ * Only the sentences, the first element, are parsed.
+ *
+ * RETURN: 0 on success, with out[i] holding the newly-allocated translation
+ * of q[i]; -1 on failure.
+ */
+int
+upstream_parse(const char *raw, size_t len, GBytes **q, size_t nq,
+    char **out)
+{
+	JsonParser	*parser;
+	GError		*error;
+	JsonNode	*root;
+	char		*first;
+	size_t		 off, first_len;
+	gint64		 start;
+	int		 ret;
+
+	ret = -1;
+	parser = NULL;
+	first = NULL;
+	start = g_get_monotonic_time();
+
+	if (rawjson_element(raw, len, 0, &off, &first_len) == -1 ||
+	    (first = rawjson_dup(raw + off, first_len)) == NULL) {
+		xwarn("malformed response");
+		goto done;
+	}
+
+	error = NULL;
+	parser = json_parser_new();
+	if (!json_parser_load_from_data(parser, first, -1, &error)) {
+		xwarn("json_parser_load_from_data: %s", error->message);
+		g_error_free(error);
+		goto done;
+	}
+
+	root = json_parser_get_root(parser);
+	if (!JSON_NODE_HOLDS_ARRAY(root)) {
+		xwarn("malformed response");
+		goto done;
+	}
+
+	ret = demux_sentences(json_node_get_array(root), q, nq, out);
+
+done:
+	free(first);
+	if (parser != NULL)
+		g_object_unref(parser);
+
+	metrics_observe(PHASE_PARSE, g_get_monotonic_time() - start);
+	if (ret == -1)
+		metrics_add(METRIC_FAILURES, 1);
+
+	return ret;
+}
+
+/*
+ * Open the connection ahead of the first request, then let any request
+ * waiting for it go. Whether the HEAD request succeeds does not matter;
+ * only the connection it leaves behind does. It gets no longer than a
+ * connection is allowed.
+ */
+static gpointer
+prewarm_func(gpointer data)
+{
+	CURL	*handle;
+
+	if ((handle = curl_easy_init()) != NULL) {
+		curl_easy_setopt(handle, CURLOPT_URL, PREWARM_URL);
+		curl_easy_setopt(handle, CURLOPT_SHARE, share);
+		curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
+		curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS,
+		    opts.connect_ms);
+		curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, opts.connect_ms);
+		curl_easy_perform(handle);
+		curl_easy_cleanup(handle);
+	}
+
+	g_mutex_lock(&prewarm.lock);
+	prewarm.busy = 0;
+	g_cond_broadcast(&prewarm.cond);
+	g_mutex_unlock(&prewarm.lock);
+
+	return NULL;
+}
+
+/*
+ * Wait for the connection opened ahead of time, if it is still on its way.
+ * It is as far along as a new one would be, or further.
+ */
+static void
+wait_prewarm(void)
+{
+	g_mutex_lock(&prewarm.lock);
+	while (prewarm.busy)
+		g_cond_wait(&prewarm.cond, &prewarm.lock);
+	g_mutex_unlock(&prewarm.lock);
+}
+
+/*
+ * Take the lock on one kind of shared data, for curl.
+ */
+static void
+lock_share(CURL *handle, curl_lock_data data, curl_lock_access access,
+    void *user)
+{
+	g_mutex_lock(&share_locks[data]);
+}
+
+/*
+ * Release the lock on one kind of shared data, for curl.
+ */
+static void
+unlock_share(CURL *handle, curl_lock_data data, void *user)
+{
+	g_mutex_unlock(&share_locks[data]);
+}
+
+/*
+ * Run the transfer on the handle to completion. If hedging is on and the
+ * transfer is slower than the recent p95, start a copy of it; whichever
+ * finishes first wins and the other is cancelled.
+ *
+ * Each copy takes its own slot of class cls from the limiter. The first
+ * waits for one; the hedge is only sent if a slot is free right away. Each
+ * also reads the POST body from the start for itself. Background transfers
+ * are never hedged, and are stopped if the limiter preempts them, unless
+ * preemptible is 0.
+ *
+ * RETURN: the curl result of the winning transfer, or
+ * CURLE_ABORTED_BY_CALLBACK if it was preempted. Its response body, HTTP
+ * status, and error message are stored into resp, status, and errbuf.
+ */
+static CURLcode
+perform(CURL *handle, const struct form_reader *body, enum limit_class cls,
+    int preemptible, struct mem_buf **resp, long *status, char *errbuf)
+{
+	CURLM		*multi;
+	CURLMsg		*msg;
+	CURLcode	 code;
+	struct transfer	 t[2];
+	gint64		 now, delay, hedge_at;
+	long		 st;
+	size_t		 i, n, live, winner;
+	guint		 ticket;
+	int		 running, left, wait_ms, preempted;
+
+	if ((multi = curl_multi_init()) == NULL)
+		errx(1, "curl_multi_init");
+
+	memset(t, 0, sizeof(t));
+	ticket = limit_acquire(cls);
+	start_transfer(multi, &t[0], handle, body, cls, 0);
+	n = live = 1;
+	winner = 0;
+	code = CURLE_OK;
+	preempted = 0;
+
+	delay = opts.hedge && cls != LIMIT_BACKGROUND ? hedge_delay() : -1;
+	hedge_at = delay >= 0 ? t[0].start + delay * 1000 : -1;
+
+	for (;;) {
+		curl_multi_perform(multi, &running);
+
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			i = msg->easy_handle == t[0].handle ? 0 : 1;
+			curl_multi_remove_handle(multi, t[i].handle);
+			t[i].attached = 0;
+			t[i].end = g_get_monotonic_time();
+			t[i].code = msg->data.result;
+			live--;
+
+			/* A failed copy can still be saved by the other one */
+			if (msg->data.result == CURLE_OK || live == 0) {
+				winner = i;
+				code = msg->data.result;
+				goto done;
+			}
+		}
+
+		if (preemptible && limit_preempted(cls, ticket)) {
+			code = CURLE_ABORTED_BY_CALLBACK;
+			preempted = 1;
+			goto done;
+		}
+
+		now = g_get_monotonic_time();
+		if (n == 1 && hedge_at >= 0 && now >= hedge_at) {
+			if (limit_try_acquire(cls)) {
+				if (start_transfer(multi, &t[1], handle, body,
+				    cls, 1) != NULL) {
+					metrics_add(METRIC_HEDGES, 1);
+					n++;
+					live++;
+				} else
+					limit_release(cls, 0, LIMIT_IGNORE);
+			}
+			hedge_at = -1;
+		}
+
+		wait_ms = cls == LIMIT_BACKGROUND ? LIMIT_POLL_MS : 1000;
+		if (hedge_at >= 0)
+			wait_ms = MIN(wait_ms, (hedge_at - now) / 1000 + 1);
+		curl_multi_wait(multi, NULL, 0, wait_ms, NULL);
+	}
+
+done:
+	*status = 0;
+	curl_easy_getinfo(t[winner].handle, CURLINFO_RESPONSE_CODE, status);
+
+	/* Errors and refusals come back fast, and would pull the p95 down */
+	if (code == CURLE_OK && *status == 200)
+		record_latency((g_get_monotonic_time() - t[winner].start) / 1000);
+	memcpy(errbuf, t[winner].errbuf, CURL_ERROR_SIZE);
+	*resp = t[winner].resp;
+
+	for (i = 0; i < n; i++) {
+		progress_advance(-t[i].credit);
+		if (t[i].attached) {
+			curl_multi_remove_handle(multi, t[i].handle);
+			limit_release(cls, 0, LIMIT_IGNORE);
+			metrics_add(preempted ? METRIC_PREEMPTED :
+			    METRIC_CANCELLED, 1);
+		} else {
+			record_transfer(t[i].handle);
+			curl_easy_getinfo(t[i].handle, CURLINFO_RESPONSE_CODE,
+			    &st);
+			limit_release(cls, (t[i].end - t[i].start) / 1000,
+			    outcome(t[i].code, st));
+		}
+		if (i != winner)
+			mem_buf_free(t[i].resp);
+		if (t[i].handle != handle)
+			curl_easy_cleanup(t[i].handle);
+	}
+	curl_multi_cleanup(multi);
+	curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, NULL);
+
+	return code;
+}
+
+/*
+ * Start a transfer of class cls on the multi handle. The first transfer
+ * uses the handle itself; a hedge runs on a duplicate of it.
+ *
+ * RETURN: the easy handle now running, or NULL if it could not start.
+ */
+static CURL *
+start_transfer(CURLM *multi, struct transfer *t, CURL *handle,
+    const struct form_reader *body, enum limit_class cls, int dup)
+{
+	if (!dup)
+		t->handle = handle;
+	else if ((t->handle = curl_easy_duphandle(handle)) == NULL)
+		return NULL;
+
+	t->body = *body;
+	t->resp = mem_buf_new();
+	t->errbuf[0] = '\0';
+	/*
+	 * A hedge shows no progress of its own, or it would count twice, and
+	 * nor does a background transfer: nobody is waiting on it
+	 */
+	if (dup || cls == LIMIT_BACKGROUND)
+		t->units = 0;
+	else
+		t->units = (gint64)body->nq * PROGRESS_UNIT;
+	t->credit = 0;
+	if (progress_on()) {
+		curl_easy_setopt(t->handle, CURLOPT_XFERINFOFUNCTION, xferinfo);
+		curl_easy_setopt(t->handle, CURLOPT_XFERINFODATA, t);
+		curl_easy_setopt(t->handle, CURLOPT_NOPROGRESS, 0L);
+	}
+	curl_easy_setopt(t->handle, CURLOPT_READDATA, &t->body);
+	curl_easy_setopt(t->handle, CURLOPT_SEEKDATA, &t->body);
+	curl_easy_setopt(t->handle, CURLOPT_WRITEDATA, t->resp);
+	curl_easy_setopt(t->handle, CURLOPT_ERRORBUFFER, t->errbuf);
+	t->start = g_get_monotonic_time();
+
+	if (curl_multi_add_handle(multi, t->handle) != CURLM_OK) {
+		if (!dup)
+			errx(1, "curl_multi_add_handle");
+		curl_easy_cleanup(t->handle);
+		mem_buf_free(t->resp);
+		t->handle = NULL;
+		t->resp = NULL;
+		return NULL;
+	}
+	t->attached = 1;
+	metrics_add(METRIC_REQUESTS, 1);
+
+	return t->handle;
+}
+
+/*
+ * RETURN: whether the failure is worth retrying: the connection broke or
+ * timed out, the server had a problem of its own, or it asked us to slow
+ * down.
+ */
+static int
+transient(CURLcode code, long status)
+{
+	switch (code) {
+	case CURLE_OK:
+		return status == 429 || status >= 500;
+	case CURLE_COULDNT_RESOLVE_HOST:
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_SSL_CONNECT_ERROR:
+	case CURLE_GOT_NOTHING:
+	case CURLE_PARTIAL_FILE:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * RETURN: what the result of a transfer says about the backend's capacity.
+ * Throttling, server errors, and timeouts all mean it has had enough.
+ */
+static enum limit_outcome
+outcome(CURLcode code, long status)
+{
+	switch (code) {
+	case CURLE_OK:
+		if (status == 429 || status >= 500)
+			return LIMIT_DROP;
+		return status < 400 ? LIMIT_OK : LIMIT_IGNORE;
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_OPERATION_TIMEDOUT:
+		return LIMIT_DROP;
+	default:
+		return LIMIT_IGNORE;
+	}
+}
+
+/*
+ * Sleep before the next retry: a random time up to an exponentially growing
+ * cap, so that clients which failed together do not retry together.
+ */
+static void
+backoff(int attempt)
+{
+	gint64	cap;
+
+	cap = BACKOFF_BASE_MS << MIN(attempt, 16);
+	cap = MIN(cap, BACKOFF_CAP_MS);
+
+	g_usleep(g_random_int_range(0, cap + 1) * 1000);
+}
+
+/*
+ * Remember how long a successful transfer took.
+ */
+static void
+record_latency(gint64 ms)
+{
+	g_mutex_lock(&latency.lock);
+	latency.ms[latency.next] = ms;
+	latency.next = (latency.next + 1) % LATENCY_SAMPLES;
+	if (latency.n < LATENCY_SAMPLES)
+		latency.n++;
+	g_mutex_unlock(&latency.lock);
+}
+
+/*
+ * Record how long each phase of a finished transfer took, and how much it
+ * sent and received. curl gives the time from the start to the end of each
+ * phase, so each phase is the difference from the one before; a reused
+ * connection has no DNS, connect, or TLS phase.
+ */
+static void
+record_transfer(CURL *handle)
+{
+	double		dns, conn, tls, pre, first, total;
+	curl_off_t	up, down;
+
+	dns = conn = tls = pre = first = total = 0;
+	up = down = 0;
+	curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME, &dns);
+	curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME, &conn);
+	curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME, &tls);
+	curl_easy_getinfo(handle, CURLINFO_PRETRANSFER_TIME, &pre);
+	curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &first);
+	curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &total);
+	curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD_T, &up);
+	curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &down);
+
+	if (conn > 0) {
+		metrics_observe(PHASE_DNS, dns * 1e6);
+		metrics_observe(PHASE_CONNECT, (conn - dns) * 1e6);
+	}
+	if (tls > 0)
+		metrics_observe(PHASE_TLS, (tls - conn) * 1e6);
+	if (first > 0) {
+		metrics_observe(PHASE_WAIT, (first - pre) * 1e6);
+		metrics_observe(PHASE_RECEIVE, (total - first) * 1e6);
+	}
+	metrics_observe(PHASE_TOTAL, total * 1e6);
+
+	metrics_add(METRIC_BYTES_SENT, up);
+	metrics_add(METRIC_BYTES_RECEIVED, down);
+}
+
+/*
+ * RETURN: the p95 of recent latencies in milliseconds, which is how long to
+ * wait before hedging, or -1 if there are too few to go on.
+ */
+static gint64
+hedge_delay(void)
+{
+	gint64	ms[LATENCY_SAMPLES];
+	size_t	n;
+
+	g_mutex_lock(&latency.lock);
+	n = latency.n;
+	memcpy(ms, latency.ms, sizeof(ms));
+	g_mutex_unlock(&latency.lock);
+
+	if (n < HEDGE_MIN_SAMPLES)
+		return -1;
+
+	qsort(ms, n, sizeof(gint64), cmp_gint64);
+	return ms[(n * 95) / 100];
+}
+
+/*
+ * RETURN: the environment variable, in seconds, converted to milliseconds,
+ * or def if it is unset or not a positive number.
+ */
+static long
+env_ms(const char *name, long def)
+{
+	const char	*s;
+	char		*end;
+	double		 secs;
+
+	if ((s = getenv(name)) == NULL || *s == '\0')
+		return def;
+
+	secs = strtod(s, &end);
+	if (*end != '\0' || secs <= 0) {
+		warnx("%s: invalid number of seconds: %s", name, s);
+		return def;
+	}
+
+	return (long)(secs * 1000);
+}
+
+/*
+ * Show a transfer's progress as part of its segments' worth: half for the
+ * request going out, and half for the response coming in, if its length is
+ * known. Whatever is shown is taken back when the transfer ends, and the
+ * segments are counted whole as their translations are handed over.
+ *
+ * RETURN: 0, so the transfer goes on.
+ */
+static int
+xferinfo(void *data, curl_off_t dltotal, curl_off_t dlnow,
+    curl_off_t ultotal, curl_off_t ulnow)
+{
+	struct transfer	*t;
+	double		 frac;
+	gint64		 credit;
+
+	t = (struct transfer *)data;
+
+	frac = 0;
+	if (ultotal > 0)
+		frac += 0.5 * ulnow / ultotal;
+	if (dltotal > 0)
+		frac += 0.5 * dlnow / dltotal;
+
+	credit = t->units * MIN(frac, 1.0);
+	progress_advance(credit - t->credit);
+	t->credit = credit;
+
+	return 0;
+}
+
+/*
+ * Compare two gint64s, for qsort(3).
+ */
+static int
+cmp_gint64(const void *a, const void *b)
+{
+	gint64	x, y;
+
+	x = *(const gint64 *)a;
+	y = *(const gint64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * RETURN: the length of the POST body: "q=one&q=two&q=three".
+ */
+static curl_off_t
+form_len(GBytes **q, size_t nq)
+{
+	curl_off_t	len;
+	size_t		i;
+
+	for (i = 0, len = 0; i < nq; i++)
+		len += upstream_field_len(g_bytes_get_data(q[i], NULL),
+		    g_bytes_get_size(q[i]));
+
+	return len > 0 ? len - 1 : 0;
+}
+
+/*
+ * Form-encode as much of the POST body as fits into buf, picking up where
+ * the last call left off. Each character is escaped whole or not at all,
+ * which curl's buffer is always big enough for.
+ *
+ * RETURN: how many bytes were written; 0 at the end of the body.
+ */
+static size_t
+read_form(char *buf, size_t size, size_t nitems, void *data)
+{
+	static const char	 hex[] = "0123456789ABCDEF";
+	struct form_reader	*r;
+	const unsigned char	*text;
+	size_t			 n, room, len;
+	unsigned char		 c;
+
+	r = (struct form_reader *)data;
+	room = size * nitems;
+	n = 0;
+
+	for (; r->field < r->nq; r->field++, r->pos = 0, r->named = 0) {
+		if (!r->named) {
+			len = r->field == 0 ? 2 : 3;
+			if (room - n < len)
+				return n;
+			memcpy(buf + n, r->field == 0 ? "q=" : "&q=", len);
+			n += len;
+			r->named = 1;
+		}
+
+		text = g_bytes_get_data(r->q[r->field], &len);
+		for (; r->pos < len; r->pos++) {
+			if (room - n < 3)
+				return n;
+			c = text[r->pos];
+			if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+			    (c >= '0' && c <= '9') || c == '-' || c == '.' ||
+			    c == '_' || c == '~')
+				buf[n++] = c;
+			else {
+				buf[n++] = '%';
+				buf[n++] = hex[c >> 4];
+				buf[n++] = hex[c & 0xf];
+			}
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Rewind the POST body, for when curl has to send it again. Only going
+ * back to the start is needed.
+ *
+ * RETURN: whether that worked, as curl wants to know.
+ */
+static int
+seek_form(void *data, curl_off_t offset, int origin)
+{
+	struct form_reader	*r;
+
+	r = (struct form_reader *)data;
+
+	if (offset != 0 || origin != SEEK_SET)
+		return CURL_SEEKFUNC_CANTSEEK;
+
+	r->field = r->pos = 0;
+	r->named = 0;
+	return CURL_SEEKFUNC_OK;
+}
+
+/*
+ * Hand each translated sentence back to the piece of text it came from.
+ *
+ * The backend joins all the "q" fields into one text and answers with a
+ * single array of [translation, original, ...] sentences. Walk that array,
+ * using the length of each original sentence to tell when one piece of text
+ * has been used up and the next begins. Whitespace is not counted, since the
+ * backend is free to change it where the pieces were joined.
+ *
+ * RETURN: 0 on success, -1 if the response does not have that shape.
+ */
+static int
+demux_sentences(JsonArray *sentences, GBytes **q, size_t nq, char **out)
+{
+	struct mem_buf	**bufs;
+	JsonArray	 *pair;
+	JsonNode	 *node;
+	const gchar	 *value, *orig;
+	size_t		  i, cur, left, vis;
+	guint		  n, len;
+
+	if (sentences == NULL || nq == 0) {
+		xwarn("unexpected response");
+		return -1;
+	}
+
+	if ((bufs = reallocarray(NULL, nq, sizeof(struct mem_buf *))) == NULL)
+		err(1, "reallocarray");
+	for (i = 0; i < nq; i++)
+		bufs[i] = mem_buf_new();
+
+	cur = 0;
+	left = count_visible(g_bytes_get_data(q[0], NULL),
+	    g_bytes_get_size(q[0]));
+	len = json_array_get_length(sentences);
+
+	for (n = 0; n < len; n++) {
+		node = json_array_get_element(sentences, n);
+		if (!JSON_NODE_HOLDS_ARRAY(node))
+			continue;
+		pair = json_node_get_array(node);
+		if (json_array_get_length(pair) < 2)
+			continue;
+
+		node = json_array_get_element(pair, 0);
+		if (!JSON_NODE_HOLDS_VALUE(node) ||
+		    (value = json_node_get_string(node)) == NULL)
+			continue;
+
+		accumulate_mem_buf((char *)value, sizeof(char), strlen(value),
+		    bufs[cur]);
+
+		node = json_array_get_element(pair, 1);
+		if (!JSON_NODE_HOLDS_VALUE(node) ||
+		    (orig = json_node_get_string(node)) == NULL)
+			continue;
+
+		vis = count_visible(orig, strlen(orig));
+		left = vis < left ? left - vis : 0;
+		while (left == 0 && cur + 1 < nq) {
+			cur++;
+			left = count_visible(g_bytes_get_data(q[cur], NULL),
+			    g_bytes_get_size(q[cur]));
+		}
+	}
+
+	for (i = 0; i < nq; i++) {
+		out[i] = trim_dup(bufs[i]->mem, bufs[i]->size);
+		mem_buf_free(bufs[i]);
+	}
+	free(bufs);
+
+	return 0;
+}
+
+/*
+ * RETURN: the number of non-whitespace bytes in the text.
+ */
+static size_t
+count_visible(const char *text, size_t len)
+{
+	size_t	i, n;
+
+	for (i = n = 0; i < len; i++)
+		if (text[i] != ' ' && text[i] != '\t' && text[i] != '\n' &&
+		    text[i] != '\r')
+			n++;
+
+	return n;
+}
+
+/*
+ * RETURN: a newly-allocated copy of the text without leading or trailing
+ * whitespace.
+ */
+static char *
+trim_dup(const char *text, size_t len)
+{
+	char	*s;
+
+	while (len > 0 && (*text == ' ' || *text == '\n'))
+		text++, len--;
+	while (len > 0 && (text[len - 1] == ' ' || text[len - 1] == '\n'))
+		len--;
+
+	if ((s = calloc(len + 1, sizeof(char))) == NULL)
+		err(1, "calloc");
+	memcpy(s, text, len);
+
+	return s;
+}
@@ -0,0 +1,25 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <sys/types.h>
+
+#include <glib.h>
+
+#include "limit.h"
+
+/* The largest form-encoded POST body the backend accepts */
+#define UPSTREAM_MAX_BODY	5000
+
+/* The longest segment, chosen so that any segment fits in one request */
+#define UPSTREAM_MAX_SEGMENT	(UPSTREAM_MAX_BODY / 3 - 3)
+
+void	upstream_init(void);
+void	upstream_prewarm(void);
+size_t	upstream_field_len(const char *, size_t);
+int	upstream_translate(const char *, const char *, GBytes **, size_t,
+	    char **, char **, enum limit_class);
+int	upstream_fetch(const char *, const char *, GBytes **, size_t, char **,
+	    size_t *, enum limit_class);
+int	upstream_parse(const char *, size_t, GBytes **, size_t, char **);
+
+#endif /* !UPSTREAM_H */
@@ -0,0 +1,357 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "cache.h"
+#include "compat.h"
+#include "langid.h"
+#include "limit.h"
+#include "segment.h"
+#include "upstream.h"
+#include "warmup.h"
+
+/*
+ * A phrase list to translate ahead of time, and what into.
+ */
+struct warmup {
+	char		 *path;		/* A file, or a directory of them */
+	char		 *src_lang;	/* The language the phrases are in */
+	char		**dst_langs;	/* The languages to translate into */
+	size_t		  ndst;		/* How many there are */
+};
+
+/*
+ * Segments waiting to go out together, all between one pair of languages.
+ */
+struct pending {
+	const char	 *src_lang;	/* The language they are in */
+	GBytes		**q;		/* The segments */
+	size_t		  nq;		/* How many there are */
+	size_t		  size;		/* How many there is room for */
+	size_t		  body;		/* Their size as a POST body */
+};
+
+/*
+ * Warming up is the lowest priority work there is. It sends one request at
+ * a time, only once nothing else has been in flight, or asked for, for
+ * WARMUP_QUIET_MS; every request still goes through the rate limiter.
+ */
+static gint64	quiet_since;	/* When real work was last asked for */
+
+static gpointer	 warmup_func(gpointer);
+static int	 warm_file(struct warmup *, const char *, struct pending *);
+static int	 warm_phrase(struct warmup *, const char *, size_t,
+    struct pending *);
+static int	 flush(const char *, struct pending *);
+static void	 wait_quiet(void);
+static int	 cmp_str(const void *, const void *);
+static char	*xstrdup(const char *);
+
+/*
+ * Translate every line of the phrase list at path into each of dst_langs,
+ * in the background, and keep the translations in the cache. A directory
+ * stands for every file in it. Lines already cached are skipped, so a
+ * warm-up after the first costs next to nothing.
+ */
+void
+warmup_start(const char *path, const char *src_lang, const char **dst_langs,
+    size_t ndst)
+{
+	struct warmup	*w;
+	GThread		*thr;
+	size_t		 i;
+
+	if ((w = calloc(1, sizeof(struct warmup))) == NULL)
+		err(1, "calloc");
+	if ((w->dst_langs = reallocarray(NULL, ndst, sizeof(char *))) == NULL)
+		err(1, "reallocarray");
+
+	w->path = xstrdup(path);
+	w->src_lang = xstrdup(src_lang);
+	for (i = 0; i < ndst; i++)
+		w->dst_langs[i] = xstrdup(dst_langs[i]);
+	w->ndst = ndst;
+
+	warmup_defer();
+	thr = g_thread_new("warmup", warmup_func, w);
+	g_thread_unref(thr);
+}
+
+/*
+ * Hold the warm-up back: real work has just been asked for.
+ */
+void
+warmup_defer(void)
+{
+	__atomic_store_n(&quiet_since, g_get_monotonic_time(),
+	    __ATOMIC_RELAXED);
+}
+
+/*
+ * Work through the phrase list, then save the cache so the work is kept
+ * even if the program does not exit cleanly.
+ */
+static gpointer
+warmup_func(gpointer data)
+{
+	struct warmup	 *w;
+	struct pending	 *p;
+	struct stat	  sb;
+	struct dirent	 *de;
+	DIR		 *dir;
+	char		**names, *file;
+	size_t		  n, size, i;
+	int		  ok;
+
+	w = (struct warmup *)data;
+	names = NULL;
+	n = size = 0;
+	ok = 1;
+
+	if ((p = calloc(w->ndst, sizeof(struct pending))) == NULL)
+		err(1, "calloc");
+
+	if (stat(w->path, &sb) == -1)
+		warn("%s", w->path);
+	else if (!S_ISDIR(sb.st_mode))
+		ok = warm_file(w, w->path, p);
+	else if ((dir = opendir(w->path)) == NULL)
+		warn("%s", w->path);
+	else {
+		while ((de = readdir(dir)) != NULL) {
+			if (de->d_name[0] == '.')
+				continue;
+			if (n == size) {
+				size = size ? size * 2 : 16;
+				names = reallocarray(names, size,
+				    sizeof(char *));
+				if (names == NULL)
+					err(1, "reallocarray");
+			}
+			names[n++] = xstrdup(de->d_name);
+		}
+		closedir(dir);
+
+		qsort(names, n, sizeof(char *), cmp_str);
+		for (i = 0; i < n && ok; i++) {
+			if (asprintf(&file, "%s/%s", w->path,
+			    names[i]) == -1)
+				err(1, "asprintf");
+			ok = warm_file(w, file, p);
+			free(file);
+		}
+	}
+
+	for (i = 0; i < w->ndst && ok; i++)
+		ok = flush(w->dst_langs[i], &p[i]);
+
+	cache_save();
+
+	for (i = 0; i < w->ndst; i++) {
+		flush(NULL, &p[i]);
+		free(p[i].q);
+		free(w->dst_langs[i]);
+	}
+	for (i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+	free(p);
+	free(w->dst_langs);
+	free(w->src_lang);
+	free(w->path);
+	free(w);
+
+	return NULL;
+}
+
+/*
+ * Warm up every line of one file.
+ *
+ * RETURN: 0 if a request failed, to stop there, otherwise 1.
+ */
+static int
+warm_file(struct warmup *w, const char *path, struct pending *p)
+{
+	FILE	*fp;
+	char	*line;
+	size_t	 size;
+	ssize_t	 len;
+	int	 ok;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		warn("%s", path);
+		return 1;
+	}
+
+	line = NULL;
+	size = 0;
+	ok = 1;
+
+	while (ok && (len = getline(&line, &size, fp)) != -1) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len > 0)
+			ok = warm_phrase(w, line, len, p);
+	}
+
+	if (ferror(fp))
+		warn("%s", path);
+	free(line);
+	fclose(fp);
+
+	return ok;
+}
+
+/*
+ * Queue up the segments of a phrase that are not cached yet, in each
+ * language. The source language is guessed just as it is for text typed
+ * in, so that the cache keys match.
+ *
+ * RETURN: 0 if a request failed, otherwise 1.
+ */
+static int
+warm_phrase(struct warmup *w, const char *text, size_t len,
+    struct pending *p)
+{
+	struct segment	*segs;
+	const char	*src_lang, *guess;
+	char		*hit;
+	size_t		 d, i, n, field;
+	int		 ok;
+
+	n = segment_text(text, len, UPSTREAM_MAX_SEGMENT, &segs);
+	ok = 1;
+
+	for (d = 0; d < w->ndst && ok; d++) {
+		src_lang = w->src_lang;
+		if ((guess = langid_guess(text, len, src_lang)) != NULL &&
+		    strcmp(guess, src_lang) != 0 &&
+		    strcmp(guess, w->dst_langs[d]) != 0)
+			src_lang = guess;
+		if (strcmp(src_lang, w->dst_langs[d]) == 0)
+			continue;
+
+		/* A request carries only one pair of languages */
+		if (p[d].nq > 0 && strcmp(p[d].src_lang, src_lang) != 0)
+			ok = flush(w->dst_langs[d], &p[d]);
+
+		for (i = 0; i < n && ok; i++) {
+			if ((hit = cache_get(src_lang, w->dst_langs[d],
+			    text + segs[i].off, segs[i].len)) != NULL) {
+				free(hit);
+				continue;
+			}
+
+			field = upstream_field_len(text + segs[i].off,
+			    segs[i].len);
+			if (p[d].nq > 0 &&
+			    p[d].body + field > UPSTREAM_MAX_BODY &&
+			    !(ok = flush(w->dst_langs[d], &p[d])))
+				break;
+
+			if (p[d].nq == p[d].size) {
+				p[d].size = MAX(p[d].size * 2, 16);
+				p[d].q = reallocarray(p[d].q, p[d].size,
+				    sizeof(GBytes *));
+				if (p[d].q == NULL)
+					err(1, "reallocarray");
+			}
+			p[d].q[p[d].nq++] = g_bytes_new(text +
+			    segs[i].off, segs[i].len);
+			p[d].src_lang = src_lang;
+			p[d].body += field;
+		}
+	}
+
+	free(segs);
+	return ok;
+}
+
+/*
+ * Send the waiting segments off, once it is quiet, and cache what comes
+ * back. With no language to translate into, just drop them.
+ *
+ * RETURN: 0 if the request failed, otherwise 1.
+ */
+static int
+flush(const char *dst_lang, struct pending *p)
+{
+	char	**out;
+	size_t	  i;
+	int	  ok;
+
+	ok = 1;
+
+	if (dst_lang != NULL && p->nq > 0) {
+		if ((out = calloc(p->nq, sizeof(char *))) == NULL)
+			err(1, "calloc");
+
+		wait_quiet();
+		ok = upstream_translate(p->src_lang, dst_lang, p->q, p->nq,
+		    out, NULL, LIMIT_BACKGROUND) == 0;
+		if (ok)
+			for (i = 0; i < p->nq; i++) {
+				cache_put(p->src_lang, dst_lang,
+				    g_bytes_get_data(p->q[i], NULL),
+				    g_bytes_get_size(p->q[i]), out[i]);
+				free(out[i]);
+			}
+		free(out);
+	}
+
+	for (i = 0; i < p->nq; i++)
+		g_bytes_unref(p->q[i]);
+	p->nq = 0;
+	p->body = 0;
+
+	return ok;
+}
+
+/*
+ * Wait until nothing has been in flight, or asked for, for a while.
+ */
+static void
+wait_quiet(void)
+{
+	gint64	since;
+
+	for (;;) {
+		since = __atomic_load_n(&quiet_since, __ATOMIC_RELAXED);
+		if (g_get_monotonic_time() - since >= WARMUP_QUIET_MS * 1000 &&
+		    limit_idle())
+			return;
+		g_usleep(WARMUP_POLL_MS * 1000);
+	}
+}
+
+/*
+ * Compare two strings through pointers to them, for qsort(3).
+ */
+static int
+cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * RETURN: a copy of the string; exits if there is no memory for one.
+ */
+static char *
+xstrdup(const char *s)
+{
+	char	*copy;
+
+	if ((copy = strdup(s)) == NULL)
+		err(1, "strdup");
+	return copy;
+}
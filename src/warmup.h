@@ -0,0 +1,15 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <sys/types.h>
+
+/* Wait this long after the last real translation before warming up more */
+#define WARMUP_QUIET_MS		2000
+
+/* How often to look for quiet */
+#define WARMUP_POLL_MS		100
+
+void	warmup_start(const char *, const char *, const char **, size_t);
+void	warmup_defer(void);
+
+#endif /* !WARMUP_H */